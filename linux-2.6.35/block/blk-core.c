@@ -1500,6 +1500,21 @@ static inline void __generic_make_request(struct bio *bio)
 		if (bio_check_eod(bio, nr_sectors))
 			goto end_io;
 
+#ifdef CONFIG_BLK_DEV_SCRUB
+		if (bio->bi_bdev->bd_disk->scrubber) {
+			/* Writes and discards change the provisioning of thin
+			 * LUNs, and written data is verified later on */
+			if (bio_data_dir(bio) == WRITE)
+				blk_scrub_written(bio->bi_bdev->bd_disk,
+					bio->bi_sector, nr_sectors,
+					bio_rw_flagged(bio, BIO_RW_DISCARD));
+			/* The read engine's bios aren't foreground ones */
+			if (bio->bi_end_io != scrub_read_end_io)
+				blk_scrub_seen(bio->bi_bdev->bd_disk,
+					bio->bi_sector, nr_sectors);
+		}
+#endif
+
 		if (bio_rw_flagged(bio, BIO_RW_DISCARD) &&
 		    !blk_queue_discard(q)) {
 			err = -EOPNOTSUPP;
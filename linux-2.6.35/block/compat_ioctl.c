@@ -753,6 +753,9 @@ long compat_blkdev_ioctl(struct file *file, unsigned cmd, unsigned long arg)
 	case BLKFLSBUF:
 	case BLKROSET:
 	case BLKDISCARD:
+#ifdef CONFIG_BLK_DEV_SCRUB
+	case BLKSCRUB:
+#endif /* CONFIG_BLK_DEV_SCRUB */
 	/*
 	 * the ones below are implemented in blkdev_locked_ioctl,
 	 * but we call blkdev_ioctl, which gets the lock for us
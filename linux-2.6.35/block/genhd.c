@@ -567,8 +567,15 @@ void add_disk(struct gendisk *disk)
 		case 9:
 		/* 4. User-mode Virtual Block disks */
 		case 98:
+		/* 5. Loopback and network block devices (read engine) */
+		case 7: case 43:
 			blk_register_scrub(disk);
+			break;
 		default:
+			/* Device-mapper and virtio disks have dynamic majors */
+			if (!strncmp(disk->disk_name, "dm-", 3) ||
+			    !strncmp(disk->disk_name, "vd", 2))
+				blk_register_scrub(disk);
 			break;
 	}
 #endif
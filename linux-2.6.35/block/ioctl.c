@@ -238,6 +238,14 @@ int blkdev_ioctl(struct block_device *bdev, fmode_t mode, unsigned cmd,
 		return blk_ioctl_discard(bdev, range[0], range[1]);
 	}
 
+#ifdef CONFIG_BLK_DEV_SCRUB
+	case BLKSCRUB:
+		if (!capable(CAP_SYS_ADMIN))
+			return -EACCES;
+		return blk_scrub_ioctl(bdev,
+			(struct blk_scrub_batch __user *) arg);
+#endif /* CONFIG_BLK_DEV_SCRUB */
+
 	case HDIO_GETGEO: {
 		struct hd_geometry geo;
 
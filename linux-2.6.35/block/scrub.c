@@ -19,9 +19,11 @@
 #include <linux/scrub.h>
 #include <linux/blkdev.h>
 #include <linux/kthread.h>
+#include <linux/ctype.h>
 
-static char *strategies[SCRUB_STRAT_NUM] = {"seql", "stag", "fixed"};
-static char *priorities[SCRUB_PRIO_NUM]  = {"realtime", "idlechk"};
+static char *strategies[SCRUB_STRAT_NUM] = {"seql", "stag", "char", "hybr"};
+static char *priorities[SCRUB_PRIO_NUM]  = {"realtime", "idlechk",
+					    "deadline"};
 
 static struct kobj_type scrubber_ktype;
 
@@ -70,6 +72,10 @@ static struct disk_scrubber *blk_init_scrub(struct gendisk *disk)
 	s->threads = 1;
 	s->dpo = 1;
 	s->vrprotect = 0;
+	s->vcmd = SCRUB_VCMD_AUTO;
+	s->ata_pt = -1;
+	s->engine = SCRUB_ENGINE_AUTO;
+	s->use_read = -1;
 	s->verbose = 1;
 	s->spoint = 0;
 	s->reqcount = 0;
@@ -80,6 +86,72 @@ static struct disk_scrubber *blk_init_scrub(struct gendisk *disk)
 	s->resptime_us = 0;
 	s->delayms = 0;
 
+	s->deadline_s = 0;
+	s->remaining_s = 0;
+	s->completion_s = 0;
+	s->slack_s = 0;
+
+	atomic_set(&s->bad_sectors, 0);
+	s->rescan_radius = 2048;
+	s->rescan_chunk = 128;
+	spin_lock_init(&s->bad_lock);
+	memset(s->bad_recent, 0, sizeof(s->bad_recent));
+
+	s->fsaware = 0;
+	s->free_interval = 4;
+	s->rounds = 0;
+
+	s->meta_period_s = 0;
+	s->meta_next = 0;
+
+	s->thin = SCRUB_THIN_AUTO;
+	s->lbp = -1;
+	spin_lock_init(&s->lbas_lock);
+	memset(s->lbas_lookups, 0, sizeof(s->lbas_lookups));
+
+	s->wverify_delay_s = 0;
+	spin_lock_init(&s->wdirty_lock);
+	s->wdirty_since = 0;
+	s->wverified = 0;
+
+	s->zoned = 0;
+	s->zone_learn = 1;
+	s->zone_idle_ms = 0;
+	s->idle_ios = 0;
+	s->idle_since = jiffies;
+	atomic_long_set(&s->rios, 0);
+	s->idle_rios = 0;
+	s->trackalign = 0;
+	s->stag_order = SCRUB_STAG_LINEAR;
+	s->stag_burst = 1;
+	s->hybrid_idle_ms = 1000;
+	s->parts = 1;
+	s->stripe_kb = 0;
+	s->flash = SCRUB_FLASH_AUTO;
+	s->flash_depth = 32;
+	s->flash_rate_mbs = 0;
+	s->wtime = NULL;
+	atomic64_set(&s->fg_last, 0);
+	s->fg_local = 0;
+	s->weak_factor = 4;
+	s->weak_action = SCRUB_WEAK_NONE;
+	s->nweak = 0;
+
+	atomic_set(&s->recovered, 0);
+	s->recov_region = 262144;
+	s->recov_threshold = 4;
+	s->recov_interval_s = 3600;
+	spin_lock_init(&s->recov_lock);
+	memset(s->recov, 0, sizeof(s->recov));
+
+	s->period_s = 0;
+	s->stagger = 1;
+	s->slot = scrub_sched_slot();
+	s->nwindows = 0;
+
+	INIT_LIST_HEAD(&s->policies);
+	s->part_round = 0;
+
 	/* Allocate memory for strategy names */
 	s->strategy = kmalloc_node(SCRUB_STRAT_NAME_MAX*sizeof(char),
 					GFP_KERNEL | __GFP_ZERO, -1);
@@ -95,6 +167,15 @@ static struct disk_scrubber *blk_init_scrub(struct gendisk *disk)
 	kobject_init(&s->kobj, &scrubber_ktype);
 
 	mutex_init(&s->sysfs_lock);
+	mutex_init(&s->rbdev_lock);
+
+	INIT_LIST_HEAD(&s->jobs);
+	spin_lock_init(&s->joblock);
+	s->njobs = 0;
+
+	if (scrub_errlog_init(s))
+		printk(KERN_ERR "scrubber (%s): cannot allocate error log.\n",
+			s->disk_name);
 
 	/* Proceed with starting the scrubber thread */
 	s->task = kthread_run(kscrubd_init, (void *) disk, "Scrubber");
@@ -111,6 +192,14 @@ static void blk_release_scrub(struct kobject *kobj)
 		return;
 
 	kthread_stop(s->task);
+	scrub_flush_jobs(s);
+	scrub_errlog_exit(s);
+	scrub_read_exit(s);
+	scrub_map_free(&s->amap);
+	scrub_map_free(&s->meta);
+	scrub_lbas_free(s);
+	scrub_wtime_free(s);
+	scrub_wdirty_free(s);
 
 	/* De-allocate memory for strategy, priority names */
 	kfree(s->strategy);
@@ -457,6 +546,90 @@ static ssize_t scrub_vrprotect_store(struct disk_scrubber *s, const char *page,
 	return count;
 }
 
+static const char *vcmds[] = { "auto", "verify10", "ata16" };
+
+static ssize_t scrub_vcmd_show(struct disk_scrubber *s, char *page)
+{
+	int i, len = 0;
+
+	for (i = 0; i < ARRAY_SIZE(vcmds); i++) {
+		if (i == s->vcmd)
+			len += sprintf(page+len, "[%s] ", vcmds[i]);
+		else
+			len += sprintf(page+len, "%s ", vcmds[i]);
+	}
+
+	len += sprintf(page+len, "\n");
+	return len;
+}
+
+static ssize_t scrub_vcmd_store(struct disk_scrubber *s, const char *page,
+	size_t count)
+{
+	int i;
+	size_t len;
+	char *p = (char *) page;
+
+	len = strlen(p);
+	if (len && p[len-1] == '\n')
+		p[len-1] = '\0';
+
+	for (i = 0; i < ARRAY_SIZE(vcmds); i++) {
+		if (!strcmp(p, vcmds[i])) {
+			s->vcmd = i;
+			/* Probe again the next time auto mode is used */
+			s->ata_pt = -1;
+			return count;
+		}
+	}
+
+	printk(KERN_ERR "scrubber (%s): verify command '%s' not found.\n",
+		s->disk_name, p);
+	return count;
+}
+
+static const char *engines[] = { "auto", "verify", "read" };
+
+static ssize_t scrub_engine_show(struct disk_scrubber *s, char *page)
+{
+	int i, len = 0;
+
+	for (i = 0; i < ARRAY_SIZE(engines); i++) {
+		if (i == s->engine)
+			len += sprintf(page+len, "[%s] ", engines[i]);
+		else
+			len += sprintf(page+len, "%s ", engines[i]);
+	}
+
+	len += sprintf(page+len, "\n");
+	return len;
+}
+
+static ssize_t scrub_engine_store(struct disk_scrubber *s, const char *page,
+	size_t count)
+{
+	int i;
+	size_t len;
+	char *p = (char *) page;
+
+	len = strlen(p);
+	if (len && p[len-1] == '\n')
+		p[len-1] = '\0';
+
+	for (i = 0; i < ARRAY_SIZE(engines); i++) {
+		if (!strcmp(p, engines[i])) {
+			s->engine = i;
+			/* Pick again before the next verification */
+			s->use_read = -1;
+			return count;
+		}
+	}
+
+	printk(KERN_ERR "scrubber (%s): engine '%s' not found.\n",
+		s->disk_name, p);
+	return count;
+}
+
 static ssize_t scrub_verbose_show(struct disk_scrubber *s, char *page)
 {
 	return sprintf(page, "Verbosity of scrubber: %d\n", s->verbose);
@@ -571,192 +744,1476 @@ static ssize_t scrub_delayms_store(struct disk_scrubber *s, const char *page,
 	return count;
 }
 
-static struct scrub_sysfs_entry scrub_reqbound_entry = {
-	.attr = {.name = "reqbound", .mode = S_IRUGO | S_IWUSR },
-	.show = scrub_reqbound_show,
-	.store = scrub_reqbound_store,
-};
+static ssize_t scrub_deadline_s_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%llu\n", s->deadline_s);
+}
 
-static struct scrub_sysfs_entry scrub_segsize_entry = {
-	.attr = {.name = "segsize", .mode = S_IRUGO | S_IWUSR },
-	.show = scrub_segsize_show,
-	.store = scrub_segsize_store,
-};
+static ssize_t scrub_deadline_s_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	char *p = (char *) page;
 
-static struct scrub_sysfs_entry scrub_regsize_entry = {
-	.attr = {.name = "regsize", .mode = S_IRUGO | S_IWUSR },
-	.show = scrub_regsize_show,
-	.store = scrub_regsize_store,
-};
+	s->deadline_s = simple_strtoull(p, &p, 10);
 
-static struct scrub_sysfs_entry scrub_spoint_entry = {
-	.attr = {.name = "spoint", .mode = S_IRUGO | S_IWUSR },
-	.show = scrub_spoint_show,
-	.store = scrub_spoint_store,
-};
+	return count;
+}
 
-static struct scrub_sysfs_entry scrub_scount_entry = {
-	.attr = {.name = "scount", .mode = S_IRUGO | S_IWUSR },
-	.show = scrub_scount_show,
-	.store = scrub_scount_store,
-};
+static ssize_t scrub_remaining_s_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%lld\n", s->remaining_s);
+}
 
-static struct scrub_sysfs_entry scrub_strategy_entry = {
-	.attr = {.name = "strategy", .mode = S_IRUGO | S_IWUSR },
-	.show = scrub_strategy_show,
-	.store = scrub_strategy_store,
-};
+/* Projected completion of the pass, in seconds since the epoch */
+static ssize_t scrub_completion_s_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%lu\n", s->completion_s);
+}
 
-static struct scrub_sysfs_entry scrub_priority_entry = {
-	.attr = {.name = "priority", .mode = S_IRUGO | S_IWUSR },
-	.show = scrub_priority_show,
-	.store = scrub_priority_store,
-};
+static ssize_t scrub_slack_s_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%lld\n", s->slack_s);
+}
 
-static struct scrub_sysfs_entry scrub_state_entry = {
-	.attr = {.name = "state", .mode = S_IRUGO | S_IWUSR },
-	.show = scrub_state_show,
-	.store = scrub_state_store,
-};
+static ssize_t scrub_period_s_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%llu\n", s->period_s);
+}
 
-static struct scrub_sysfs_entry scrub_threads_entry = {
-	.attr = {.name = "threads", .mode = S_IRUGO | S_IWUSR },
-	.show = scrub_threads_show,
-	.store = scrub_threads_store,
-};
+static ssize_t scrub_period_s_store(struct disk_scrubber *s, const char *page,
+	size_t count)
+{
+	char *p = (char *) page;
 
-static struct scrub_sysfs_entry scrub_dpo_entry = {
-	.attr = {.name = "dpo", .mode = S_IRUGO | S_IWUSR },
-	.show = scrub_dpo_show,
-	.store = scrub_dpo_store,
-};
+	s->period_s = simple_strtoull(p, &p, 10);
+	if (s->period_s) {
+		scrub_sched_reset(s);
+		wake_up_process(s->task);
+	}
 
-static struct scrub_sysfs_entry scrub_vrprotect_entry = {
-	.attr = {.name = "vrprotect", .mode = S_IRUGO | S_IWUSR },
-	.show = scrub_vrprotect_show,
-	.store = scrub_vrprotect_store,
-};
+	return count;
+}
 
-static struct scrub_sysfs_entry scrub_verbose_entry = {
-	.attr = {.name = "verbose", .mode = S_IRUGO | S_IWUSR },
-	.show = scrub_verbose_show,
-	.store = scrub_verbose_store,
-};
+static ssize_t scrub_window_show(struct disk_scrubber *s, char *page)
+{
+	return scrub_print_windows(s, page);
+}
 
-static struct scrub_sysfs_entry scrub_timed_entry = {
-	.attr = {.name = "timed", .mode = S_IRUGO | S_IWUSR },
-	.show = scrub_timed_show,
-	.store = scrub_timed_store,
-};
+static ssize_t scrub_window_store(struct disk_scrubber *s, const char *page,
+	size_t count)
+{
+	struct scrub_window windows[SCRUB_WINDOWS_MAX];
+	int n;
+
+	n = scrub_parse_windows(page, windows);
+	if (n < 0) {
+		printk(KERN_ERR "scrubber (%s): windows should be given as "
+			"HH:MM-HH:MM (up to %d), or 'all'.\n", s->disk_name,
+			SCRUB_WINDOWS_MAX);
+	} else {
+		memcpy(s->windows, windows, n * sizeof(struct scrub_window));
+		s->nwindows = n;
+		wake_up_process(s->task);
+	}
 
-static struct scrub_sysfs_entry scrub_ttime_ms_entry = {
-	.attr = {.name = "ttime_ms", .mode = S_IRUGO | S_IWUSR },
-	.show = scrub_ttime_ms_show,
-	.store = scrub_ttime_ms_store,
-};
+	return count;
+}
 
-static struct scrub_sysfs_entry scrub_resptime_us_entry = {
-	.attr = {.name = "resptime_us", .mode = S_IRUGO },
-	.show = scrub_resptime_us_show,
-	.store = NULL,
-};
+static ssize_t scrub_stagger_show(struct disk_scrubber *s, char *page)
+{
+	int len = 0;
 
-static struct scrub_sysfs_entry scrub_reqcount_entry = {
-	.attr = {.name = "reqcount", .mode = S_IRUGO | S_IWUSR },
-	.show = scrub_reqcount_show,
-	.store = scrub_reqcount_store,
-};
+	if (s->stagger)
+		len = sprintf(page, "Staggered periodic rounds: [on] off\n");
+	else
+		len = sprintf(page, "Staggered periodic rounds:  on [off]\n");
 
-static struct scrub_sysfs_entry scrub_delayms_entry = {
-	.attr = {.name = "delayms", .mode = S_IRUGO | S_IWUSR },
-	.show = scrub_delayms_show,
-	.store = scrub_delayms_store,
-};
+	return len;
+}
 
-static struct attribute *default_attrs[] = {
-	&scrub_reqbound_entry.attr,
-	&scrub_segsize_entry.attr,
-	&scrub_regsize_entry.attr,
-	&scrub_spoint_entry.attr,
-	&scrub_scount_entry.attr,
-	&scrub_strategy_entry.attr,
-	&scrub_priority_entry.attr,
-	&scrub_state_entry.attr,
-	&scrub_threads_entry.attr,
-	&scrub_dpo_entry.attr,
-	&scrub_vrprotect_entry.attr,
-	&scrub_verbose_entry.attr,
-	&scrub_timed_entry.attr,
-	&scrub_ttime_ms_entry.attr,
-	&scrub_resptime_us_entry.attr,
-	&scrub_reqcount_entry.attr,
-	&scrub_delayms_entry.attr,
-	NULL,
-};
+static ssize_t scrub_stagger_store(struct disk_scrubber *s, const char *page,
+	size_t count)
+{
+	size_t len;
+	char *p = (char *) page;
 
-#define to_scrub(atr) container_of((atr), struct scrub_sysfs_entry, attr)
+	len = strlen(p);
+	if (len && p[len-1] == '\n')
+		p[len-1] = '\0';
 
-static ssize_t scrub_attr_show(struct kobject *kobj, struct attribute *attr,
-	char *page)
-{
-	struct scrub_sysfs_entry *entry = to_scrub(attr);
-	struct disk_scrubber *s =
-		container_of(kobj, struct disk_scrubber, kobj);
-	ssize_t res;
+	if (s->stagger != 0 && s->stagger != 1)
+		s->stagger = 0;
 
-	if (!entry->show)
-		return -EIO;
-	mutex_lock(&s->sysfs_lock);
-	res = entry->show(s, page);
-	mutex_unlock(&s->sysfs_lock);
-	return res;
+	if (!strcmp(p, "on") && !s->stagger)
+		s->stagger = 1;
+	else if (!strcmp(p, "off") && s->stagger)
+		s->stagger = 0;
+	else
+		printk(KERN_ERR "scrubber (%s): state '%s' not found, or coincides "
+			"with the current one.\n", s->disk_name, p);
+
+	return count;
 }
 
-static ssize_t scrub_attr_store(struct kobject *kobj, struct attribute *attr,
-	const char *page, size_t length)
+static ssize_t scrub_next_s_show(struct disk_scrubber *s, char *page)
 {
-	struct scrub_sysfs_entry *entry = to_scrub(attr);
-	struct disk_scrubber *s =
-		container_of(kobj, struct disk_scrubber, kobj);
-	ssize_t res;
+	unsigned long now = get_seconds();
 
-	if (!entry->store)
-		return -EIO;
-	mutex_lock(&s->sysfs_lock);
-	res = entry->store(s, page, length);
-	mutex_unlock(&s->sysfs_lock);
-	return res;
+	if (!s->period_s)
+		return sprintf(page, "none\n");
+	if (time_before(now, s->next_start))
+		return sprintf(page, "%lu\n", s->next_start - now);
+	return sprintf(page, "%lu\n", scrub_window_wait(s, now));
 }
 
-static struct sysfs_ops scrub_sysfs_ops = {
-	.show	= scrub_attr_show,
-	.store	= scrub_attr_store,
-};
-
-static struct kobj_type scrubber_ktype = {
-	.sysfs_ops	= &scrub_sysfs_ops,
-	.default_attrs	= default_attrs,
-	.release	= blk_release_scrub,
-};
+static ssize_t scrub_rescan_radius_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%llu\n", s->rescan_radius);
+}
 
-int blk_register_scrub(struct gendisk *disk)
+static ssize_t scrub_rescan_radius_store(struct disk_scrubber *s,
+	const char *page, size_t count)
 {
-	int ret;
-	struct disk_scrubber *s = blk_init_scrub(disk);
+	char *p = (char *) page;
 
-	/* 
-	 * Checks prior to registration.
-	 * If anything fails, just return.
-	 */
-	if (!s)
-		return -ENXIO;
+	s->rescan_radius = simple_strtoull(p, &p, 10);
+
+	return count;
+}
+
+static ssize_t scrub_rescan_chunk_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%llu\n", s->rescan_chunk);
+}
+
+static ssize_t scrub_rescan_chunk_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	uint64_t chunk;
+	char *p = (char *) page;
+
+	chunk = simple_strtoull(p, &p, 10);
+
+	if (!chunk || chunk > 65535)
+		printk(KERN_ERR "scrubber (%s): Check that 0 < rescan_chunk <= 65535.\n",
+			s->disk_name);
+	else
+		s->rescan_chunk = chunk;
+
+	return count;
+}
+
+static ssize_t scrub_fsaware_show(struct disk_scrubber *s, char *page)
+{
+	int len = 0;
+
+	if (s->fsaware)
+		len = sprintf(page, "Filesystem-aware scrubbing: [on] off\n");
+	else
+		len = sprintf(page, "Filesystem-aware scrubbing:  on [off]\n");
+
+	return len;
+}
+
+static ssize_t scrub_fsaware_store(struct disk_scrubber *s, const char *page,
+	size_t count)
+{
+	size_t len;
+	char *p = (char *) page;
+
+	len = strlen(p);
+	if (len && p[len-1] == '\n')
+		p[len-1] = '\0';
+
+	if (!strcmp(p, "on") && !s->fsaware)
+		s->fsaware = 1;
+	else if (!strcmp(p, "off") && s->fsaware)
+		s->fsaware = 0;
+	else
+		printk(KERN_ERR "scrubber (%s): state '%s' not found, or coincides "
+			"with the current one.\n", s->disk_name, p);
+
+	return count;
+}
+
+static ssize_t scrub_free_interval_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%u\n", s->free_interval);
+}
+
+static ssize_t scrub_free_interval_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	s->free_interval = (unsigned int) simple_strtoul(p, &p, 10);
+
+	return count;
+}
+
+static ssize_t scrub_allocated_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%llu\n", s->amap.sectors);
+}
+
+static ssize_t scrub_meta_period_s_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%llu\n", s->meta_period_s);
+}
+
+static ssize_t scrub_meta_period_s_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	s->meta_period_s = simple_strtoull(p, &p, 10);
+	if (s->meta_period_s) {
+		/* The first metadata pass is due right away */
+		s->meta_next = get_seconds();
+		wake_up_process(s->task);
+	}
+
+	return count;
+}
+
+static ssize_t scrub_meta_sectors_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%llu\n", s->meta.sectors);
+}
+
+static const char *thin_modes[] = { "auto", "on", "off" };
+
+static ssize_t scrub_thin_show(struct disk_scrubber *s, char *page)
+{
+	int i, len = 0;
+
+	for (i = 0; i < ARRAY_SIZE(thin_modes); i++) {
+		if (i == s->thin)
+			len += sprintf(page+len, "[%s] ", thin_modes[i]);
+		else
+			len += sprintf(page+len, "%s ", thin_modes[i]);
+	}
+
+	len += sprintf(page+len, "\n");
+	return len;
+}
+
+static ssize_t scrub_thin_store(struct disk_scrubber *s, const char *page,
+	size_t count)
+{
+	int i;
+	size_t len;
+	char *p = (char *) page;
+
+	len = strlen(p);
+	if (len && p[len-1] == '\n')
+		p[len-1] = '\0';
+
+	for (i = 0; i < ARRAY_SIZE(thin_modes); i++) {
+		if (!strcmp(p, thin_modes[i])) {
+			s->thin = i;
+			/* Probe for GET LBA STATUS again */
+			s->lbp = -1;
+			return count;
+		}
+	}
+
+	printk(KERN_ERR "scrubber (%s): thin provisioning mode '%s' not "
+		"found.\n", s->disk_name, p);
+	return count;
+}
+
+static ssize_t scrub_zoned_show(struct disk_scrubber *s, char *page)
+{
+	int len = 0;
+
+	if (s->zoned)
+		len = sprintf(page, "Zone-sized commands: [on] off\n");
+	else
+		len = sprintf(page, "Zone-sized commands:  on [off]\n");
+
+	return len;
+}
+
+static ssize_t scrub_zoned_store(struct disk_scrubber *s, const char *page,
+	size_t count)
+{
+	size_t len;
+	char *p = (char *) page;
+
+	len = strlen(p);
+	if (len && p[len-1] == '\n')
+		p[len-1] = '\0';
+
+	if (!strcmp(p, "on") && !s->zoned)
+		s->zoned = 1;
+	else if (!strcmp(p, "off") && s->zoned)
+		s->zoned = 0;
+	else
+		printk(KERN_ERR "scrubber (%s): state '%s' not found, or coincides "
+			"with the current one.\n", s->disk_name, p);
+
+	return count;
+}
+
+/* Shows the bandwidth (KB/s) of each zone, and whether it's learned */
+static ssize_t scrub_zones_show(struct disk_scrubber *s, char *page)
+{
+	int z, len = 0;
+
+	for (z = 0; z < SCRUB_ZONES; z++)
+		len += sprintf(page+len, "%u ", s->zone_kbs[z]);
+	len += sprintf(page+len, "(%s)\n", s->zone_learn ? "learned" : "given");
+
+	return len;
+}
+
+/* Takes "learn", which drops the profile and learns it anew, or a list of
+ * bandwidths spread evenly over the zones, from the outermost one. */
+static ssize_t scrub_zones_store(struct disk_scrubber *s, const char *page,
+	size_t count)
+{
+	uint32_t kbs[SCRUB_ZONES];
+	char *p = (char *) page, *end;
+	int z, n = 0;
+
+	if (!strncmp(p, "learn", 5)) {
+		memset(s->zone_kbs, 0, sizeof(s->zone_kbs));
+		s->zone_learn = 1;
+		return count;
+	}
+
+	while (n < SCRUB_ZONES) {
+		while (isspace(*p))
+			p++;
+		if (!*p)
+			break;
+		kbs[n] = (uint32_t) simple_strtoul(p, &end, 10);
+		if (end == p || !kbs[n]) {
+			printk(KERN_ERR "scrubber (%s): Check that zone bandwidths "
+				"are positive numbers.\n", s->disk_name);
+			return count;
+		}
+		p = end;
+		n++;
+	}
+	if (!n)
+		return count;
+
+	for (z = 0; z < SCRUB_ZONES; z++)
+		s->zone_kbs[z] = kbs[z * n / SCRUB_ZONES];
+	s->zone_learn = 0;
+
+	return count;
+}
+
+static ssize_t scrub_zone_idle_ms_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%u\n", s->zone_idle_ms);
+}
+
+static ssize_t scrub_zone_idle_ms_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	s->zone_idle_ms = (unsigned int) simple_strtoul(p, &p, 10);
+
+	return count;
+}
+
+static ssize_t scrub_cmd_us_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%u\n", s->cost_cmd_us);
+}
+
+/* Restores the overhead found on an earlier boot, or on another disk of
+ * the same model */
+static ssize_t scrub_cmd_us_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	s->cost_cmd_us = (uint32_t) simple_strtoul(p, &p, 10);
+
+	return count;
+}
+
+/* Shows the seek curve as distance:time pairs (sectors:us) */
+static ssize_t scrub_seek_us_show(struct disk_scrubber *s, char *page)
+{
+	uint64_t cap = get_capacity(s->disk);
+	int i, len = 0;
+
+	for (i = 0; i < SCRUB_SEEK_POINTS; i++)
+		len += sprintf(page+len, "%llu:%u ",
+			(unsigned long long) min(cap >> (2 * i), cap - 1),
+			s->cost_seek_us[i]);
+	len += sprintf(page+len, "\n");
+
+	return len;
+}
+
+/* Takes the pairs shown, like tracks. Distances follow from the capacity,
+ * so only the times are kept. */
+static ssize_t scrub_seek_us_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	uint32_t us[SCRUB_SEEK_POINTS];
+	char *p = (char *) page, *end;
+	int i;
+
+	for (i = 0; i < SCRUB_SEEK_POINTS; i++) {
+		while (isspace(*p))
+			p++;
+		simple_strtoull(p, &end, 10);
+		if (end == p || *end != ':')
+			goto bad;
+		p = end + 1;
+		us[i] = (uint32_t) simple_strtoul(p, &end, 10);
+		if (end == p)
+			goto bad;
+		p = end;
+	}
+
+	memcpy(s->cost_seek_us, us, sizeof(us));
+	return count;
+bad:
+	printk(KERN_ERR "scrubber (%s): Expected %d distance:time pairs.\n",
+		s->disk_name, SCRUB_SEEK_POINTS);
+	return count;
+}
+
+static ssize_t scrub_trackalign_show(struct disk_scrubber *s, char *page)
+{
+	int len = 0;
+
+	if (s->trackalign)
+		len = sprintf(page, "Track-aligned segments: [on] off\n");
+	else
+		len = sprintf(page, "Track-aligned segments:  on [off]\n");
+
+	return len;
+}
+
+static ssize_t scrub_trackalign_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	size_t len;
+	char *p = (char *) page;
+
+	len = strlen(p);
+	if (len && p[len-1] == '\n')
+		p[len-1] = '\0';
+
+	if (!strcmp(p, "on") && !s->trackalign)
+		s->trackalign = 1;
+	else if (!strcmp(p, "off") && s->trackalign)
+		s->trackalign = 0;
+	else
+		printk(KERN_ERR "scrubber (%s): state '%s' not found, or coincides "
+			"with the current one.\n", s->disk_name, p);
+
+	return count;
+}
+
+/* Shows a track boundary and the track length of each zone, as
+ * boundary:length pairs (sectors) */
+static ssize_t scrub_tracks_show(struct disk_scrubber *s, char *page)
+{
+	int z, len = 0;
+
+	for (z = 0; z < SCRUB_ZONES; z++)
+		len += sprintf(page+len, "%llu:%u ",
+			(unsigned long long) s->track_start[z], s->track_len[z]);
+	len += sprintf(page+len, "\n");
+
+	return len;
+}
+
+/* Takes the pairs shown, so that a table found on an earlier boot can be
+ * restored without characterizing the disk again */
+static ssize_t scrub_tracks_store(struct disk_scrubber *s, const char *page,
+	size_t count)
+{
+	uint64_t start[SCRUB_ZONES];
+	uint32_t tlen[SCRUB_ZONES];
+	char *p = (char *) page, *end;
+	int z;
+
+	for (z = 0; z < SCRUB_ZONES; z++) {
+		while (isspace(*p))
+			p++;
+		start[z] = simple_strtoull(p, &end, 10);
+		if (end == p || *end != ':')
+			goto bad;
+		p = end + 1;
+		tlen[z] = (uint32_t) simple_strtoul(p, &end, 10);
+		if (end == p)
+			goto bad;
+		p = end;
+	}
+
+	memcpy(s->track_start, start, sizeof(start));
+	memcpy(s->track_len, tlen, sizeof(tlen));
+	return count;
+bad:
+	printk(KERN_ERR "scrubber (%s): Expected %d boundary:length pairs.\n",
+		s->disk_name, SCRUB_ZONES);
+	return count;
+}
+
+static const char *stag_orders[] = { "linear", "rotate", "random", "vdc" };
+
+static ssize_t scrub_stag_order_show(struct disk_scrubber *s, char *page)
+{
+	int i, len = 0;
+
+	for (i = 0; i < ARRAY_SIZE(stag_orders); i++) {
+		if (i == s->stag_order)
+			len += sprintf(page+len, "[%s] ", stag_orders[i]);
+		else
+			len += sprintf(page+len, "%s ", stag_orders[i]);
+	}
+
+	len += sprintf(page+len, "\n");
+	return len;
+}
+
+static ssize_t scrub_stag_order_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	int i;
+	size_t len;
+	char *p = (char *) page;
+
+	len = strlen(p);
+	if (len && p[len-1] == '\n')
+		p[len-1] = '\0';
+
+	for (i = 0; i < ARRAY_SIZE(stag_orders); i++) {
+		if (!strcmp(p, stag_orders[i])) {
+			s->stag_order = i;
+			return count;
+		}
+	}
+
+	printk(KERN_ERR "scrubber (%s): staggered order '%s' not found.\n",
+		s->disk_name, p);
+	return count;
+}
+
+static ssize_t scrub_stag_burst_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%llu\n", s->stag_burst);
+}
+
+static ssize_t scrub_stag_burst_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	char *p = (char *) page;
+	uint64_t burst;
+
+	burst = simple_strtoull(p, &p, 10);
+	if (!burst) {
+		printk(KERN_ERR "scrubber (%s): Check that stag_burst > 0.\n",
+			s->disk_name);
+		return count;
+	}
+	s->stag_burst = burst;
+
+	return count;
+}
+
+static ssize_t scrub_hybrid_idle_ms_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%u\n", s->hybrid_idle_ms);
+}
+
+static ssize_t scrub_hybrid_idle_ms_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	s->hybrid_idle_ms = (unsigned int) simple_strtoul(p, &p, 10);
+
+	return count;
+}
+
+/* Shows the share of recent foreground requests that were local (%) */
+static ssize_t scrub_locality_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%u\n", s->fg_local * 100 / 1024);
+}
+
+/* Shows the number of sub-ranges, or "auto" and the number detected */
+static ssize_t scrub_parts_show(struct disk_scrubber *s, char *page)
+{
+	unsigned int io_min = queue_io_min(s->disk->queue);
+	unsigned int io_opt = queue_io_opt(s->disk->queue);
+
+	if (s->parts)
+		return sprintf(page, "%u\n", s->parts);
+	if (io_min && io_opt > io_min && !(io_opt % io_min))
+		return sprintf(page, "auto (%u)\n",
+			min_t(unsigned int, io_opt / io_min, SCRUB_PARTS_MAX));
+	return sprintf(page, "auto (1)\n");
+}
+
+static ssize_t scrub_parts_store(struct disk_scrubber *s, const char *page,
+	size_t count)
+{
+	char *p = (char *) page;
+	unsigned long parts;
+
+	if (!strncmp(p, "auto", 4)) {
+		s->parts = 0;
+		return count;
+	}
+
+	parts = simple_strtoul(p, &p, 10);
+	if (!parts || parts > SCRUB_PARTS_MAX) {
+		printk(KERN_ERR "scrubber (%s): Check that 0 < parts <= %d, or "
+			"use 'auto'.\n", s->disk_name, SCRUB_PARTS_MAX);
+		return count;
+	}
+	s->parts = (unsigned int) parts;
+
+	return count;
+}
+
+static ssize_t scrub_stripe_kb_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%llu\n", s->stripe_kb);
+}
+
+static ssize_t scrub_stripe_kb_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	s->stripe_kb = simple_strtoull(p, &p, 10);
+
+	return count;
+}
+
+static ssize_t scrub_wverify_delay_s_show(struct disk_scrubber *s,
+	char *page)
+{
+	return sprintf(page, "%llu\n", s->wverify_delay_s);
+}
+
+static ssize_t scrub_wverify_delay_s_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	char *p = (char *) page;
+	uint64_t old = s->wverify_delay_s;
+
+	s->wverify_delay_s = simple_strtoull(p, &p, 10);
+	if (scrub_wdirty_init(s)) {
+		printk(KERN_ERR "scrubber (%s): cannot allocate dirty map.\n",
+			s->disk_name);
+		s->wverify_delay_s = old;
+	}
+	wake_up_process(s->task);
+
+	return count;
+}
+
+static ssize_t scrub_wverify_pending_show(struct disk_scrubber *s,
+	char *page)
+{
+	return sprintf(page, "%llu\n", scrub_wdirty_pending(s));
+}
+
+static ssize_t scrub_wverified_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%llu\n", s->wverified);
+}
+
+static const char *flash_modes[] = { "auto", "on", "off" };
+
+static ssize_t scrub_flash_show(struct disk_scrubber *s, char *page)
+{
+	int i, len = 0;
+
+	for (i = 0; i < ARRAY_SIZE(flash_modes); i++) {
+		if (i == s->flash)
+			len += sprintf(page+len, "[%s] ", flash_modes[i]);
+		else
+			len += sprintf(page+len, "%s ", flash_modes[i]);
+	}
+
+	len += sprintf(page+len, "\n");
+	return len;
+}
+
+static ssize_t scrub_flash_store(struct disk_scrubber *s, const char *page,
+	size_t count)
+{
+	int i;
+	size_t len;
+	char *p = (char *) page;
+
+	len = strlen(p);
+	if (len && p[len-1] == '\n')
+		p[len-1] = '\0';
+
+	for (i = 0; i < ARRAY_SIZE(flash_modes); i++) {
+		if (!strcmp(p, flash_modes[i])) {
+			s->flash = i;
+			return count;
+		}
+	}
+
+	printk(KERN_ERR "scrubber (%s): flash profile mode '%s' not found.\n",
+		s->disk_name, p);
+	return count;
+}
+
+static ssize_t scrub_flash_depth_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%u\n", s->flash_depth);
+}
+
+static ssize_t scrub_flash_depth_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	char *p = (char *) page;
+	unsigned long depth;
+
+	depth = simple_strtoul(p, &p, 10);
+	if (!depth) {
+		printk(KERN_ERR "scrubber (%s): Check that flash_depth > 0.\n",
+			s->disk_name);
+		return count;
+	}
+	s->flash_depth = (unsigned int) depth;
+
+	return count;
+}
+
+static ssize_t scrub_flash_rate_mbs_show(struct disk_scrubber *s,
+	char *page)
+{
+	return sprintf(page, "%u\n", s->flash_rate_mbs);
+}
+
+static ssize_t scrub_flash_rate_mbs_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	s->flash_rate_mbs = (unsigned int) simple_strtoul(p, &p, 10);
+
+	return count;
+}
+
+static ssize_t scrub_weak_factor_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%u\n", s->weak_factor);
+}
+
+static ssize_t scrub_weak_factor_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	s->weak_factor = (unsigned int) simple_strtoul(p, &p, 10);
+	if (s->weak_factor && !s->cost_cmd_us)
+		printk(KERN_INFO "scrubber (%s): No cost model, weak sector "
+			"detection is inactive until cmd_us and seek_us are "
+			"restored or a char round is run.\n", s->disk_name);
+
+	return count;
+}
+
+static const char *weak_actions[] = { "none", "rewrite", "reassign" };
+
+static ssize_t scrub_weak_action_show(struct disk_scrubber *s, char *page)
+{
+	int i, len = 0;
+
+	for (i = 0; i < ARRAY_SIZE(weak_actions); i++) {
+		if (i == s->weak_action)
+			len += sprintf(page+len, "[%s] ", weak_actions[i]);
+		else
+			len += sprintf(page+len, "%s ", weak_actions[i]);
+	}
+
+	len += sprintf(page+len, "\n");
+	return len;
+}
+
+static ssize_t scrub_weak_action_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	int i;
+	size_t len;
+	char *p = (char *) page;
+
+	len = strlen(p);
+	if (len && p[len-1] == '\n')
+		p[len-1] = '\0';
+
+	for (i = 0; i < ARRAY_SIZE(weak_actions); i++) {
+		if (!strcmp(p, weak_actions[i])) {
+			s->weak_action = i;
+			return count;
+		}
+	}
+
+	printk(KERN_ERR "scrubber (%s): weak sector action '%s' not found.\n",
+		s->disk_name, p);
+	return count;
+}
+
+/* Shows the weak sectors, one range per line, as
+ * "sector len times-found last-response-us" */
+static ssize_t scrub_weak_show(struct disk_scrubber *s, char *page)
+{
+	int i, len = 0;
+
+	for (i = 0; i < s->nweak; i++)
+		len += sprintf(page+len, "%llu %u %u %u\n",
+			(unsigned long long) s->weak[i].sector, s->weak[i].len,
+			s->weak[i].count, s->weak[i].us);
+
+	return len;
+}
+
+/* Writing "clear" forgets the weak sectors found so far */
+static ssize_t scrub_weak_store(struct disk_scrubber *s, const char *page,
+	size_t count)
+{
+	if (!strncmp(page, "clear", 5))
+		s->nweak = 0;
+	else
+		printk(KERN_ERR "scrubber (%s): Only 'clear' can be written.\n",
+			s->disk_name);
+
+	return count;
+}
+
+static ssize_t scrub_recovered_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%d\n", atomic_read(&s->recovered));
+}
+
+static ssize_t scrub_recov_region_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%llu\n", s->recov_region);
+}
+
+static ssize_t scrub_recov_region_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	char *p = (char *) page;
+	unsigned long flags;
+
+	/* Regions change, so forget the ones tracked so far */
+	spin_lock_irqsave(&s->recov_lock, flags);
+	s->recov_region = simple_strtoull(p, &p, 10);
+	memset(s->recov, 0, sizeof(s->recov));
+	spin_unlock_irqrestore(&s->recov_lock, flags);
+
+	return count;
+}
+
+static ssize_t scrub_recov_threshold_show(struct disk_scrubber *s,
+	char *page)
+{
+	return sprintf(page, "%u\n", s->recov_threshold);
+}
+
+static ssize_t scrub_recov_threshold_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	char *p = (char *) page;
+	unsigned long threshold;
+
+	threshold = simple_strtoul(p, &p, 10);
+	if (!threshold) {
+		printk(KERN_ERR "scrubber (%s): Check that recov_threshold > 0.\n",
+			s->disk_name);
+		return count;
+	}
+	s->recov_threshold = (unsigned int) threshold;
+
+	return count;
+}
+
+static ssize_t scrub_recov_interval_s_show(struct disk_scrubber *s,
+	char *page)
+{
+	return sprintf(page, "%u\n", s->recov_interval_s);
+}
+
+static ssize_t scrub_recov_interval_s_store(struct disk_scrubber *s,
+	const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	s->recov_interval_s = (unsigned int) simple_strtoul(p, &p, 10);
+
+	return count;
+}
+
+/* Shows the tracked regions, one per line, as
+ * "start-sector errors-since-rescrub rescrubs" */
+static ssize_t scrub_recov_regions_show(struct disk_scrubber *s, char *page)
+{
+	unsigned long flags;
+	int i, len = 0;
+
+	spin_lock_irqsave(&s->recov_lock, flags);
+	for (i = 0; i < SCRUB_RECOV_MAX; i++)
+		if (s->recov[i].stamp)
+			len += sprintf(page+len, "%llu %u %u\n",
+				(unsigned long long) s->recov[i].start,
+				s->recov[i].errors, s->recov[i].rescrubs);
+	spin_unlock_irqrestore(&s->recov_lock, flags);
+
+	return len;
+}
+
+static ssize_t scrub_bad_sectors_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%d\n", atomic_read(&s->bad_sectors));
+}
+
+static ssize_t scrub_jobs_show(struct disk_scrubber *s, char *page)
+{
+	return sprintf(page, "%u\n", s->njobs);
+}
+
+static struct scrub_sysfs_entry scrub_reqbound_entry = {
+	.attr = {.name = "reqbound", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_reqbound_show,
+	.store = scrub_reqbound_store,
+};
+
+static struct scrub_sysfs_entry scrub_segsize_entry = {
+	.attr = {.name = "segsize", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_segsize_show,
+	.store = scrub_segsize_store,
+};
+
+static struct scrub_sysfs_entry scrub_regsize_entry = {
+	.attr = {.name = "regsize", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_regsize_show,
+	.store = scrub_regsize_store,
+};
+
+static struct scrub_sysfs_entry scrub_spoint_entry = {
+	.attr = {.name = "spoint", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_spoint_show,
+	.store = scrub_spoint_store,
+};
+
+static struct scrub_sysfs_entry scrub_scount_entry = {
+	.attr = {.name = "scount", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_scount_show,
+	.store = scrub_scount_store,
+};
+
+static struct scrub_sysfs_entry scrub_strategy_entry = {
+	.attr = {.name = "strategy", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_strategy_show,
+	.store = scrub_strategy_store,
+};
+
+static struct scrub_sysfs_entry scrub_priority_entry = {
+	.attr = {.name = "priority", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_priority_show,
+	.store = scrub_priority_store,
+};
+
+static struct scrub_sysfs_entry scrub_state_entry = {
+	.attr = {.name = "state", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_state_show,
+	.store = scrub_state_store,
+};
+
+static struct scrub_sysfs_entry scrub_threads_entry = {
+	.attr = {.name = "threads", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_threads_show,
+	.store = scrub_threads_store,
+};
+
+static struct scrub_sysfs_entry scrub_dpo_entry = {
+	.attr = {.name = "dpo", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_dpo_show,
+	.store = scrub_dpo_store,
+};
+
+static struct scrub_sysfs_entry scrub_vrprotect_entry = {
+	.attr = {.name = "vrprotect", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_vrprotect_show,
+	.store = scrub_vrprotect_store,
+};
+
+static struct scrub_sysfs_entry scrub_engine_entry = {
+	.attr = {.name = "engine", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_engine_show,
+	.store = scrub_engine_store,
+};
+
+static struct scrub_sysfs_entry scrub_vcmd_entry = {
+	.attr = {.name = "verify_cmd", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_vcmd_show,
+	.store = scrub_vcmd_store,
+};
+
+static struct scrub_sysfs_entry scrub_verbose_entry = {
+	.attr = {.name = "verbose", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_verbose_show,
+	.store = scrub_verbose_store,
+};
+
+static struct scrub_sysfs_entry scrub_timed_entry = {
+	.attr = {.name = "timed", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_timed_show,
+	.store = scrub_timed_store,
+};
+
+static struct scrub_sysfs_entry scrub_ttime_ms_entry = {
+	.attr = {.name = "ttime_ms", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_ttime_ms_show,
+	.store = scrub_ttime_ms_store,
+};
+
+static struct scrub_sysfs_entry scrub_resptime_us_entry = {
+	.attr = {.name = "resptime_us", .mode = S_IRUGO },
+	.show = scrub_resptime_us_show,
+	.store = NULL,
+};
+
+static struct scrub_sysfs_entry scrub_reqcount_entry = {
+	.attr = {.name = "reqcount", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_reqcount_show,
+	.store = scrub_reqcount_store,
+};
+
+static struct scrub_sysfs_entry scrub_delayms_entry = {
+	.attr = {.name = "delayms", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_delayms_show,
+	.store = scrub_delayms_store,
+};
+
+static struct scrub_sysfs_entry scrub_deadline_s_entry = {
+	.attr = {.name = "deadline_s", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_deadline_s_show,
+	.store = scrub_deadline_s_store,
+};
+
+static struct scrub_sysfs_entry scrub_remaining_s_entry = {
+	.attr = {.name = "remaining_s", .mode = S_IRUGO },
+	.show = scrub_remaining_s_show,
+	.store = NULL,
+};
+
+static struct scrub_sysfs_entry scrub_completion_s_entry = {
+	.attr = {.name = "completion_s", .mode = S_IRUGO },
+	.show = scrub_completion_s_show,
+	.store = NULL,
+};
+
+static struct scrub_sysfs_entry scrub_slack_s_entry = {
+	.attr = {.name = "slack_s", .mode = S_IRUGO },
+	.show = scrub_slack_s_show,
+	.store = NULL,
+};
+
+static struct scrub_sysfs_entry scrub_period_s_entry = {
+	.attr = {.name = "period_s", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_period_s_show,
+	.store = scrub_period_s_store,
+};
+
+static struct scrub_sysfs_entry scrub_window_entry = {
+	.attr = {.name = "window", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_window_show,
+	.store = scrub_window_store,
+};
+
+static struct scrub_sysfs_entry scrub_stagger_entry = {
+	.attr = {.name = "stagger", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_stagger_show,
+	.store = scrub_stagger_store,
+};
+
+static struct scrub_sysfs_entry scrub_next_s_entry = {
+	.attr = {.name = "next_s", .mode = S_IRUGO },
+	.show = scrub_next_s_show,
+	.store = NULL,
+};
+
+static struct scrub_sysfs_entry scrub_rescan_radius_entry = {
+	.attr = {.name = "rescan_radius", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_rescan_radius_show,
+	.store = scrub_rescan_radius_store,
+};
+
+static struct scrub_sysfs_entry scrub_rescan_chunk_entry = {
+	.attr = {.name = "rescan_chunk", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_rescan_chunk_show,
+	.store = scrub_rescan_chunk_store,
+};
+
+static struct scrub_sysfs_entry scrub_fsaware_entry = {
+	.attr = {.name = "fsaware", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_fsaware_show,
+	.store = scrub_fsaware_store,
+};
+
+static struct scrub_sysfs_entry scrub_free_interval_entry = {
+	.attr = {.name = "free_interval", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_free_interval_show,
+	.store = scrub_free_interval_store,
+};
+
+static struct scrub_sysfs_entry scrub_allocated_entry = {
+	.attr = {.name = "allocated", .mode = S_IRUGO },
+	.show = scrub_allocated_show,
+	.store = NULL,
+};
+
+static struct scrub_sysfs_entry scrub_meta_period_s_entry = {
+	.attr = {.name = "meta_period_s", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_meta_period_s_show,
+	.store = scrub_meta_period_s_store,
+};
+
+static struct scrub_sysfs_entry scrub_meta_sectors_entry = {
+	.attr = {.name = "meta_sectors", .mode = S_IRUGO },
+	.show = scrub_meta_sectors_show,
+	.store = NULL,
+};
+
+static struct scrub_sysfs_entry scrub_thin_entry = {
+	.attr = {.name = "thin", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_thin_show,
+	.store = scrub_thin_store,
+};
+
+static struct scrub_sysfs_entry scrub_zoned_entry = {
+	.attr = {.name = "zoned", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_zoned_show,
+	.store = scrub_zoned_store,
+};
+
+static struct scrub_sysfs_entry scrub_zones_entry = {
+	.attr = {.name = "zones", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_zones_show,
+	.store = scrub_zones_store,
+};
+
+static struct scrub_sysfs_entry scrub_zone_idle_ms_entry = {
+	.attr = {.name = "zone_idle_ms", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_zone_idle_ms_show,
+	.store = scrub_zone_idle_ms_store,
+};
+
+static struct scrub_sysfs_entry scrub_cmd_us_entry = {
+	.attr = {.name = "cmd_us", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_cmd_us_show,
+	.store = scrub_cmd_us_store,
+};
+
+static struct scrub_sysfs_entry scrub_seek_us_entry = {
+	.attr = {.name = "seek_us", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_seek_us_show,
+	.store = scrub_seek_us_store,
+};
+
+static struct scrub_sysfs_entry scrub_trackalign_entry = {
+	.attr = {.name = "trackalign", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_trackalign_show,
+	.store = scrub_trackalign_store,
+};
+
+static struct scrub_sysfs_entry scrub_tracks_entry = {
+	.attr = {.name = "tracks", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_tracks_show,
+	.store = scrub_tracks_store,
+};
+
+static struct scrub_sysfs_entry scrub_stag_order_entry = {
+	.attr = {.name = "stag_order", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_stag_order_show,
+	.store = scrub_stag_order_store,
+};
+
+static struct scrub_sysfs_entry scrub_stag_burst_entry = {
+	.attr = {.name = "stag_burst", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_stag_burst_show,
+	.store = scrub_stag_burst_store,
+};
+
+static struct scrub_sysfs_entry scrub_hybrid_idle_ms_entry = {
+	.attr = {.name = "hybrid_idle_ms", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_hybrid_idle_ms_show,
+	.store = scrub_hybrid_idle_ms_store,
+};
+
+static struct scrub_sysfs_entry scrub_locality_entry = {
+	.attr = {.name = "locality", .mode = S_IRUGO },
+	.show = scrub_locality_show,
+	.store = NULL,
+};
+
+static struct scrub_sysfs_entry scrub_parts_entry = {
+	.attr = {.name = "parts", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_parts_show,
+	.store = scrub_parts_store,
+};
+
+static struct scrub_sysfs_entry scrub_stripe_kb_entry = {
+	.attr = {.name = "stripe_kb", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_stripe_kb_show,
+	.store = scrub_stripe_kb_store,
+};
+
+static struct scrub_sysfs_entry scrub_wverify_delay_s_entry = {
+	.attr = {.name = "wverify_delay_s", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_wverify_delay_s_show,
+	.store = scrub_wverify_delay_s_store,
+};
+
+static struct scrub_sysfs_entry scrub_wverify_pending_entry = {
+	.attr = {.name = "wverify_pending", .mode = S_IRUGO },
+	.show = scrub_wverify_pending_show,
+};
+
+static struct scrub_sysfs_entry scrub_wverified_entry = {
+	.attr = {.name = "wverified", .mode = S_IRUGO },
+	.show = scrub_wverified_show,
+};
+
+static struct scrub_sysfs_entry scrub_flash_entry = {
+	.attr = {.name = "flash", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_flash_show,
+	.store = scrub_flash_store,
+};
+
+static struct scrub_sysfs_entry scrub_flash_depth_entry = {
+	.attr = {.name = "flash_depth", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_flash_depth_show,
+	.store = scrub_flash_depth_store,
+};
+
+static struct scrub_sysfs_entry scrub_flash_rate_mbs_entry = {
+	.attr = {.name = "flash_rate_mbs", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_flash_rate_mbs_show,
+	.store = scrub_flash_rate_mbs_store,
+};
+
+static struct scrub_sysfs_entry scrub_weak_factor_entry = {
+	.attr = {.name = "weak_factor", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_weak_factor_show,
+	.store = scrub_weak_factor_store,
+};
+
+static struct scrub_sysfs_entry scrub_weak_action_entry = {
+	.attr = {.name = "weak_action", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_weak_action_show,
+	.store = scrub_weak_action_store,
+};
+
+static struct scrub_sysfs_entry scrub_weak_entry = {
+	.attr = {.name = "weak", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_weak_show,
+	.store = scrub_weak_store,
+};
+
+static struct scrub_sysfs_entry scrub_recovered_entry = {
+	.attr = {.name = "recovered", .mode = S_IRUGO },
+	.show = scrub_recovered_show,
+	.store = NULL,
+};
+
+static struct scrub_sysfs_entry scrub_recov_region_entry = {
+	.attr = {.name = "recov_region", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_recov_region_show,
+	.store = scrub_recov_region_store,
+};
+
+static struct scrub_sysfs_entry scrub_recov_threshold_entry = {
+	.attr = {.name = "recov_threshold", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_recov_threshold_show,
+	.store = scrub_recov_threshold_store,
+};
+
+static struct scrub_sysfs_entry scrub_recov_interval_s_entry = {
+	.attr = {.name = "recov_interval_s", .mode = S_IRUGO | S_IWUSR },
+	.show = scrub_recov_interval_s_show,
+	.store = scrub_recov_interval_s_store,
+};
+
+static struct scrub_sysfs_entry scrub_recov_regions_entry = {
+	.attr = {.name = "recov_regions", .mode = S_IRUGO },
+	.show = scrub_recov_regions_show,
+	.store = NULL,
+};
+
+static struct scrub_sysfs_entry scrub_bad_sectors_entry = {
+	.attr = {.name = "bad_sectors", .mode = S_IRUGO },
+	.show = scrub_bad_sectors_show,
+	.store = NULL,
+};
+
+static struct scrub_sysfs_entry scrub_jobs_entry = {
+	.attr = {.name = "jobs", .mode = S_IRUGO },
+	.show = scrub_jobs_show,
+	.store = NULL,
+};
+
+static struct attribute *default_attrs[] = {
+	&scrub_reqbound_entry.attr,
+	&scrub_segsize_entry.attr,
+	&scrub_regsize_entry.attr,
+	&scrub_spoint_entry.attr,
+	&scrub_scount_entry.attr,
+	&scrub_strategy_entry.attr,
+	&scrub_priority_entry.attr,
+	&scrub_state_entry.attr,
+	&scrub_threads_entry.attr,
+	&scrub_dpo_entry.attr,
+	&scrub_vrprotect_entry.attr,
+	&scrub_vcmd_entry.attr,
+	&scrub_engine_entry.attr,
+	&scrub_verbose_entry.attr,
+	&scrub_timed_entry.attr,
+	&scrub_ttime_ms_entry.attr,
+	&scrub_resptime_us_entry.attr,
+	&scrub_reqcount_entry.attr,
+	&scrub_delayms_entry.attr,
+	&scrub_deadline_s_entry.attr,
+	&scrub_remaining_s_entry.attr,
+	&scrub_completion_s_entry.attr,
+	&scrub_slack_s_entry.attr,
+	&scrub_period_s_entry.attr,
+	&scrub_window_entry.attr,
+	&scrub_stagger_entry.attr,
+	&scrub_next_s_entry.attr,
+	&scrub_rescan_radius_entry.attr,
+	&scrub_rescan_chunk_entry.attr,
+	&scrub_fsaware_entry.attr,
+	&scrub_free_interval_entry.attr,
+	&scrub_allocated_entry.attr,
+	&scrub_meta_period_s_entry.attr,
+	&scrub_meta_sectors_entry.attr,
+	&scrub_thin_entry.attr,
+	&scrub_zoned_entry.attr,
+	&scrub_zones_entry.attr,
+	&scrub_zone_idle_ms_entry.attr,
+	&scrub_cmd_us_entry.attr,
+	&scrub_seek_us_entry.attr,
+	&scrub_trackalign_entry.attr,
+	&scrub_tracks_entry.attr,
+	&scrub_stag_order_entry.attr,
+	&scrub_stag_burst_entry.attr,
+	&scrub_hybrid_idle_ms_entry.attr,
+	&scrub_locality_entry.attr,
+	&scrub_parts_entry.attr,
+	&scrub_stripe_kb_entry.attr,
+	&scrub_wverify_delay_s_entry.attr,
+	&scrub_wverify_pending_entry.attr,
+	&scrub_wverified_entry.attr,
+	&scrub_flash_entry.attr,
+	&scrub_flash_depth_entry.attr,
+	&scrub_flash_rate_mbs_entry.attr,
+	&scrub_weak_factor_entry.attr,
+	&scrub_weak_action_entry.attr,
+	&scrub_weak_entry.attr,
+	&scrub_recovered_entry.attr,
+	&scrub_recov_region_entry.attr,
+	&scrub_recov_threshold_entry.attr,
+	&scrub_recov_interval_s_entry.attr,
+	&scrub_recov_regions_entry.attr,
+	&scrub_bad_sectors_entry.attr,
+	&scrub_jobs_entry.attr,
+	NULL,
+};
+
+#define to_scrub(atr) container_of((atr), struct scrub_sysfs_entry, attr)
+
+static ssize_t scrub_attr_show(struct kobject *kobj, struct attribute *attr,
+	char *page)
+{
+	struct scrub_sysfs_entry *entry = to_scrub(attr);
+	struct disk_scrubber *s =
+		container_of(kobj, struct disk_scrubber, kobj);
+	ssize_t res;
+
+	if (!entry->show)
+		return -EIO;
+	mutex_lock(&s->sysfs_lock);
+	res = entry->show(s, page);
+	mutex_unlock(&s->sysfs_lock);
+	return res;
+}
+
+static ssize_t scrub_attr_store(struct kobject *kobj, struct attribute *attr,
+	const char *page, size_t length)
+{
+	struct scrub_sysfs_entry *entry = to_scrub(attr);
+	struct disk_scrubber *s =
+		container_of(kobj, struct disk_scrubber, kobj);
+	ssize_t res;
+
+	if (!entry->store)
+		return -EIO;
+	mutex_lock(&s->sysfs_lock);
+	res = entry->store(s, page, length);
+	mutex_unlock(&s->sysfs_lock);
+	return res;
+}
+
+static struct sysfs_ops scrub_sysfs_ops = {
+	.show	= scrub_attr_show,
+	.store	= scrub_attr_store,
+};
+
+static struct kobj_type scrubber_ktype = {
+	.sysfs_ops	= &scrub_sysfs_ops,
+	.default_attrs	= default_attrs,
+	.release	= blk_release_scrub,
+};
+
+int blk_register_scrub(struct gendisk *disk)
+{
+	int ret;
+	struct disk_scrubber *s = blk_init_scrub(disk);
+	struct disk_part_iter piter;
+	struct hd_struct *part;
+
+	/* 
+	 * Checks prior to registration.
+	 * If anything fails, just return.
+	 */
+	if (!s)
+		return -ENXIO;
 
 	ret = kobject_add(&s->kobj, get_disk(disk), "%s", "scrubber");
 	if (ret < 0)
 		return ret;
 
+	if (sysfs_create_bin_file(&s->kobj, &scrub_errlog_attr))
+		printk(KERN_ERR "scrubber (%s): cannot create error log file.\n",
+			s->disk_name);
+
 	kobject_uevent(&s->kobj, KOBJ_ADD);
 
+	/* Partitions were scanned before we got here */
+	disk_part_iter_init(&piter, disk, 0);
+	while ((part = disk_part_iter_next(&piter)))
+		if (blk_register_scrub_part(disk, part))
+			printk(KERN_ERR "scrubber (%s): cannot create policy of "
+				"partition %d.\n", s->disk_name, part->partno);
+	disk_part_iter_exit(&piter);
+
 	/* 
 	 * Check stuff
 	 * If something goes wrong, remember:
@@ -771,11 +2228,19 @@ int blk_register_scrub(struct gendisk *disk)
 void blk_unregister_scrub(struct gendisk *disk)
 {
 	struct disk_scrubber *s = disk->scrubber;
+	struct scrub_policy *p;
 
 	if (WARN_ON(!s))
 		return;
 
+	/* Partitions are normally gone by now */
+	while (!list_empty(&s->policies)) {
+		p = list_first_entry(&s->policies, struct scrub_policy, list);
+		blk_unregister_scrub_part(disk, p->partno);
+	}
+
 	//kobject_put(&s->kobj);
+	sysfs_remove_bin_file(&s->kobj, &scrub_errlog_attr);
 	kobject_uevent(&s->kobj, KOBJ_REMOVE);
 	kobject_del(&s->kobj);
 	put_disk(disk);
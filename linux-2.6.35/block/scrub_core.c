@@ -25,13 +25,21 @@
 #include <linux/kthread.h>
 #include <linux/err.h>
 #include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/fs.h>
+#include <linux/random.h>
+#include <linux/vmalloc.h>
+#include <linux/sort.h>
+#include <linux/delay.h>
 
 #define SEQLSCRUB 1
 #define STAGSCRUB 2
-#define FIXEDSCRUB 3
+#define CHARSCRUB 3
+#define HYBRSCRUB 4
 
 #define RTIMEPRIO 1
 #define IDCHKPRIO 2
+#define DLINEPRIO 3
 
 /* Thread states */
 #define TINIT  0
@@ -59,6 +67,40 @@ struct scrubparams {
 	uint64_t delayms;	/* Artificial delay inbetween SCSIVerify requests (ms) */
 	uint64_t resptime_us;	/* Avg. response time per SCSIVerify (us) */
 	uint64_t reqcount;	/* Total number of requests executed during last scrub */
+	uint64_t deadline_ms;	/* Time allowed for the pass (deadline priority) */
+	uint64_t total;		/* Sectors to be scrubbed during the pass */
+	uint64_t done;		/* Sectors dispatched so far during the pass */
+	struct timeval rstart;	/* Start of the pass */
+	int boosted;		/* BE levels claimed above idle (0: idle class) */
+	int fsaware;		/* Whether only allocated blocks are scrubbed */
+	unsigned int free_interval;	/* Rounds between scrubs of free space */
+	int skip_free;		/* Whether free segments are skipped this round */
+	int thin;		/* Whether deallocated LBAs are skipped */
+	int zoned;		/* Whether command sizes follow the zone profile */
+	uint32_t zone_kbs[SCRUB_ZONES];	/* Zone profile at the start of the pass */
+	unsigned int zone_slow;	/* Bitmask of the slow zones */
+	unsigned int zone_idle_ms;	/* Idle time that calls for slow zones */
+	int trackalign;		/* Whether segments end on track boundaries */
+	uint64_t track_start[SCRUB_ZONES];	/* A track boundary per zone */
+	uint32_t track_len[SCRUB_ZONES];	/* Sectors per track (0: unknown) */
+	uint64_t trk_at;	/* Where the boundary in use was found */
+	uint64_t trk_start;	/* Track boundary in use */
+	uint32_t trk_len;	/* Its track length (0: none found) */
+	int trk_valid;		/* Whether the three above are set */
+	uint32_t cost_cmd_us;	/* Per-command overhead (0: unknown) */
+	uint32_t seek_full_us;	/* Full stroke seek time */
+	unsigned int weak_factor;	/* Allowed extra overheads per command */
+	int weak_action;	/* What to do with weak sectors */
+	int stag_order;		/* Order of regions in staggered visits */
+	uint64_t stag_burst;	/* Segments per region visit */
+	unsigned int hybrid_idle_ms;	/* Idle time that calls for sequential runs */
+	unsigned int parts;	/* Sub-ranges scrubbed in parallel */
+	uint64_t stripe;	/* Stripe unit in sectors (0: unknown) */
+	int flash;		/* Whether the flash profile is used */
+	unsigned int flash_rate_mbs;	/* Rate cap in MB/s (0: none) */
+	int nexcl;		/* Partitions left out of the round */
+	uint64_t excl_start[SCRUB_POLICY_MAX];	/* Their first sectors */
+	uint64_t excl_end[SCRUB_POLICY_MAX];	/* Their ends */
 
 	/* Mutex variables */
 	struct mutex mutexerr;
@@ -73,6 +115,7 @@ struct scrub_thread_data {
 	struct scrubparams *s;
 	uint64_t pos;
 	uint64_t count;
+	unsigned int cmd;	/* Sectors per command */
 	int state;
 	int tid;
 };
@@ -91,11 +134,687 @@ int islater(struct timespec *b, struct timespec *c)
 	}
 }
 
+/* Upper bound on the bad sectors pinpointed within a single failed command,
+ * so that a dead stretch of the disk doesn't turn into 64K commands */
+#define LOCATE_MAX 64
+
+/*
+ * Read engine. Devices that don't understand VERIFY (dm, md, loop, nbd,
+ * virtio-blk, ...) are scrubbed by reading segments with READ bios and
+ * discarding the data. Every bio reads into the same few pages, since the
+ * data is never looked at. Bios are issued SCRUB_READ_DEPTH at a time, and
+ * the bad sectors of a failed bio are pinpointed with single sector reads.
+ */
+#define SCRUB_READ_DEPTH	16
+
+struct scrub_read_batch {
+	struct disk_scrubber	*s;
+	atomic_t		pending;
+	struct completion	done;
+};
+
+struct scrub_read_io {
+	struct scrub_read_batch	*batch;
+	uint64_t		sector;
+	unsigned int		sectors;
+	int			error;
+};
+
+int scrub_read_init(struct disk_scrubber *s)
+{
+	int i;
+
+	for (i = 0; i < SCRUB_READ_PAGES; i++) {
+		if (!s->rpages[i] && !(s->rpages[i] = alloc_page(GFP_KERNEL)))
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+void scrub_read_exit(struct disk_scrubber *s)
+{
+	int i;
+
+	for (i = 0; i < SCRUB_READ_PAGES; i++) {
+		if (s->rpages[i])
+			__free_page(s->rpages[i]);
+		s->rpages[i] = NULL;
+	}
+}
+
+/* Our bios are told apart from foreground ones by their end_io */
+void scrub_read_end_io(struct bio *bio, int error)
+{
+	struct scrub_read_io *io = bio->bi_private;
+	struct scrub_read_batch *b = io->batch;
+
+	if (error || !test_bit(BIO_UPTODATE, &bio->bi_flags))
+		io->error = error ? error : -EIO;
+	bio_put(bio);
+	atomic_long_inc(&b->s->rios);
+
+	if (atomic_dec_and_test(&b->pending))
+		complete(&b->done);
+}
+
+/* Reads up to SCRUB_READ_DEPTH bios of at most max sectors each, starting
+ * from pos, and waits for them. Returns the number of bios issued, or a
+ * negative error if none could be. */
+static int scrub_read_bios(struct disk_scrubber *s, struct block_device *bdev,
+	uint64_t pos, uint64_t count, unsigned int max, struct scrub_read_io *ios)
+{
+	struct scrub_read_batch b;
+	struct bio *bio;
+	unsigned int len, left;
+	int i, n;
+
+	b.s = s;
+	atomic_set(&b.pending, 1);
+	init_completion(&b.done);
+
+	for (n = 0; n < SCRUB_READ_DEPTH && count; n++) {
+		bio = bio_alloc(GFP_NOIO, SCRUB_READ_PAGES);
+		bio->bi_sector = pos;
+		bio->bi_bdev = bdev;
+		bio->bi_end_io = scrub_read_end_io;
+		bio->bi_private = &ios[n];
+
+		left = (unsigned int) min_t(uint64_t, count, max);
+		for (i = 0; i < SCRUB_READ_PAGES && left; i++) {
+			len = min_t(unsigned int, left << 9, PAGE_SIZE);
+			if (bio_add_page(bio, s->rpages[i], len, 0) < len)
+				break;
+			left -= len >> 9;
+		}
+		if (!bio->bi_size) {
+			bio_put(bio);
+			break;
+		}
+
+		ios[n].batch = &b;
+		ios[n].sector = pos;
+		ios[n].sectors = bio->bi_size >> 9;
+		ios[n].error = 0;
+		pos += ios[n].sectors;
+		count -= ios[n].sectors;
+
+		atomic_inc(&b.pending);
+		submit_bio(READ, bio);
+	}
+
+	if (!atomic_dec_and_test(&b.pending))
+		wait_for_completion(&b.done);
+
+	return n ? n : -EIO;
+}
+
+/* Returns the first sector of the first unreadable logical block of a
+ * failed bio, or -1 if the whole range reads fine on a second try */
+static int64_t scrub_read_locate(struct disk_scrubber *s,
+	struct block_device *bdev, uint64_t pos, uint64_t count)
+{
+	struct scrub_read_io ios[SCRUB_READ_DEPTH];
+	unsigned int bs = scrub_block_sectors(s->disk);
+	int i, n;
+
+	while (count) {
+		n = scrub_read_bios(s, bdev, pos, count, bs, ios);
+		if (n < 0)
+			return -1;
+		for (i = 0; i < n; i++) {
+			if (ios[i].error)
+				return ios[i].sector;
+			pos += ios[i].sectors;
+			count -= ios[i].sectors;
+		}
+	}
+
+	return -1;
+}
+
+/* Returns the block device reads are issued to. It's opened on first use,
+ * and kept open until scrub_read_put(), rather than opened for every
+ * segment. */
+static struct block_device *scrub_read_bdev(struct gendisk *disk)
+{
+	struct disk_scrubber *s = disk->scrubber;
+	struct block_device *bdev;
+
+	if (likely(s->rbdev))
+		return s->rbdev;
+
+	mutex_lock(&s->rbdev_lock);
+	if (!s->rbdev) {
+		bdev = open_by_devnum(disk_devt(disk), FMODE_READ);
+		if (!IS_ERR(bdev))
+			s->rbdev = bdev;
+	}
+	bdev = s->rbdev;
+	mutex_unlock(&s->rbdev_lock);
+
+	return bdev;
+}
+
+/* Closes the block device reads are issued to. Called by the main scrubber
+ * thread when it goes idle or exits, with no read in progress. */
+static void scrub_read_put(struct disk_scrubber *s)
+{
+	struct block_device *bdev;
+
+	mutex_lock(&s->rbdev_lock);
+	bdev = s->rbdev;
+	s->rbdev = NULL;
+	mutex_unlock(&s->rbdev_lock);
+
+	if (bdev)
+		blkdev_put(bdev, FMODE_READ);
+}
+
+/* Reads count sectors starting from lba. Returns and fills in sense like
+ * scsi_verify(), with the first unreadable sector as the reported LBA. */
+static int scrub_read(struct gendisk *disk, uint64_t lba, unsigned int count,
+	struct scrub_sense *sense)
+{
+	struct disk_scrubber *s = disk->scrubber;
+	struct scrub_read_io ios[SCRUB_READ_DEPTH];
+	struct block_device *bdev;
+	unsigned int max = SCRUB_READ_PAGES << (PAGE_SHIFT - 9);
+	unsigned int mask = scrub_block_sectors(disk) - 1;
+	int64_t bad;
+	int i, n, res = 0;
+
+	if (sense)
+		memset(sense, 0, sizeof(*sense));
+
+	/* Bios must cover whole logical blocks */
+	count = (unsigned int) (((lba + count + mask) & ~(uint64_t) mask) -
+		(lba & ~(uint64_t) mask));
+	lba &= ~(uint64_t) mask;
+
+	bdev = scrub_read_bdev(disk);
+	if (!bdev)
+		return SG_LIB_CAT_NOT_READY;
+
+	while (count && !res) {
+		n = scrub_read_bios(s, bdev, lba, count, max, ios);
+		if (n < 0) {
+			res = SG_LIB_CAT_OTHER;
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (!ios[i].error) {
+				lba += ios[i].sectors;
+				count -= ios[i].sectors;
+				continue;
+			}
+
+			/* There's no sense data for bios: report an
+			 * unrecovered read error */
+			if (sense) {
+				sense->key = 0x3;
+				sense->asc = 0x11;
+			}
+			bad = scrub_read_locate(s, bdev, ios[i].sector,
+				ios[i].sectors);
+			if (bad >= 0) {
+				if (sense)
+					sense->info = bad;
+				res = SG_LIB_CAT_MEDIUM_HARD_WITH_INFO;
+			} else
+				res = SG_LIB_CAT_MEDIUM_HARD;
+			if (s->verbose)
+				printk(KERN_INFO "scrubber (%s): read error (%d) in "
+					"lba=%llu-%llu\n", disk->disk_name, ios[i].error,
+					ios[i].sector, ios[i].sector + ios[i].sectors - 1);
+			break;
+		}
+	}
+
+	return res;
+}
+
+/* Returns whether segments are read rather than verified. In auto mode,
+ * bio-based devices are always read, and the rest are probed with a single
+ * sector verification. */
+static int scrub_use_read(struct gendisk *disk)
+{
+	struct disk_scrubber *s = disk->scrubber;
+	int res;
+
+	if (likely(s->use_read >= 0))
+		return s->use_read;
+
+	mutex_lock(&s->sysfs_lock);
+	if (s->use_read < 0) {
+		/* There's no way to pass VERIFY to bio-based devices */
+		if (!disk->queue->request_fn || s->engine == SCRUB_ENGINE_READ)
+			res = 1;
+		else if (s->engine == SCRUB_ENGINE_VERIFY)
+			res = 0;
+		else {
+			res = scsi_verify(disk, 0, 1, NULL);
+			res = !(res == 0 || res == SG_LIB_CAT_MEDIUM_HARD ||
+				res == SG_LIB_CAT_MEDIUM_HARD_WITH_INFO);
+		}
+
+		if (res && scrub_read_init(s)) {
+			printk(KERN_ERR "scrubber (%s): cannot allocate read "
+				"buffer.\n", disk->disk_name);
+			res = 0;
+		}
+		s->use_read = res;
+		if (s->verbose)
+			printk(KERN_INFO "scrubber (%s): using the %s engine\n",
+				disk->disk_name, res ? "read" : "verify");
+	}
+	mutex_unlock(&s->sysfs_lock);
+
+	return s->use_read;
+}
+
+/* Verifies (or reads) count sectors starting from lba */
+static int scrub_verify(struct gendisk *disk, uint64_t lba,
+	unsigned int count, struct scrub_sense *sense)
+{
+	if (scrub_use_read(disk))
+		return scrub_read(disk, lba, count, sense);
+	return scsi_verify(disk, lba, count, sense);
+}
+
+/* Reports a bad logical block, starting at sector lba, and queues a rescan
+ * of its neighborhood. Blocks reported lately (e.g. found again by their
+ * own rescan, or reported by regular reads) are only reported once. */
+static void bad_sector(struct gendisk *disk, uint64_t lba, int rescan,
+	struct scrub_sense *sense)
+{
+	unsigned int bs = scrub_block_sectors(disk);
+
+	if (scrub_bad_reported(disk->scrubber, lba, bs))
+		return;
+
+	atomic_inc(&disk->scrubber->bad_sectors);
+	printk(KERN_INFO "scrubber (%s): Bad sector at lba=%llu\n",
+		disk->disk_name, lba);
+	blk_scrub_log_error(disk, lba, sense->key, sense->asc, sense->ascq,
+		BLK_SCRUB_SRC_SCRUB);
+	if (rescan)
+		blk_scrub_rescan(disk, lba, bs, GFP_KERNEL);
+	scrub_notify_bad_sector(disk, lba, bs);
+}
+
+/*
+ * Pinpoints the bad sectors after a failed verification of num sectors
+ * starting from pos, with result res (and sense data). When the drive
+ * reports the LBA of the error, verification resumes right after it. When
+ * it doesn't, the range is bisected with shrinking verifications until the
+ * bad sectors are found, in O(k log n) commands for k bad sectors. Ranges
+ * are whole logical blocks, so bisection stops at one block. Returns the
+ * number of bad blocks found.
+ */
+static int locate_errors(struct gendisk *disk, uint64_t pos, uint64_t num,
+	int res, struct scrub_sense *sense, int rescan, int *budget)
+{
+	int found = 0;
+	unsigned int bs = scrub_block_sectors(disk);
+	uint64_t half, mask = bs - 1;
+	struct scrub_sense hsense;
+
+	num = ((pos + num + mask) & ~mask) - (pos & ~mask);
+	pos &= ~mask;
+
+	while (num && res) {
+		if (res != SG_LIB_CAT_MEDIUM_HARD &&
+		    res != SG_LIB_CAT_MEDIUM_HARD_WITH_INFO) {
+			/* Not a medium error, nothing to pinpoint */
+			blk_scrub_log_error(disk, pos, sense->key, sense->asc,
+				sense->ascq, BLK_SCRUB_SRC_SCRUB);
+			break;
+		}
+
+		if (*budget <= 0) {
+			printk(KERN_INFO "scrubber (%s): Too many bad sectors, "
+				"giving up on lba=%llu-%llu\n", disk->disk_name,
+				pos, pos + num - 1);
+			break;
+		}
+
+		if (res == SG_LIB_CAT_MEDIUM_HARD_WITH_INFO &&
+		    sense->info >= pos && sense->info < pos + num) {
+			/* Skip past the reported block and keep going */
+			bad_sector(disk, sense->info & ~mask, rescan, sense);
+			++found;
+			--*budget;
+			num -= (sense->info & ~mask) + bs - pos;
+			pos = (sense->info & ~mask) + bs;
+			if (num)
+				res = scrub_verify(disk, pos, num, sense);
+			continue;
+		}
+
+		if (num <= bs) {
+			bad_sector(disk, pos, rescan, sense);
+			++found;
+			--*budget;
+			break;
+		}
+
+		/* No (usable) LBA was reported: bisect */
+		half = (num / 2) & ~mask;
+		res = scrub_verify(disk, pos, half, &hsense);
+		found += locate_errors(disk, pos, half, res, &hsense, rescan,
+			budget);
+		pos += half;
+		num -= half;
+		res = scrub_verify(disk, pos, num, sense);
+	}
+
+	return found;
+}
+
+/* Follows up on a failed verification of num sectors starting from pos.
+ * Returns the number of bad blocks found. */
+static int medium_error(struct gendisk *disk, uint64_t pos, uint64_t num,
+	int res, struct scrub_sense *sense, int rescan)
+{
+	int budget = LOCATE_MAX;
+
+	return locate_errors(disk, pos, num, res, sense, rescan, &budget);
+}
+
+/*
+ * Zone bandwidth profile. Outer zones of a rotating disk transfer about
+ * twice as fast as inner ones, so a fixed command size takes about twice as
+ * long on the inner zones. The disk is split in SCRUB_ZONES equal LBA
+ * ranges, and the bandwidth of each is either given through sysfs, or
+ * learned from the response times of large commands. When zoned is on,
+ * segsize is the command size of the fastest zone, and commands elsewhere
+ * shrink in proportion to the bandwidth of their zone, so that every
+ * command takes about the same time.
+ */
+#define SCRUB_CMD_MAX		65535 /* Sectors per command */
+#define ZONE_LEARN_MIN		512 /* Smaller commands are seek-bound */
+
+static int zone_of(struct gendisk *disk, uint64_t pos)
+{
+	uint64_t cap = get_capacity(disk);
+
+	if (!cap || pos >= cap)
+		return SCRUB_ZONES - 1;
+	return (int) div64_u64(pos * SCRUB_ZONES, cap);
+}
+
+/* Returns the first sector past the zone of pos */
+static uint64_t zone_end(struct gendisk *disk, uint64_t pos)
+{
+	uint64_t cap = get_capacity(disk);
+	int z = zone_of(disk, pos);
+
+	if (z == SCRUB_ZONES - 1)
+		return cap;
+	return div64_u64(cap * (z + 1) + SCRUB_ZONES - 1, SCRUB_ZONES);
+}
+
+/* Folds the response time of a successful command into the profile.
+ * Called with sysfs_lock held. */
+static void zone_learn(struct gendisk *disk, uint64_t pos, unsigned int num,
+	uint64_t us)
+{
+	struct disk_scrubber *ds = disk->scrubber;
+	uint32_t kbs, *rate;
+
+	if (!ds->zone_learn || num < ZONE_LEARN_MIN || !us)
+		return;
+
+	kbs = (uint32_t) div64_u64((uint64_t) num * 500000, us);
+	rate = &ds->zone_kbs[zone_of(disk, pos)];
+	*rate = *rate ? (*rate * 7 + kbs) / 8 : kbs;
+}
+
+/* Marks the zones closer in bandwidth to the slowest zone than to the
+ * fastest one as slow */
+static void zone_classify(struct scrubparams *s)
+{
+	uint32_t lo = 0, hi = 0;
+	int z;
+
+	s->zone_slow = 0;
+	for (z = 0; z < SCRUB_ZONES; z++) {
+		if (!s->zone_kbs[z])
+			continue;
+		if (!lo || s->zone_kbs[z] < lo)
+			lo = s->zone_kbs[z];
+		if (s->zone_kbs[z] > hi)
+			hi = s->zone_kbs[z];
+	}
+
+	for (z = 0; z < SCRUB_ZONES; z++)
+		if (s->zone_kbs[z] && s->zone_kbs[z] < lo + (hi - lo) / 2)
+			s->zone_slow |= 1 << z;
+}
+
+static int zone_is_slow(struct gendisk *disk, struct scrubparams *s,
+	uint64_t pos)
+{
+	return (s->zone_slow >> zone_of(disk, pos)) & 1;
+}
+
+/* Returns the command size for segments starting from pos */
+static unsigned int zone_cmd_sectors(struct gendisk *disk,
+	struct scrubparams *s, uint64_t pos)
+{
+	uint32_t ref = 0, rate;
+	uint64_t cmd;
+	int z;
+
+	if (!s->zoned)
+		return SCRUB_CMD_MAX;
+
+	for (z = 0; z < SCRUB_ZONES; z++)
+		ref = max(ref, s->zone_kbs[z]);
+	rate = s->zone_kbs[zone_of(disk, pos)];
+	if (!ref || !rate)
+		return SCRUB_CMD_MAX;
+
+	cmd = div64_u64(s->segsize * rate, ref) & ~7ULL;
+	return (unsigned int) clamp_t(uint64_t, cmd, 8, SCRUB_CMD_MAX);
+}
+
+/*
+ * Track alignment. A command that crosses a track boundary pays for a head
+ * switch, and often for most of an extra rotation. Characterization finds a
+ * track boundary and the track length in each zone, and when trackalign is
+ * on, sequential segments are stretched or shrunk to end on the track
+ * boundary closest to segsize, so that they span whole tracks.
+ *
+ * Track lengths vary within our zones, and spared sectors shift boundaries,
+ * so a boundary is only extrapolated up to TRACK_REACH sectors away from
+ * where it was found. Past that, a boundary is probed for again, near the
+ * current position. A probe takes about 60 rotations.
+ */
+#define TRACK_REACH	(1ULL << 23) /* 4GB */
+
+static void track_discover(struct gendisk *disk, uint64_t pos, uint32_t kbs,
+	uint32_t cmd_us, uint64_t *start, uint32_t *len);
+
+static uint64_t track_align(struct gendisk *disk, struct scrubparams *s,
+	uint64_t pos, uint64_t len)
+{
+	int z = zone_of(disk, pos);
+	uint64_t base, len_t, end = pos + len, k;
+
+	if (!s->trackalign || !s->track_len[z])
+		return len;
+
+	if (!s->trk_valid || zone_of(disk, s->trk_at) != z ||
+	    max(pos, s->trk_at) - min(pos, s->trk_at) > TRACK_REACH) {
+		s->trk_valid = 1;
+		if (max(pos, s->track_start[z]) - min(pos, s->track_start[z]) <=
+		    TRACK_REACH) {
+			/* Characterization found one close enough */
+			s->trk_at = s->track_start[z];
+			s->trk_start = s->track_start[z];
+			s->trk_len = s->track_len[z];
+		} else {
+			s->trk_at = pos;
+			track_discover(disk, pos, s->zone_kbs[z], s->cost_cmd_us,
+				&s->trk_start, &s->trk_len);
+			if (s->verbose > 1)
+				printk(KERN_INFO "scrubber (%s): %u sectors per "
+					"track, boundary at %llu.\n", disk->disk_name,
+					s->trk_len, s->trk_start);
+		}
+	}
+	base = s->trk_start;
+	len_t = s->trk_len;
+	if (!len_t)
+		return len;
+
+	/* Closest boundary to the end, but past pos */
+	if (end >= base) {
+		k = div64_u64(end - base + len_t / 2, len_t);
+		end = base + k * len_t;
+	} else {
+		k = div64_u64(base - end + len_t / 2, len_t);
+		end = base - k * len_t;
+	}
+	while (end <= pos)
+		end += len_t;
+
+	return end - pos;
+}
+
+/*
+ * Weak sectors. A sector that only reads after internal retries doesn't
+ * fail verification, it is just slow, since every retry costs about a
+ * rotation; and it is likely to fail for good later on. A command that
+ * takes weak_factor per-command overheads longer than the cost model
+ * predicts is verified again in halves, down to WEAK_MIN_SECTORS, and the
+ * ranges that stay slow are remembered as weak. Depending on weak_action,
+ * they are then rewritten by the notifiers (e.g. md, from redundancy), or
+ * reassigned by the drive. Commands of other threads skew response times,
+ * so only single-threaded rounds are checked.
+ */
+#define WEAK_MIN_SECTORS	8
+#define WEAK_MAX_PROBES		64 /* Verifications per outlier */
+
+/* Returns whether verifying num sectors from pos in us is an outlier. The
+ * cost model doesn't cover seeks, so unless the head was just over the
+ * range, a full stroke is allowed for. */
+static int weak_slow(struct gendisk *disk, struct scrubparams *s,
+	uint64_t pos, unsigned int num, uint64_t us, int seek)
+{
+	uint32_t kbs = s->zone_kbs[zone_of(disk, pos)];
+	uint64_t expect;
+
+	if (!s->weak_factor || s->threads > 1 || !s->cost_cmd_us || !kbs)
+		return 0;
+
+	expect = s->cost_cmd_us + div64_u64((uint64_t) num * 500000, kbs);
+	if (seek)
+		expect += s->seek_full_us;
+	return us > expect + (uint64_t) s->weak_factor * s->cost_cmd_us;
+}
+
+/* Remembers a weak range, in place of the one found slow longest ago when
+ * the list is full */
+static void weak_record(struct gendisk *disk, uint64_t pos, unsigned int num,
+	uint64_t us)
+{
+	struct disk_scrubber *ds = disk->scrubber;
+	struct scrub_weak *w = NULL;
+	int i;
+
+	mutex_lock(&ds->sysfs_lock);
+	for (i = 0; i < ds->nweak && !w; i++)
+		if (ds->weak[i].sector == pos)
+			w = &ds->weak[i];
+	if (w) {
+		++w->count;
+	} else {
+		if (ds->nweak < SCRUB_WEAK_MAX)
+			w = &ds->weak[ds->nweak++];
+		else
+			for (w = &ds->weak[0], i = 1; i < SCRUB_WEAK_MAX; i++)
+				if (time_before(ds->weak[i].stamp, w->stamp))
+					w = &ds->weak[i];
+		w->sector = pos;
+		w->count = 1;
+	}
+	w->len = num;
+	w->us = (uint32_t) min_t(uint64_t, us, UINT_MAX);
+	w->stamp = get_seconds();
+	mutex_unlock(&ds->sysfs_lock);
+
+	printk(KERN_INFO "scrubber (%s): Weak sectors at lba=%llu+%u (%llu us)\n",
+		disk->disk_name, pos, num, us);
+}
+
+static void weak_fix(struct gendisk *disk, struct scrubparams *s,
+	uint64_t pos, unsigned int num)
+{
+	int res;
+
+	switch (s->weak_action) {
+		case SCRUB_WEAK_REWRITE:
+			scrub_notify_bad_sector(disk, pos, num);
+			break;
+		case SCRUB_WEAK_REASSIGN:
+			/* Only SCSI devices know how to reassign */
+			if (scrub_use_read(disk))
+				break;
+			if ((res = scsi_reassign_blocks(disk, pos, num)))
+				printk(KERN_INFO "scrubber (%s): Reassigning "
+					"lba=%llu+%u failed (%d)\n",
+					disk->disk_name, pos, num, res);
+			break;
+	}
+}
+
+/* Verifies num sectors from pos again, and bisects them while they stay
+ * slow. Returns the number of weak ranges found. */
+static int weak_isolate(struct gendisk *disk, struct scrubparams *s,
+	uint64_t pos, unsigned int num, int *budget)
+{
+	struct timeval va, vb;
+	uint64_t us;
+	unsigned int half, min;
+	int res;
+
+	min = max_t(unsigned int, WEAK_MIN_SECTORS, scrub_block_sectors(disk));
+	if (!num || (*budget)-- <= 0 || kthread_should_stop())
+		return 0;
+
+	do_gettimeofday(&va);
+	res = scrub_verify(disk, pos, num, NULL);
+	do_gettimeofday(&vb);
+	us = (vb.tv_sec - va.tv_sec) * 1000000 + (vb.tv_usec - va.tv_usec);
+
+	/* Errors are left to medium_error(), and passing slowness is ignored */
+	if (res || !weak_slow(disk, s, pos, num, us, 0))
+		return 0;
+
+	if (num <= min) {
+		weak_record(disk, pos, num, us);
+		weak_fix(disk, s, pos, num);
+		return 1;
+	}
+
+	half = (num / 2) & ~(min - 1);
+	if (!half)
+		half = num / 2;
+	return weak_isolate(disk, s, pos, half, budget) +
+		weak_isolate(disk, s, pos + half, num - half, budget);
+}
+
 int kthread_segread(void *thread_data)
 {
 	int res;
-	uint64_t pos, count, resptime;
-	unsigned int num;
+	uint64_t pos, count, resptime = 0;
+	struct scrub_sense sense;
+	unsigned int num, max;
+	int learn, timing, budget;
 	//float sumtime = 0.0;
 	struct timeval va, vb;
 
@@ -148,20 +867,30 @@ int kthread_segread(void *thread_data)
 				/* Extract data loaded in struct */
 				pos = data->pos;
 				count = data->count;
+				max = data->cmd;
+				learn = data->s->zoned || data->s->zone_idle_ms;
+				timing = learn || data->s->weak_factor;
 				/* if (count == 65536)
 					count = 65535; */
 
-				for (;; count -= 65535, pos += 65535) {
+				for (;; count -= num, pos += num) {
 					if (data->s->verbose > 1)
 						printk(KERN_INFO "scrubber (%s): About to scrub %llu "
 						"sectors, starting from %llu.\n", data->disk->disk_name,
 						count, pos);
 
-					num = (count > 65535) ? 65535 : (unsigned int) count;
+					num = (count > max) ? max : (unsigned int) count;
 
-					if (data->s->timed) do_gettimeofday(&va);
+					if (data->s->timed || timing)
+						do_gettimeofday(&va);
 
-					res = scsi_verify(data->disk, pos, num);
+					res = scrub_verify(data->disk, pos, num, &sense);
+
+					if (timing) {
+						do_gettimeofday(&vb);
+						resptime = (vb.tv_sec - va.tv_sec) * 1000000 +
+							(vb.tv_usec - va.tv_usec);
+					}
 
 					if (data->s->timed){
 						do_gettimeofday(&vb);
@@ -193,16 +922,24 @@ int kthread_segread(void *thread_data)
 						mutex_lock(&data->s->mutexerr);
 						++data->s->read_errs;
 						mutex_unlock(&data->s->mutexerr);
+						medium_error(data->disk, pos, num, res, &sense, 1);
+					} else if (weak_slow(data->disk, data->s, pos, num,
+							resptime, 1)) {
+						budget = WEAK_MAX_PROBES;
+						weak_isolate(data->disk, data->s, pos, num,
+							&budget);
 					}
 
 					//mutex_lock(&data->s->mutextime);
 					mutex_lock(&data->disk->scrubber->sysfs_lock);
 					++data->s->reqcount;
 					++data->disk->scrubber->reqcount;
+					if (learn && !res)
+						zone_learn(data->disk, pos, num, resptime);
 					//mutex_unlock(&data->s->mutextime);
 					mutex_unlock(&data->disk->scrubber->sysfs_lock);
 
-					if (count <= 65535) break;
+					if (count <= max) break;
 				}
 				/* Record time passed */
 				//if (rtime[tid] == 0.0)
@@ -235,9 +972,321 @@ int kthread_segread(void *thread_data)
 		}
 	}
 
-	//printk(KERN_INFO "scrubber (%s): Thread exiting with return. That shouldn't happen!\n",
-	//	data->disk->disk_name);
+	//printk(KERN_INFO "scrubber (%s): Thread exiting with return. That shouldn't happen!\n",
+	//	data->disk->disk_name);
+
+	return 0;
+}
+
+/* Verifies count sectors starting from pos, in chunks of at most 65535
+ * sectors. Returns the number of failed verifications, the first sector of
+ * the first chunk that failed in bad, and adds the number of bad sectors
+ * found to bad_sectors. Bad sectors are pinpointed and, unless this is a
+ * rescan itself, their neighborhood is rescanned. */
+static int verify_range(struct gendisk *disk, uint64_t pos, uint64_t count,
+	uint64_t *bad, uint64_t *bad_sectors, int rescan)
+{
+	int res, found, errors = 0;
+	unsigned int num;
+	struct scrub_sense sense;
+
+	for (; count; count -= num, pos += num) {
+		num = (count > 65535) ? 65535 : (unsigned int) count;
+		if ((res = scrub_verify(disk, pos, num, &sense))) {
+			if (!errors && bad)
+				*bad = pos;
+			++errors;
+			found = medium_error(disk, pos, num, res, &sense, rescan);
+			if (bad_sectors)
+				*bad_sectors += (uint64_t) found *
+					scrub_block_sectors(disk);
+		}
+	}
+
+	return errors;
+}
+
+/* Serves up to chunks segment-sized chunks (0 for no limit) of pending jobs
+ * with priority no lower than maxprio. Jobs are served synchronously by the
+ * caller, which is always the main scrubber thread. Returns the number of
+ * chunks served. */
+static int serve_jobs(struct gendisk *disk, int maxprio, int chunks)
+{
+	struct disk_scrubber *ds = disk->scrubber;
+	struct scrub_job *job;
+	uint64_t bad = 0, num, chunk;
+	int errors, served = 0;
+
+	while ((!chunks || served < chunks) &&
+	       (job = scrub_dequeue_job(ds, maxprio)) != NULL) {
+		chunk = job->chunk ? job->chunk : ds->segsize * 2;
+		num = job->start + job->len - job->pos;
+		if (num > chunk)
+			num = chunk;
+
+		if (ds->verbose > 1)
+			printk(KERN_INFO "scrubber (%s): Job: scrubbing %llu sectors, "
+				"starting from %llu (prio %d).\n", disk->disk_name,
+				num, job->pos, job->prio);
+
+		errors = verify_range(disk, job->pos, num, &bad,
+			&job->bad_sectors, !(job->flags & SCRUB_JOB_RESCAN));
+		if (errors && !job->errors)
+			job->bad_sector = bad;
+		job->errors += errors;
+		job->pos += num;
+		++served;
+
+		if (job->pos < job->start + job->len)
+			scrub_requeue_job(ds, job);
+		else
+			scrub_end_job(job);
+	}
+
+	return served;
+}
+
+/*
+ * Metadata tier. Metadata areas are always scrubbed at the start of every
+ * round, ahead of bulk data. When meta_period_s is set, they are scrubbed
+ * again every meta_period_s seconds, within a round or between rounds. The
+ * metadata map is rebuilt for every pass.
+ */
+static int meta_due(struct disk_scrubber *ds)
+{
+	return ds->meta_period_s && !time_before(get_seconds(), ds->meta_next);
+}
+
+/* Returns the time to sleep until the next metadata pass is due */
+static long meta_timeout(struct disk_scrubber *ds)
+{
+	unsigned long now = get_seconds();
+
+	if (!ds->meta_period_s)
+		return MAX_SCHEDULE_TIMEOUT;
+	if (!time_before(now, ds->meta_next))
+		return 1;
+	return msecs_to_jiffies(min(ds->meta_next - now, 3600UL) * 1000);
+}
+
+static void meta_pass(struct gendisk *disk)
+{
+	struct disk_scrubber *ds = disk->scrubber;
+	uint64_t pos = 0, start, len, capacity = get_capacity(disk);
+
+	mutex_lock(&ds->sysfs_lock);
+	ds->meta_next = get_seconds() + (unsigned long) ds->meta_period_s;
+	mutex_unlock(&ds->sysfs_lock);
+
+	if (scrub_map_build(ds, &ds->meta, SCRUB_MAP_METADATA)) {
+		printk(KERN_INFO "scrubber (%s): cannot build metadata map.\n",
+			disk->disk_name);
+		return;
+	}
+	if (ds->verbose)
+		printk(KERN_INFO "scrubber (%s): Scrubbing %llu metadata sectors.\n",
+			disk->disk_name, ds->meta.sectors);
+
+	while (scrub_map_next(&ds->meta, pos, &start, &len) && start < capacity) {
+		if (start + len > capacity)
+			len = capacity - start;
+		verify_range(disk, start, len, NULL, NULL, 1);
+		pos = start + len;
+		if (ds->state == 2 || kthread_should_stop())
+			break;
+	}
+}
+
+/* Returns 0 if a periodic round is due now, or the time to sleep until one
+ * might be (MAX_SCHEDULE_TIMEOUT if periodic scrubbing is off) */
+static long sched_timeout(struct disk_scrubber *ds)
+{
+	unsigned long now = get_seconds(), wait;
+
+	if (!ds->period_s)
+		return MAX_SCHEDULE_TIMEOUT;
+
+	mutex_lock(&ds->sysfs_lock);
+	if (time_before(now, ds->next_start))
+		wait = ds->next_start - now;
+	else
+		wait = scrub_window_wait(ds, now);
+	mutex_unlock(&ds->sysfs_lock);
+
+	if (!wait)
+		return 0;
+	/* Check back at least hourly, in case the clock was changed */
+	return msecs_to_jiffies(min(wait, 3600UL) * 1000);
+}
+
+/* Pauses the round while we're outside the allowed time-of-day windows.
+ * Urgent jobs are still served while paused. */
+static void wait_window(struct gendisk *disk, struct scrubparams *s)
+{
+	struct disk_scrubber *ds = disk->scrubber;
+	unsigned long wait;
+	int paused = 0;
+
+	while (ds->state != 2 && !kthread_should_stop()) {
+		mutex_lock(&ds->sysfs_lock);
+		wait = scrub_window_wait(ds, get_seconds());
+		mutex_unlock(&ds->sysfs_lock);
+		if (!wait)
+			break;
+
+		if (!paused++ && s->verbose)
+			printk(KERN_INFO "scrubber (%s): Outside scrubbing window, "
+				"pausing for %lu sec.\n", disk->disk_name, wait);
+
+		serve_jobs(disk, BLK_SCRUB_PRIO_NORMAL - 1, 0);
+		schedule_timeout_interruptible(msecs_to_jiffies(min(wait, 60UL) * 1000));
+	}
+
+	if (paused && s->verbose)
+		printk(KERN_INFO "scrubber (%s): Resuming scrubbing.\n",
+			disk->disk_name);
+}
+
+static void set_threads_ioprio(struct gendisk *disk, struct scrubparams *s,
+	struct scrub_thread_data *tdata, int ioprio)
+{
+	struct task_struct *ttask;
+	int i;
+
+	for (i = 0; i <= s->threads; i++) {
+		ttask = (i == s->threads) ? current : tdata[i].task;
+		if (set_task_ioprio(ttask, ioprio))
+			printk(KERN_INFO "scrubber (%s): Failed to set CFQ priorities for %d\n",
+				disk->disk_name, ttask->pid);
+	}
+}
+
+/*
+ * Deadline-driven pacing. The pass starts out in the idle class, so that it
+ * only uses idle time. From the sectors and the time left, we get the rate
+ * needed to finish by the deadline. Whenever the rate achieved so far falls
+ * short of it, delayms is dropped and threads are raised to the best-effort
+ * class, one level above BE/7 for every PACE_STEP percent of shortfall, up
+ * to BE/0 once the deadline is past. They are dropped back to the idle
+ * class once we've caught up.
+ */
+#define PACE_STEP	25 /* Shortfall (%) per best-effort level */
+
+static void pace_deadline(struct gendisk *disk, struct scrubparams *s,
+	struct scrub_thread_data *tdata)
+{
+	struct disk_scrubber *ds = disk->scrubber;
+	struct timeval now;
+	uint64_t elapsed_ms, left_ms, left, needed, achieved, projected_ms;
+	int boost = 0;
+
+	if (!s->total || !s->deadline_ms)
+		return;
+
+	do_gettimeofday(&now);
+	elapsed_ms = (now.tv_sec - s->rstart.tv_sec) * 1000 +
+		(now.tv_usec - s->rstart.tv_usec) / 1000;
+	left = s->done < s->total ? s->total - s->done : 0;
+	left_ms = elapsed_ms < s->deadline_ms ? s->deadline_ms - elapsed_ms : 0;
+
+	if (s->done && elapsed_ms)
+		projected_ms = div64_u64(elapsed_ms * left, s->done);
+	else
+		projected_ms = s->deadline_ms;
+
+	mutex_lock(&ds->sysfs_lock);
+	ds->remaining_s = (int64_t) projected_ms / 1000;
+	ds->completion_s = get_seconds() + (unsigned long) ds->remaining_s;
+	ds->slack_s = ((int64_t) s->deadline_ms - (int64_t) elapsed_ms -
+		(int64_t) projected_ms) / 1000;
+	mutex_unlock(&ds->sysfs_lock);
+
+	/* Sectors per second needed from now on, and achieved so far */
+	if (left && !left_ms)
+		boost = 8;
+	else if (left) {
+		needed = div64_u64(left * 1000, left_ms);
+		achieved = elapsed_ms ? div64_u64(s->done * 1000, elapsed_ms) : 0;
+		if (needed > achieved && !achieved)
+			boost = 1;
+		else if (needed > achieved)
+			boost = 1 + (int) min_t(uint64_t, 7,
+				div64_u64((needed - achieved) * 100,
+					achieved * PACE_STEP));
+	}
+	if (boost == s->boosted)
+		return;
+
+	if (s->verbose > 1)
+		printk(KERN_INFO "scrubber (%s): %s schedule (%llu/%llu sectors "
+			"after %llu ms), %s busy time.\n", disk->disk_name,
+			boost ? "Behind" : "Back on", s->done, s->total, elapsed_ms,
+			boost ? "claiming" : "yielding");
+
+	set_threads_ioprio(disk, s, tdata, boost ?
+		IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, (8 - boost)) :
+		IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0));
+	s->boosted = boost;
+}
+
+/*
+ * Partition policies (see block/scrub_part.c). A partition round covers
+ * its partition, with the strategy, priority and delay of its policy. A
+ * disk round leaves out the partitions with policies of their own.
+ */
+
+/* Applies the policy of the partition of the round, if any. Called with
+ * sysfs_lock held, after the rest of the parameters were copied. */
+static void part_policy(struct gendisk *disk, struct scrubparams *s)
+{
+	struct disk_scrubber *ds = disk->scrubber;
+	struct scrub_policy *p;
+	struct hd_struct *part;
+
+	s->nexcl = 0;
+	if (ds->part_round) {
+		p = scrub_policy_find(ds, ds->part_round);
+		part = disk_get_part(disk, ds->part_round);
+		if (p && part) {
+			s->start = part->start_sect;
+			s->capacity = part->nr_sects;
+			/* Names are in the same order as the constants */
+			if (p->strategy)
+				s->strategy = p->strategy;
+			/* Characterization covers the whole disk */
+			if (s->strategy == CHARSCRUB)
+				s->strategy = SEQLSCRUB;
+			if (p->priority)
+				s->priority = p->priority;
+			s->delayms = p->delayms;
+			if (p->period_s)
+				s->deadline_ms = p->period_s * 1000;
+		}
+		disk_put_part(part);
+		return;
+	}
+
+	list_for_each_entry(p, &ds->policies, list) {
+		if (!p->own || s->nexcl == SCRUB_POLICY_MAX)
+			continue;
+		part = disk_get_part(disk, p->partno);
+		if (!part)
+			continue;
+		s->excl_start[s->nexcl] = part->start_sect;
+		s->excl_end[s->nexcl++] = part->start_sect + part->nr_sects;
+		disk_put_part(part);
+	}
+}
+
+/* Returns whether count sectors from pos are all in a partition left out
+ * of the round */
+static int part_excluded(struct scrubparams *s, uint64_t pos, uint64_t count)
+{
+	int i;
 
+	for (i = 0; i < s->nexcl; i++)
+		if (pos >= s->excl_start[i] && pos + count <= s->excl_end[i])
+			return 1;
 	return 0;
 }
 
@@ -247,9 +1296,36 @@ int segread(struct gendisk *disk, struct scrubparams *s,
 	int tcounter = 0;
 	struct timeval temp;
 
+	wait_window(disk, s);
+
+	/* Urgent jobs jump ahead of the round; the rest are interleaved with
+	 * it, one chunk per segment */
+	serve_jobs(disk, BLK_SCRUB_PRIO_NORMAL - 1, 0);
+	serve_jobs(disk, BLK_SCRUB_PRIO_LOW, 1);
+
+	if (meta_due(disk->scrubber))
+		meta_pass(disk);
+	if (scrub_wdirty_due(disk->scrubber))
+		scrub_wdirty_flush(disk->scrubber);
+
+	/* Segments without allocated blocks or mapped LBAs, or in partitions
+	 * with policies of their own, count as done */
+	if (part_excluded(s, pos, count) ||
+	    (s->skip_free &&
+	     !scrub_map_marked(&disk->scrubber->amap, pos, count)) ||
+	    (s->thin && !scrub_lbas_mapped(disk->scrubber, pos, count))) {
+		if (s->total)
+			s->done += count;
+		return 0;
+	}
+
+	if (s->priority == DLINEPRIO)
+		pace_deadline(disk, s, tdata);
+
 	/* Check the number of available threads */
 	set_current_state(TASK_INTERRUPTIBLE);
-	if (s->priority == RTIMEPRIO || s->priority == IDCHKPRIO) {
+	if (s->priority == RTIMEPRIO || s->priority == IDCHKPRIO ||
+	    s->priority == DLINEPRIO) {
 		while (!s->available){
 			schedule();
 			set_current_state(TASK_INTERRUPTIBLE);
@@ -283,7 +1359,8 @@ int segread(struct gendisk *disk, struct scrubparams *s,
 	--s->available;
 	mutex_unlock(&s->mutexavail);
 
-	if (s->delayms) {
+	/* Behind the deadline, we don't hold back */
+	if (s->delayms && !s->boosted) {
 		if (s->verbose > 2) {
 			do_gettimeofday(&temp);
 			printk(KERN_INFO "scrubber (%s): Before schedule_timeout, current_time is %ld.%ldusec\n",
@@ -304,6 +1381,9 @@ int segread(struct gendisk *disk, struct scrubparams *s,
 	/* Prep thread data */
 	tdata[tcounter].pos = pos;
 	tdata[tcounter].count = count;
+	tdata[tcounter].cmd = zone_cmd_sectors(disk, s, pos);
+	if (s->total)
+		s->done += count;
 
 	/* Now that we're ready, raise the barrier */
 	if (s->verbose > 2)
@@ -343,6 +1423,186 @@ static uint64_t lceil (uint64_t whole, uint64_t part, struct gendisk *disk,
 		return ((uint64_t) 1 + (whole/part));
 }
 
+/* Returns for how long (ms) no foreground requests were seen on the disk.
+ * Our own VERIFY commands don't show up in the disk statistics, but the
+ * read engine's bios do: requests beyond the number of bios we read are
+ * foreground ones. Our bios may be merged into fewer requests, so a few
+ * foreground requests alongside them can go unnoticed. */
+static unsigned int idle_ms(struct gendisk *disk)
+{
+	struct disk_scrubber *ds = disk->scrubber;
+	unsigned long ios = part_stat_read(&disk->part0, ios[READ]) +
+		part_stat_read(&disk->part0, ios[WRITE]);
+	unsigned long rios = atomic_long_read(&ds->rios);
+
+	if (ios - ds->idle_ios > rios - ds->idle_rios ||
+	    part_in_flight(&disk->part0)) {
+		ds->idle_ios = ios;
+		ds->idle_rios = rios;
+		ds->idle_since = jiffies;
+	}
+
+	return jiffies_to_msecs(jiffies - ds->idle_since);
+}
+
+/* Tracks the locality of foreground requests: the share (of 1024) of
+ * recent requests that started within two regions of the end of the
+ * previous one. Called for every bio, without locking; a lost update only
+ * skews the average a little. fg_last is atomic so that it doesn't tear on
+ * 32-bit. */
+void blk_scrub_seen(struct gendisk *disk, uint64_t sector, uint64_t len)
+{
+	struct disk_scrubber *ds = disk->scrubber;
+	uint64_t near = ds->regsize * 2, last = atomic64_read(&ds->fg_last);
+	int local = sector + near >= last && sector <= last + near;
+
+	ds->fg_local = (ds->fg_local * 15 + (local ? 1024 : 0)) / 16;
+	atomic64_set(&ds->fg_last, sector + len);
+}
+
+/*
+ * Zone-aware sequential scrubbing. Two cursors walk the disk, one over the
+ * fast zones and one over the slow ones. Commands on fast zones are over
+ * sooner, so they go to short idle periods, while idle periods longer than
+ * zone_idle_ms are spent on slow zones. Segments don't cross zones.
+ */
+static int zonescrub(struct gendisk *disk, struct scrubparams *s,
+	struct scrub_thread_data *tdata)
+{
+	uint64_t cur[2], pos, num, reqcount = 0;
+	int slow;
+
+	cur[0] = cur[1] = s->start;
+	if (s->verbose)
+		printk(KERN_INFO "scrubber (%s): Starting from %llu to %llu, slow "
+			"zones after %u ms of idleness.\n", disk->disk_name, s->start,
+			s->capacity, s->zone_idle_ms);
+
+	for (;;) {
+		/* Move each cursor to the next zone of its kind */
+		for (slow = 0; slow < 2; slow++)
+			while (cur[slow] < s->capacity &&
+			       zone_is_slow(disk, s, cur[slow]) != slow)
+				cur[slow] = zone_end(disk, cur[slow]);
+		if (cur[0] >= s->capacity && cur[1] >= s->capacity)
+			break;
+
+		slow = idle_ms(disk) >= s->zone_idle_ms;
+		if (cur[slow] >= s->capacity)
+			slow = !slow;
+
+		pos = cur[slow];
+		num = min(track_align(disk, s, pos, s->segsize),
+			min(zone_end(disk, pos), s->capacity) - pos);
+		if (segread(disk, s, tdata, pos, num))
+			return -1;
+		if (disk->scrubber->state == 2 || (s->reqbound && ++reqcount > s->reqbound))
+			return 0;
+
+		cur[slow] += num;
+	}
+
+	return 0;
+}
+
+/*
+ * Partitioned scrubbing, for LUNs and arrays that stripe their LBA space
+ * over many spindles. Threads that pull consecutive segments off a single
+ * cursor all land on the same stripe unit. Instead, the range is split in
+ * parts contiguous sub-ranges, each with a cursor of its own, served round
+ * robin, so that as many threads keep as many spindles busy. When the
+ * stripe unit is known, commands are one stripe unit long, and sub-range i
+ * starts i stripe units into a stripe, so the cursors stay on different
+ * spindles as they advance.
+ */
+
+/* Resolves the geometry of partitioned scrubbing, detecting it from the
+ * I/O hints of the queue (the Block Limits VPD page, or the md chunk and
+ * stripe sizes) where it isn't given. Called with sysfs_lock held. */
+static void part_geometry(struct gendisk *disk, struct scrubparams *s)
+{
+	struct disk_scrubber *ds = disk->scrubber;
+	unsigned int io_min = queue_io_min(disk->queue);
+	unsigned int io_opt = queue_io_opt(disk->queue);
+
+	s->parts = ds->parts;
+	s->stripe = ds->stripe_kb * 2;
+	if (!s->parts && io_min && io_opt > io_min && !(io_opt % io_min))
+		s->parts = io_opt / io_min;
+	if (!ds->stripe_kb && s->parts > 1 && io_min >= 512 &&
+	    io_opt == io_min * s->parts)
+		s->stripe = io_min >> 9;
+	s->parts = clamp_t(unsigned int, s->parts, 1, SCRUB_PARTS_MAX);
+}
+
+/* Picks the flash profile, on non-rotational queues unless told otherwise,
+ * and drops the seek-oriented settings it makes pointless. Called with
+ * sysfs_lock held, after the rest of the parameters were copied. */
+static void flash_profile(struct gendisk *disk, struct scrubparams *s)
+{
+	struct disk_scrubber *ds = disk->scrubber;
+
+	s->flash = ds->flash == SCRUB_FLASH_ON ||
+		(ds->flash == SCRUB_FLASH_AUTO && blk_queue_nonrot(disk->queue));
+	if (!s->flash)
+		return;
+
+	s->threads = max_t(int, s->threads, ds->flash_depth);
+	s->flash_rate_mbs = ds->flash_rate_mbs;
+	s->delayms = 0;
+	s->zoned = 0;
+	s->zone_slow = 0;
+	s->zone_idle_ms = 0;
+	s->trackalign = 0;
+	s->parts = 1;
+}
+
+static int partscrub(struct gendisk *disk, struct scrubparams *s,
+	struct scrub_thread_data *tdata)
+{
+	uint64_t cur[SCRUB_PARTS_MAX], end[SCRUB_PARTS_MAX];
+	uint64_t len, step, num, reqcount = 0;
+	int i, k = s->parts, left;
+
+	step = s->stripe ? s->stripe : s->segsize;
+	len = div64_u64(s->capacity - s->start, k);
+	if (s->stripe)
+		len = div64_u64(len, step * k) * step * k;
+
+	for (i = 0; i < k; i++)
+		cur[i] = min(s->start + i * (len + (s->stripe ? step : 0)),
+			s->capacity);
+	for (i = 0; i < k; i++)
+		end[i] = (i == k - 1) ? s->capacity : cur[i + 1];
+
+	if (s->verbose)
+		printk(KERN_INFO "scrubber (%s): Starting from %llu to %llu, in %d "
+			"sub-ranges of about %llu sectors, %llu sectors per "
+			"command.\n", disk->disk_name, s->start, s->capacity, k, len,
+			step);
+	if (s->verbose && s->threads < k)
+		printk(KERN_INFO "scrubber (%s): Only %d of %d sub-ranges are "
+			"scrubbed at a time, raise threads.\n", disk->disk_name,
+			s->threads, k);
+
+	do {
+		left = 0;
+		for (i = 0; i < k; i++) {
+			if (cur[i] >= end[i])
+				continue;
+			left = 1;
+			num = min(step, end[i] - cur[i]);
+			if (segread(disk, s, tdata, cur[i], num))
+				return -1;
+			if (disk->scrubber->state == 2 || (s->reqbound && ++reqcount > s->reqbound))
+				return 0;
+			cur[i] += num;
+		}
+	} while (left);
+
+	return 0;
+}
+
 int seqscrub (struct gendisk *disk, struct scrubparams *s,
 	struct scrub_thread_data *tdata)
 {
@@ -351,6 +1611,12 @@ int seqscrub (struct gendisk *disk, struct scrubparams *s,
 	//struct timespec rqtp;
 	//struct timespec ta, tb;
 
+	if (s->parts > 1)
+		return partscrub(disk, s, tdata);
+
+	if (s->zone_idle_ms && s->zone_slow)
+		return zonescrub(disk, s, tdata);
+
 	/* Scrub sequentially in SEGMENT_SIZE chunks */
 	pos = (uint64_t) s->start;
 	if (s->verbose)
@@ -379,8 +1645,9 @@ int seqscrub (struct gendisk *disk, struct scrubparams *s,
 		   or the remaining sectors are less than segsize (read just those). */
 			num = (s->segsize > s->capacity) ? s->capacity : (s->capacity - pos);
 		else
-		/* Verify segsize sectors */
-			num = s->segsize;
+		/* Verify segsize sectors, or the whole tracks closest to it */
+			num = min(track_align(disk, s, pos, s->segsize),
+				s->capacity - pos);
 		if (segread (disk, s, tdata, pos, num))
 			return -1;
 		if (disk->scrubber->state == 2 || (s->reqbound && ++reqcount > s->reqbound))
@@ -422,10 +1689,105 @@ int seqscrub (struct gendisk *disk, struct scrubparams *s,
 	return 0;
 }
 
+/*
+ * Staggered visiting orders. A round visits segment sn of every region, for
+ * sn = 0..segnum-1, burst segments at a time. The regions of each visit are
+ * taken in one of these orders:
+ *  - linear: ascending, as in the original staggered scrubbing,
+ *  - rotate: ascending, from an offset that moves by a golden ratio
+ *    fraction of the regions every round, so that no region is always
+ *    visited last,
+ *  - random: ascending, from a random offset,
+ *  - vdc: the van der Corput (bit-reversed) permutation, rotated as above.
+ *    Neighboring regions are visited far apart, so an error cluster that
+ *    spans a few regions is found early in the visit.
+ */
+struct stag_iter {
+	int order;
+	uint64_t regnum, segnum, burst;
+	uint64_t span; /* Indices per visit (a power of 2 for vdc) */
+	int bits;
+	uint64_t offset; /* Region offset of this round */
+	uint64_t sn, i, k; /* Segment, index within visit, segment of burst */
+};
+
+static void stag_begin(struct stag_iter *it, int order, uint64_t regnum,
+	uint64_t segnum, uint64_t burst, unsigned int round)
+{
+	uint32_t frac = round * 2654435769U;
+
+	memset(it, 0, sizeof(*it));
+	it->order = order;
+	it->regnum = regnum;
+	it->segnum = segnum;
+	it->burst = burst ? burst : 1;
+
+	it->span = regnum;
+	if (order == SCRUB_STAG_VDC) {
+		while ((1ULL << it->bits) < regnum)
+			it->bits++;
+		it->span = 1ULL << it->bits;
+	}
+
+	if (!regnum)
+		return;
+	if (order == SCRUB_STAG_ROTATE || order == SCRUB_STAG_VDC)
+		it->offset = ((uint64_t) frac * regnum) >> 32;
+	else if (order == SCRUB_STAG_RANDOM)
+		it->offset = ((uint64_t) random32() * regnum) >> 32;
+}
+
+/* Returns the region at index i of a visit, or regnum if there's none */
+static uint64_t stag_region(struct stag_iter *it, uint64_t i)
+{
+	uint64_t j = i, rn;
+	int b;
+
+	if (it->order == SCRUB_STAG_VDC)
+		for (j = 0, b = 0; b < it->bits; b++)
+			j |= ((i >> b) & 1) << (it->bits - 1 - b);
+	if (j >= it->regnum)
+		return it->regnum;
+
+	rn = j + it->offset;
+	return (rn >= it->regnum) ? rn - it->regnum : rn;
+}
+
+/* Gets the next region and segment to visit. Returns 0 when done. */
+static int stag_next(struct stag_iter *it, uint64_t *rn, uint64_t *sn)
+{
+	uint64_t r;
+
+	while (it->sn < it->segnum) {
+		if (it->i >= it->span) {
+			it->i = 0;
+			it->sn += it->burst;
+			continue;
+		}
+		r = stag_region(it, it->i);
+		if (r >= it->regnum || it->sn + it->k >= it->segnum) {
+			it->i++;
+			it->k = 0;
+			continue;
+		}
+
+		*rn = r;
+		*sn = it->sn + it->k;
+		if (++it->k >= it->burst) {
+			it->k = 0;
+			it->i++;
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
 int stgscrub (struct gendisk *disk, struct scrubparams *s,
 	struct scrub_thread_data *tdata)
 {
-	uint64_t pos, num, sn, rn, regnum, segnum, reqcount = 0;
+	uint64_t pos, num, sn, rn, regnum, segnum, reqcount = 0, last = -1ULL;
+	struct stag_iter it;
 	//struct timespec rqtp;
 	//struct timespec ta, tb;
 
@@ -449,37 +1811,38 @@ int stgscrub (struct gendisk *disk, struct scrubparams *s,
 	//if (s->timed) ta = current_kernel_time();
 
 	/* Scrub staggeredly in REGION_SIZE chunks of SEGMENT_SIZE segments */
-	for (sn = (uint64_t) 0; sn < segnum; sn++) {
-		if (s->verbose > 1)
+	stag_begin(&it, s->stag_order, regnum, segnum, s->stag_burst,
+		disk->scrubber->rounds);
+	while (stag_next(&it, &rn, &sn)) {
+		if (s->verbose > 1 && sn != last)
 			printk(KERN_INFO "scrubber(%s): Scrubbing segment: %llu/%llu\n",
 				   disk->disk_name, sn+(uint64_t)1, segnum);
-		for (rn = (uint64_t) 0; rn < regnum; rn++){
-
-			//if (LAG > 0.00) {
-			/* Introduce a delay equal to the disk's rotational latency */
-			//	rqtp.tv_sec = 0;
-			//	rqtp.tv_nsec = LAG * 5985000;
-			//	nanosleep(&rqtp,NULL);
-			//}
-
-			/* Scrub the S-th segment of the R-th region */
-			pos = s->start + rn * s->regsize + sn * s->segsize;
-			if (pos < s->capacity) {
-				if (pos + s->segsize > s->capacity)
-				/* Either the segsize is larger than the device (read device in
-				   one go), or the remaining sectors are less than segsize (read
-				   just those). */
-					num = (s->segsize > s->capacity) ? s->capacity :
-						(s->capacity - pos);
-				else
-				/* Verify segsize sectors */
-					num = s->segsize;
-				if (segread (disk, s, tdata, pos, num))
-					return -1;
-				if (disk->scrubber->state == 2 || (s->reqbound && ++reqcount > s->reqbound))
-					/* Exceeded maximum number of requests for this round. Bail. */
-					return 0;
-			}
+		last = sn;
+
+		//if (LAG > 0.00) {
+		/* Introduce a delay equal to the disk's rotational latency */
+		//	rqtp.tv_sec = 0;
+		//	rqtp.tv_nsec = LAG * 5985000;
+		//	nanosleep(&rqtp,NULL);
+		//}
+
+		/* Scrub the S-th segment of the R-th region */
+		pos = s->start + rn * s->regsize + sn * s->segsize;
+		if (pos < s->capacity) {
+			if (pos + s->segsize > s->capacity)
+			/* Either the segsize is larger than the device (read device in
+			   one go), or the remaining sectors are less than segsize (read
+			   just those). */
+				num = (s->segsize > s->capacity) ? s->capacity :
+					(s->capacity - pos);
+			else
+			/* Verify segsize sectors */
+				num = s->segsize;
+			if (segread (disk, s, tdata, pos, num))
+				return -1;
+			if (disk->scrubber->state == 2 || (s->reqbound && ++reqcount > s->reqbound))
+				/* Exceeded maximum number of requests for this round. Bail. */
+				return 0;
 		}
 	}
 
@@ -499,39 +1862,557 @@ int stgscrub (struct gendisk *disk, struct scrubparams *s,
 	return 0;
 }
 
-/* Fixed scrubbing. Used to test-drive hard disk SCSI Verify response times */
-int fixedscrub (struct gendisk *disk, struct scrubparams *s,
+/*
+ * Hybrid scrubbing. Sequential runs are the cheapest way through the disk,
+ * while staggered probes find error clusters sooner, at the cost of seeks.
+ * The hybrid strategy picks one or the other for every segment, over the
+ * region/segment grid of staggered scrubbing, and keeps a single coverage
+ * map, so that no segment is scrubbed twice in a round:
+ *  - once the disk has been idle for hybrid_idle_ms, the idle period is
+ *    likely to be long, and a sequential cursor takes the next segment,
+ *  - in short, fragmented idle windows, staggered probes are made in
+ *    stag_order; but when most foreground requests are local, the head
+ *    stays around the last one, so the probe goes to its region instead,
+ *    to keep the seeks short.
+ */
+#define HYBRID_LOCAL	512 /* Share of local requests (of 1024) */
+
+static int hybscrub(struct gendisk *disk, struct scrubparams *s,
 	struct scrub_thread_data *tdata)
 {
-	uint64_t pos, num, i;
+	struct disk_scrubber *ds = disk->scrubber;
+	uint64_t regnum, segnum, rn, sn, pos, num, fg, reqcount = 0;
+	unsigned long ncells, cell, seq = 0, done = 0, nseq = 0;
+	unsigned long *map;
+	struct stag_iter it;
+	int stag, more = 1;
 
-	pos = 0;
-	if (s->verbose) {
-		printk(KERN_INFO "scrubber (%s): Performing a fixed scrub from 0 ~ 20GB\n",
-			   disk->disk_name);
+	regnum = lceil(s->capacity - s->start, s->regsize, disk, s);
+	segnum = lceil(s->regsize, s->segsize, disk, s);
+	ncells = (unsigned long) (regnum * segnum);
+
+	map = vmalloc(BITS_TO_LONGS(ncells) * sizeof(unsigned long));
+	if (!map) {
+		printk(KERN_INFO "scrubber (%s): cannot allocate coverage map, "
+			"scrubbing sequentially.\n", disk->disk_name);
+		return seqscrub(disk, s, tdata);
+	}
+	memset(map, 0, BITS_TO_LONGS(ncells) * sizeof(unsigned long));
+
+	if (s->verbose)
+		printk(KERN_INFO "scrubber (%s): Starting from %llu to %llu, over "
+			"%llu regions of %llu segments.\n", disk->disk_name,
+			s->start, s->capacity, regnum, segnum);
+
+	stag_begin(&it, s->stag_order, regnum, segnum, s->stag_burst,
+		ds->rounds);
+	while (done < ncells) {
+		stag = idle_ms(disk) < s->hybrid_idle_ms;
+		cell = ncells;
+
+		/* Probe the region the foreground is busy with */
+		fg = atomic64_read(&ds->fg_last);
+		if (stag && ds->fg_local >= HYBRID_LOCAL && fg >= s->start &&
+		    fg < s->capacity) {
+			rn = div64_u64(fg - s->start, s->regsize);
+			cell = find_next_zero_bit(map, (rn + 1) * segnum,
+				rn * segnum);
+			if (cell >= (rn + 1) * segnum)
+				cell = ncells;
+		}
+
+		/* Or make the next staggered probe */
+		while (stag && cell >= ncells && more &&
+		       (more = stag_next(&it, &rn, &sn)))
+			if (!test_bit(rn * segnum + sn, map))
+				cell = rn * segnum + sn;
+
+		/* Or carry on sequentially */
+		if (cell >= ncells) {
+			seq = find_next_zero_bit(map, ncells, seq);
+			cell = seq;
+			++nseq;
+		}
+
+		__set_bit(cell, map);
+		++done;
+
+		rn = div64_u64(cell, segnum);
+		sn = cell - rn * segnum;
+		pos = s->start + rn * s->regsize + sn * s->segsize;
+		if (pos >= s->capacity)
+			continue;
+		num = min(s->segsize, s->capacity - pos);
+		if (segread(disk, s, tdata, pos, num)) {
+			vfree(map);
+			return -1;
+		}
+		if (disk->scrubber->state == 2 || (s->reqbound && ++reqcount > s->reqbound))
+			break;
+	}
+
+	if (s->verbose)
+		printk(KERN_INFO "scrubber (%s): Scrubbed %lu of %lu segments "
+			"sequentially.\n", disk->disk_name, nseq, done);
+
+	vfree(map);
+	return 0;
+}
+
+/*
+ * Flash profile, for non-rotational devices. There are no seeks to save
+ * and no rotations to wait for, but a single command in flight leaves
+ * most of the device's channels idle, so commands are dispatched by many
+ * threads at once, with no delay in between. Flash loses charge with the
+ * time since it was written, so instead of LBA order, the round visits the
+ * write time chunks of the disk from the one written longest ago, in a
+ * random order among chunks of the same age. Reads disturb neighboring
+ * cells, so the pass may be capped at flash_rate_mbs.
+ */
+struct flash_chunk {
+	uint32_t wtime;
+	uint32_t rank;
+	unsigned int chunk;
+};
+
+static int flash_cmp(const void *a, const void *b)
+{
+	const struct flash_chunk *x = a, *y = b;
+
+	if (x->wtime != y->wtime)
+		return x->wtime < y->wtime ? -1 : 1;
+	if (x->rank != y->rank)
+		return x->rank < y->rank ? -1 : 1;
+	return 0;
+}
+
+/* Sleeps until done sectors are due at the rate cap */
+static void flash_pace(struct scrubparams *s, unsigned long t0,
+	uint64_t done)
+{
+	uint64_t due_ms, elapsed_ms;
+
+	if (!s->flash_rate_mbs)
+		return;
+
+	due_ms = div64_u64(done * 1000, (uint64_t) s->flash_rate_mbs * 2048);
+	elapsed_ms = jiffies_to_msecs(jiffies - t0);
+	if (due_ms > elapsed_ms)
+		msleep_interruptible((unsigned int) (due_ms - elapsed_ms));
+}
+
+static int flashscrub(struct gendisk *disk, struct scrubparams *s,
+	struct scrub_thread_data *tdata)
+{
+	struct disk_scrubber *ds = disk->scrubber;
+	struct flash_chunk *order;
+	uint64_t pos, end, num, done = 0, reqcount = 0;
+	unsigned long t0 = jiffies;
+	unsigned int i, first, last;
+
+	/* Stamp writes from now on, for the rounds to come */
+	if (scrub_wtime_init(ds) ||
+	    !(order = vmalloc(SCRUB_FLASH_CHUNKS * sizeof(*order)))) {
+		printk(KERN_INFO "scrubber (%s): cannot allocate chunk order, "
+			"scrubbing sequentially.\n", disk->disk_name);
+		s->flash = 0;
+		return seqscrub(disk, s, tdata);
+	}
+
+	first = scrub_wtime_chunk(disk, s->start);
+	last = scrub_wtime_chunk(disk, s->capacity - 1);
+	for (i = first; i <= last; i++) {
+		order[i - first].wtime = ACCESS_ONCE(ds->wtime[i]);
+		order[i - first].rank = random32();
+		order[i - first].chunk = i;
+	}
+	sort(order, last - first + 1, sizeof(*order), flash_cmp, NULL);
+
+	if (s->verbose)
+		printk(KERN_INFO "scrubber (%s): Starting from %llu to %llu, over "
+			"%u chunks by age, %d threads, %u MB/s cap.\n",
+			disk->disk_name, s->start, s->capacity, last - first + 1,
+			s->threads, s->flash_rate_mbs);
+
+	for (i = 0; i <= last - first; i++) {
+		pos = max(scrub_wtime_start(disk, order[i].chunk), s->start);
+		end = min(scrub_wtime_start(disk, order[i].chunk + 1),
+			s->capacity);
+		while (pos < end) {
+			num = min(s->segsize, end - pos);
+			if (segread(disk, s, tdata, pos, num)) {
+				vfree(order);
+				return -1;
+			}
+			if (ds->state == 2 || (s->reqbound && ++reqcount > s->reqbound))
+				goto out;
+
+			pos += num;
+			done += num;
+			flash_pace(s, t0, done);
+		}
+	}
+out:
+	vfree(order);
+	return 0;
+}
+
+#ifdef CONFIG_BLK_DEV_SCRUB_SELFTEST
+
+#define stag_check(x)							\
+	do {								\
+		if (!(x))						\
+			printk(KERN_ERR "scrubber: self-test failed at "	\
+				"line %d\n", __LINE__);			\
+	} while (0)
+
+#define STAG_TEST_REGIONS	64
+#define STAG_TEST_SEGMENTS	16
+#define STAG_TEST_MAX		(100 * STAG_TEST_SEGMENTS)
+
+static uint32_t stag_time[STAG_TEST_MAX] __initdata;
+static uint64_t stag_acc[STAG_TEST_MAX] __initdata;
+static uint64_t stag_regnums[] __initdata = { 1, 5, STAG_TEST_REGIONS, 100 };
+
+/* Records the visit each segment of a simulated disk is scrubbed on.
+ * Returns the number of visits, or -1 if a segment is visited twice. */
+static int __init stag_simulate(int order, uint64_t regnum, uint64_t burst,
+	unsigned int round)
+{
+	struct stag_iter it;
+	uint64_t rn, sn;
+	uint32_t *t;
+	int n = 0;
+
+	memset(stag_time, 0xff, sizeof(stag_time));
+	stag_begin(&it, order, regnum, STAG_TEST_SEGMENTS, burst, round);
+	while (stag_next(&it, &rn, &sn)) {
+		if (rn >= regnum || sn >= STAG_TEST_SEGMENTS)
+			return -1;
+		t = &stag_time[rn * STAG_TEST_SEGMENTS + sn];
+		if (*t != ~0U)
+			return -1;
+		*t = n++;
+	}
+
+	return n;
+}
+
+/* Returns the visit that first hits a cluster of len segments from c */
+static uint32_t __init stag_first_hit(uint64_t c, uint64_t len)
+{
+	uint32_t hit = ~0U;
+
+	for (; len; len--, c++)
+		hit = min(hit, stag_time[c]);
+	return hit;
+}
+
+/* Adds up the first hits of clusters of len segments at every position,
+ * over rounds rounds, into stag_acc. Returns the largest sum. */
+static uint64_t __init stag_hits(int order, uint64_t len, unsigned int rounds)
+{
+	uint64_t c, worst = 0, nseg = STAG_TEST_REGIONS * STAG_TEST_SEGMENTS;
+	unsigned int r;
+
+	memset(stag_acc, 0, sizeof(stag_acc));
+	for (r = 0; r < rounds; r++) {
+		stag_simulate(order, STAG_TEST_REGIONS, 1, r);
+		for (c = 0; c + len <= nseg; c++)
+			stag_acc[c] += stag_first_hit(c, len);
+	}
+	for (c = 0; c + len <= nseg; c++)
+		worst = max(worst, stag_acc[c]);
+
+	return worst;
+}
+
+static uint64_t __init stag_mean_hit(int order, uint64_t len)
+{
+	uint64_t c, sum = 0, nseg = STAG_TEST_REGIONS * STAG_TEST_SEGMENTS;
+
+	stag_hits(order, len, 1);
+	for (c = 0; c + len <= nseg; c++)
+		sum += stag_acc[c];
+
+	return div64_u64(sum, nseg - len + 1);
+}
+
+static int __init stag_selftest(void)
+{
+	uint64_t burst, len, lin, vdc;
+	int order, i;
+
+	/* Every order visits every segment exactly once */
+	for (order = SCRUB_STAG_LINEAR; order <= SCRUB_STAG_VDC; order++)
+		for (i = 0; i < ARRAY_SIZE(stag_regnums); i++)
+			for (burst = 1; burst <= 3; burst += 2)
+				stag_check(stag_simulate(order, stag_regnums[i], burst, 7) ==
+					stag_regnums[i] * STAG_TEST_SEGMENTS);
+
+	/* Clusters spanning a few regions are hit earlier when neighboring
+	 * regions are visited far apart */
+	for (len = 2 * STAG_TEST_SEGMENTS; len <= 3 * STAG_TEST_SEGMENTS;
+	     len += STAG_TEST_SEGMENTS) {
+		lin = stag_mean_hit(SCRUB_STAG_LINEAR, len);
+		vdc = stag_mean_hit(SCRUB_STAG_VDC, len);
+		printk(KERN_INFO "scrubber: self-test: clusters of %llu segments "
+			"first hit after %llu (linear), %llu (vdc) visits\n",
+			len, lin, vdc);
+		stag_check(vdc < lin);
+	}
+
+	/* Over a number of rounds, no cluster is always hit last */
+	lin = stag_hits(SCRUB_STAG_LINEAR, 4, STAG_TEST_REGIONS);
+	vdc = stag_hits(SCRUB_STAG_ROTATE, 4, STAG_TEST_REGIONS);
+	printk(KERN_INFO "scrubber: self-test: worst first hit over %d rounds "
+		"after %llu (linear), %llu (rotate) visits\n", STAG_TEST_REGIONS,
+		div64_u64(lin, STAG_TEST_REGIONS), div64_u64(vdc, STAG_TEST_REGIONS));
+	stag_check(vdc < lin);
+
+	return 0;
+}
+late_initcall(stag_selftest);
+
+#endif /* CONFIG_BLK_DEV_SCRUB_SELFTEST */
+
+/*
+ * Device characterization. Instead of scrubbing, samples the response time
+ * of verifications over a grid of command sizes and positions across the
+ * whole device, and fits a cost model to it:
+ *  - the transfer rate of each zone (the slope of response time over
+ *    command size), which becomes the zone profile,
+ *  - the per-command overhead (the average intercept of those fits),
+ *  - a seek curve, sampled at distances of capacity >> 2k,
+ *  - a track boundary and the track length in each zone, found by bisecting
+ *    ranges for the extra time of a head switch.
+ * The model is kept in the scrubber, for adaptive command sizing and
+ * pacing. Run once per drive model, on an otherwise idle drive.
+ */
+#define CHAR_REPEAT	3
+#define TRACK_WINDOWS	16
+
+static const unsigned int char_sizes[] = { 8, 128, 1024, 8192, 32768 };
+
+/* Returns the average response time (us) of verifying num sectors at pos,
+ * right after verifying a sector at from, or 0 on errors */
+static uint64_t char_sample(struct gendisk *disk, uint64_t from, uint64_t pos,
+	unsigned int num)
+{
+	struct timeval va, vb;
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < CHAR_REPEAT; i++) {
+		if (scrub_verify(disk, from, 1, NULL))
+			return 0;
+		do_gettimeofday(&va);
+		if (scrub_verify(disk, pos, num, NULL))
+			return 0;
+		do_gettimeofday(&vb);
+		sum += (vb.tv_sec - va.tv_sec) * 1000000 + (vb.tv_usec - va.tv_usec);
+	}
+
+	return div64_u64(sum, CHAR_REPEAT) ? : 1;
+}
+
+static int char_stopped(struct gendisk *disk)
+{
+	return disk->scrubber->state == 2 || kthread_should_stop();
+}
+
+/* Time (us) of verifying sectors a to b, right after verifying a. That's
+ * about a rotation, plus a head switch if a track boundary lies between. */
+static uint64_t track_probe(struct gendisk *disk, uint64_t a, uint64_t b)
+{
+	return char_sample(disk, a, a, (unsigned int) (b - a + 1));
+}
+
+/* Looks for the first track boundary within span sectors from pos, given a
+ * rotation time. Returns the first sector of the track, or 0 if there's
+ * none to be seen. */
+static uint64_t track_find(struct gendisk *disk, uint64_t pos, uint64_t span,
+	uint64_t rot_us)
+{
+	uint64_t t[TRACK_WINDOWS], tmin = 0, a, b, m, k;
+	int i;
+
+	/* Windows of equal length take equally long, except for the ones
+	 * that cross a boundary */
+	k = max_t(uint64_t, div64_u64(span, TRACK_WINDOWS), 2);
+	for (i = 0; i < TRACK_WINDOWS; i++) {
+		if (char_stopped(disk) || !(t[i] = track_probe(disk, pos + i * k,
+				pos + (i + 1) * k)))
+			return 0;
+		if (!tmin || t[i] < tmin)
+			tmin = t[i];
+	}
+	for (i = 0; i < TRACK_WINDOWS; i++)
+		if (t[i] > tmin + rot_us / 64)
+			break;
+	if (i == TRACK_WINDOWS)
+		return 0;
+
+	/* Bisect the window: the half with the boundary takes longer */
+	a = pos + i * k;
+	b = a + k;
+	while (b - a > 1) {
+		m = a + (b - a) / 2;
+		if (char_stopped(disk))
+			return 0;
+		if (track_probe(disk, a, m) >= track_probe(disk, m, b))
+			b = m;
+		else
+			a = m;
+	}
+
+	return b;
+}
+
+/* Finds a track boundary and the track length in the middle of a zone,
+ * with an estimate of the zone's transfer rate */
+static void track_discover(struct gendisk *disk, uint64_t pos, uint32_t kbs,
+	uint32_t cmd_us, uint64_t *start, uint32_t *len)
+{
+	uint64_t rot_us, est, b0, b1;
+
+	*start = *len = 0;
+
+	/* Re-verifying the same sector takes a rotation (and the overhead) */
+	rot_us = char_sample(disk, pos, pos, 1);
+	if (rot_us > cmd_us)
+		rot_us -= cmd_us;
+	est = div64_u64(rot_us * kbs * 2, 1000000);
+	if (!rot_us || est < 16 || est > SCRUB_CMD_MAX)
+		return;
+
+	b0 = track_find(disk, pos, est + est / 4, rot_us);
+	if (!b0)
+		return;
+	b1 = track_find(disk, b0 + est / 2, est, rot_us);
+	if (!b1 || b1 - b0 < est / 2 || b1 - b0 > 2 * est)
+		return;
+
+	*start = b0;
+	*len = (uint32_t) (b1 - b0);
+}
+
+int charscrub (struct gendisk *disk, struct scrubparams *s,
+	struct scrub_thread_data *tdata)
+{
+	struct disk_scrubber *ds = disk->scrubber;
+	uint64_t cap = get_capacity(disk), zstart, zlen, dist, t;
+	int64_t n, sx, sy, sxx, sxy, num, den;
+	uint64_t cmd_sum = 0;
+	uint32_t kbs[SCRUB_ZONES], seek[SCRUB_SEEK_POINTS], cmd_us;
+	uint64_t tstart[SCRUB_ZONES];
+	uint32_t tlen[SCRUB_ZONES];
+	int z, i, fits = 0;
+
+	if (cap < SCRUB_ZONES * char_sizes[ARRAY_SIZE(char_sizes) - 1]) {
+		printk(KERN_INFO "scrubber (%s): Device too small to "
+			"characterize.\n", disk->disk_name);
+		return -1;
+	}
+	if (s->verbose)
+		printk(KERN_INFO "scrubber (%s): Characterizing %llu sectors over "
+			"%d zones.\n", disk->disk_name, cap, SCRUB_ZONES);
+
+	/* Transfer rate and overhead: a linear fit per zone */
+	for (z = 0; z < SCRUB_ZONES; z++) {
+		zstart = div64_u64(cap * z + SCRUB_ZONES - 1, SCRUB_ZONES);
+		zlen = zone_end(disk, zstart) - zstart;
+		n = sx = sy = sxx = sxy = 0;
+		kbs[z] = 0;
+
+		for (i = 0; i < ARRAY_SIZE(char_sizes); i++) {
+			if (char_stopped(disk))
+				return 0;
+			serve_jobs(disk, BLK_SCRUB_PRIO_NORMAL - 1, 0);
+
+			/* Sample the middle of the zone */
+			t = char_sample(disk, zstart + zlen / 2 - 1, zstart + zlen / 2,
+				char_sizes[i]);
+			if (!t)
+				continue;
+			n++;
+			sx += char_sizes[i];
+			sy += t;
+			sxx += (int64_t) char_sizes[i] * char_sizes[i];
+			sxy += (int64_t) char_sizes[i] * t;
+		}
+
+		/* slope = num / den (us per sector) */
+		num = n * sxy - sx * sy;
+		den = n * sxx - sx * sx;
+		if (n < 2 || num <= 0 || den <= 0)
+			continue;
+		kbs[z] = (uint32_t) div64_u64(den * 500000, num);
+		/* intercept = (sy - slope * sx) / n */
+		if (sy * den > num * sx)
+			cmd_sum += div64_u64(sy * den - num * sx, n * den);
+		++fits;
+
+		if (s->verbose > 1)
+			printk(KERN_INFO "scrubber (%s): Zone %d: %u KB/s.\n",
+				disk->disk_name, z, kbs[z]);
 	}
 
-	if (get_capacity(disk) < 40000001) {
-		printk(KERN_INFO "scrubber (%s): Error:: Device smaller than 20GB! Aborting...\n",
+	if (!fits) {
+		printk(KERN_INFO "scrubber (%s): Characterization failed.\n",
 			disk->disk_name);
 		return -1;
 	}
+	cmd_us = (uint32_t) div64_u64(cmd_sum, fits);
 
-	s->timed = 0;
-	if (segread (disk, s, tdata, 0, 1)) return -1;
-	s->timed = 1;
+	/* Seek curve: single sector commands a given distance apart */
+	for (i = 0; i < SCRUB_SEEK_POINTS; i++) {
+		if (char_stopped(disk))
+			return 0;
+		serve_jobs(disk, BLK_SCRUB_PRIO_NORMAL - 1, 0);
 
-	for (i = 0; i < 50; i++) {
-		if (i % 2 == 0)
-			pos = 0 + (i/2) * 400000;
-		else if (i % 2 == 1)
-			pos = 40000000 - ((i-1)/2) * 400000;
+		dist = min(cap >> (2 * i), cap - 1);
+		t = char_sample(disk, 0, dist, 1);
+		seek[i] = (t > cmd_us) ? (uint32_t) (t - cmd_us) : 0;
+	}
 
-		num = s->segsize;
-		if (segread (disk, s, tdata, pos, num))
-			return -1;
+	/* Track boundaries, where we know the transfer rate */
+	for (z = 0; z < SCRUB_ZONES; z++) {
+		if (char_stopped(disk))
+			return 0;
+		serve_jobs(disk, BLK_SCRUB_PRIO_NORMAL - 1, 0);
+
+		zstart = div64_u64(cap * z + SCRUB_ZONES - 1, SCRUB_ZONES);
+		zlen = zone_end(disk, zstart) - zstart;
+		if (kbs[z])
+			track_discover(disk, zstart + zlen / 2, kbs[z], cmd_us,
+				&tstart[z], &tlen[z]);
+		else
+			tstart[z] = tlen[z] = 0;
+
+		if (s->verbose > 1)
+			printk(KERN_INFO "scrubber (%s): Zone %d: %u sectors per "
+				"track, boundary at %llu.\n", disk->disk_name, z,
+				tlen[z], tstart[z]);
 	}
 
+	mutex_lock(&ds->sysfs_lock);
+	memcpy(ds->track_start, tstart, sizeof(tstart));
+	memcpy(ds->track_len, tlen, sizeof(tlen));
+	ds->cost_cmd_us = cmd_us;
+	memcpy(ds->cost_seek_us, seek, sizeof(seek));
+	for (z = 0; z < SCRUB_ZONES; z++)
+		if (kbs[z])
+			ds->zone_kbs[z] = kbs[z];
+	ds->zone_learn = 0;
+	mutex_unlock(&ds->sysfs_lock);
+
+	if (s->verbose)
+		printk(KERN_INFO "scrubber (%s): Command overhead %u us, full "
+			"stroke seek %u us, outer/inner zone %u/%u KB/s.\n",
+			disk->disk_name, cmd_us, seek[0], kbs[0],
+			kbs[SCRUB_ZONES - 1]);
+
 	return 0;
 }
 
@@ -540,18 +2421,65 @@ static int scrubdev (struct gendisk *disk, struct scrubparams *s,
 {
 	int ret = 0;
 
+	unsigned int bs = scrub_block_sectors(disk);
+	uint64_t mask = bs - 1;
+
 	/* Print the capacity of the drive.
-	   We're talking sectors down here (512b each). */
+	   We're talking sectors down here (512b each), in whole logical
+	   blocks, which are only converted to when commands are issued. */
 	if (s->verbose)
 		printk(KERN_INFO "scrubber (%s): Capacity = %llu (of %ld) sectors, "
-			   "Sector size = 512 bytes (fixed).\n", disk->disk_name,
-			   s->capacity, get_capacity(disk));
+			   "Logical block size = %u bytes.\n", disk->disk_name,
+			   s->capacity, get_capacity(disk), bs << 9);
+	s->start &= ~mask;
+	s->capacity = (s->capacity + mask) & ~mask;
 	if (!s->capacity || s->start + s->capacity > get_capacity(disk))
 		s->capacity = get_capacity(disk);
 	else s->capacity = s->start + s->capacity;
 
-	s->regsize = s->regsize * 2;
-	s->segsize = s->segsize * 2;
+	/* Segments and regions are whole logical blocks */
+	s->regsize = max_t(uint64_t, (s->regsize * 2) & ~mask, bs);
+	s->segsize = max_t(uint64_t, (s->segsize * 2) & ~mask, bs);
+
+	/* From here on, segread() accounts for the progress of the pass */
+	s->total = s->capacity - s->start;
+	s->done = 0;
+	do_gettimeofday(&s->rstart);
+
+	/* Filesystem-aware rounds skip free space, except for every
+	 * free_interval-th round, which scrubs the whole range */
+	s->skip_free = 0;
+	if (s->fsaware && s->strategy != CHARSCRUB &&
+	    (!s->free_interval ||
+	     (disk->scrubber->rounds + 1) % s->free_interval)) {
+		if (scrub_map_build(disk->scrubber, &disk->scrubber->amap,
+				SCRUB_MAP_ALLOCATED))
+			printk(KERN_INFO "scrubber (%s): cannot build allocation "
+				"map, scrubbing free space too.\n", disk->disk_name);
+		else {
+			s->skip_free = 1;
+			if (s->verbose)
+				printk(KERN_INFO "scrubber (%s): Scrubbing %llu allocated "
+					"sectors only.\n", disk->disk_name,
+					disk->scrubber->amap.sectors);
+		}
+	}
+	/* Characterization verifies regardless of contents */
+	if (s->strategy == CHARSCRUB)
+		s->thin = 0;
+	else if (s->thin && s->verbose > 1)
+		printk(KERN_INFO "scrubber (%s): Skipping deallocated LBAs.\n",
+			disk->disk_name);
+	/* Weak sectors are found against the cost model */
+	if (!disk->scrubber->rounds && s->weak_factor && !s->cost_cmd_us &&
+	    s->strategy != CHARSCRUB)
+		printk(KERN_INFO "scrubber (%s): No cost model, weak sector "
+			"detection is inactive until cmd_us and seek_us are "
+			"restored or a char round is run.\n", disk->disk_name);
+	++disk->scrubber->rounds;
+
+	/* Metadata first */
+	meta_pass(disk);
 	if (s->verbose > 1) {
 		printk(KERN_INFO "scrubber (%s): Device  size in sectors = "
 			   "%ld.\n", disk->disk_name, get_capacity(disk));
@@ -563,7 +2491,15 @@ static int scrubdev (struct gendisk *disk, struct scrubparams *s,
 			   "%llu.\n", disk->disk_name, s->segsize);
 	}
 
-	if (s->strategy == SEQLSCRUB) {
+	if (s->flash && s->strategy != CHARSCRUB) {
+		if ((ret = flashscrub (disk, s, tdata)) < 0 && s->verbose)
+			printk(KERN_INFO "scrubber (%s): Flash scrub failed."
+				   " %d errors detected.\n", disk->disk_name, s->read_errs);
+		else if (s->verbose)
+			printk(KERN_INFO "scrubber (%s): Flash scrub succeeded. "
+				   "Completed %llu requests. %d errors detected.\n",
+				   disk->disk_name, s->reqcount, s->read_errs);
+	} else if (s->strategy == SEQLSCRUB) {
 		if ((ret = seqscrub (disk, s, tdata)) < 0 && s->verbose)
 			printk(KERN_INFO "scrubber (%s): Sequential scrub failed."
 				   " %d errors detected.\n", disk->disk_name, s->read_errs);
@@ -579,11 +2515,21 @@ static int scrubdev (struct gendisk *disk, struct scrubparams *s,
 			printk(KERN_INFO "scrubber (%s): Staggered scrub succeeded. "
 				   "Completed %llu requests. %d errors detected.\n",
 				   disk->disk_name, s->reqcount, s->read_errs);
-	} else if (s->strategy == FIXEDSCRUB) {
-		if ((ret = fixedscrub (disk, s, tdata)) < 0 && s->verbose)
-			printk(KERN_INFO "scrubber (%s): Fixed scrub failed.\n", disk->disk_name);
+	} else if (s->strategy == CHARSCRUB) {
+		if ((ret = charscrub (disk, s, tdata)) < 0 && s->verbose)
+			printk(KERN_INFO "scrubber (%s): Characterization failed.\n",
+				disk->disk_name);
+		else if (s->verbose)
+			printk(KERN_INFO "scrubber (%s): Characterization succeeded.\n",
+				disk->disk_name);
+	} else if (s->strategy == HYBRSCRUB) {
+		if ((ret = hybscrub (disk, s, tdata)) < 0 && s->verbose)
+			printk(KERN_INFO "scrubber (%s): Hybrid scrub failed."
+				   " %d errors detected.\n", disk->disk_name, s->read_errs);
 		else if (s->verbose)
-			printk(KERN_INFO "scrubber (%s): Fixed scrub succeeded.\n", disk->disk_name);
+			printk(KERN_INFO "scrubber (%s): Hybrid scrub succeeded. "
+				   "Completed %llu requests. %d errors detected.\n",
+				   disk->disk_name, s->reqcount, s->read_errs);
 	}
 
 	return ret;
@@ -591,7 +2537,9 @@ static int scrubdev (struct gendisk *disk, struct scrubparams *s,
 
 int scrubber (struct gendisk *disk)
 {
-	int i, res, err, ret = 0;
+	int i, res, err, ret = 0, resume = 0;
+	long timeout = MAX_SCHEDULE_TIMEOUT;
+	unsigned long started;
 	struct scrubparams *s;
 	struct scrub_thread_data *tdata;
 	struct task_struct *ttask;
@@ -615,13 +2563,17 @@ int scrubber (struct gendisk *disk)
 				s->strategy = SEQLSCRUB;
 			else if (!strcmp(disk->scrubber->strategy, "stag"))
 				s->strategy = STAGSCRUB;
-			else if (!strcmp(disk->scrubber->strategy, "fixed"))
-				s->strategy = FIXEDSCRUB;
+			else if (!strcmp(disk->scrubber->strategy, "char"))
+				s->strategy = CHARSCRUB;
+			else if (!strcmp(disk->scrubber->strategy, "hybr"))
+				s->strategy = HYBRSCRUB;
 
 			if (!strcmp(disk->scrubber->priority, "realtime"))
 				s->priority = RTIMEPRIO;
 			else if (!strcmp(disk->scrubber->priority, "idlechk"))
 				s->priority = IDCHKPRIO;
+			else if (!strcmp(disk->scrubber->priority, "deadline"))
+				s->priority = DLINEPRIO;
 
 			s->segsize = disk->scrubber->segsize;
 			s->regsize = disk->scrubber->regsize;
@@ -633,9 +2585,39 @@ int scrubber (struct gendisk *disk)
 			s->capacity = disk->scrubber->scount;
 			s->start = disk->scrubber->spoint;
 			s->delayms = disk->scrubber->delayms;
+			s->fsaware = disk->scrubber->fsaware;
+			s->free_interval = disk->scrubber->free_interval;
+			s->thin = disk->scrubber->thin == SCRUB_THIN_ON ||
+				(disk->scrubber->thin == SCRUB_THIN_AUTO &&
+				 blk_queue_discard(disk->queue));
+			s->zoned = disk->scrubber->zoned;
+			s->zone_idle_ms = disk->scrubber->zone_idle_ms;
+			memcpy(s->zone_kbs, disk->scrubber->zone_kbs,
+				sizeof(s->zone_kbs));
+			zone_classify(s);
+			part_geometry(disk, s);
+			s->trackalign = disk->scrubber->trackalign;
+			memcpy(s->track_start, disk->scrubber->track_start,
+				sizeof(s->track_start));
+			memcpy(s->track_len, disk->scrubber->track_len,
+				sizeof(s->track_len));
+			s->trk_valid = 0;
+			s->cost_cmd_us = disk->scrubber->cost_cmd_us;
+			s->seek_full_us = disk->scrubber->cost_seek_us[0];
+			s->weak_factor = disk->scrubber->weak_factor;
+			s->weak_action = disk->scrubber->weak_action;
+			s->stag_order = disk->scrubber->stag_order;
+			s->stag_burst = disk->scrubber->stag_burst;
+			s->hybrid_idle_ms = disk->scrubber->hybrid_idle_ms;
+			flash_profile(disk, s);
+			s->deadline_ms = (disk->scrubber->deadline_s ?
+				disk->scrubber->deadline_s :
+				disk->scrubber->period_s) * 1000;
+			part_policy(disk, s);
 
 			mutex_unlock(&disk->scrubber->sysfs_lock);
 
+			started = get_seconds();
 			disk->scrubber->ttime_ms = 0;
 			s->ttime_ms = 0;
 			disk->scrubber->resptime_us = 0;
@@ -644,6 +2626,9 @@ int scrubber (struct gendisk *disk)
 			s->reqcount = 0;
 			s->available = 0;
 			s->read_errs = 0;
+			s->total = 0;
+			s->done = 0;
+			s->boosted = 0;
 			s->idlestamp = current_kernel_time();
 
 			/* Start scrubbing */
@@ -654,9 +2639,12 @@ int scrubber (struct gendisk *disk)
 				else if (s->strategy == STAGSCRUB)
 					printk(KERN_INFO "scrubber (%s): Scrubbing strategy used:"
 						   "Staggered scrubbing.\n", disk->disk_name);
-				else if (s->strategy == FIXEDSCRUB)
+				else if (s->strategy == CHARSCRUB)
+					printk(KERN_INFO "scrubber (%s): Scrubbing strategy used:"
+						   "Characterization.\n", disk->disk_name);
+				else if (s->strategy == HYBRSCRUB)
 					printk(KERN_INFO "scrubber (%s): Scrubbing strategy used:"
-						   "Fixed scrubbing.\n", disk->disk_name);
+						   "Hybrid scrubbing.\n", disk->disk_name);
 
 				if (s->priority == RTIMEPRIO)
 					printk(KERN_INFO "scrubber (%s): Scrubbing priority used:"
@@ -664,6 +2652,10 @@ int scrubber (struct gendisk *disk)
 				else if (s->priority == IDCHKPRIO)
 					printk(KERN_INFO "scrubber (%s): Scrubbing priority used:"
 						   "Idle Check.\n", disk->disk_name);
+				else if (s->priority == DLINEPRIO)
+					printk(KERN_INFO "scrubber (%s): Scrubbing priority used:"
+						   "Deadline (%llu ms).\n", disk->disk_name,
+						   s->deadline_ms);
 
 				printk(KERN_INFO "scrubber (%s): Using Segment Size = %lluKB\n",
 					   disk->disk_name, s->segsize);
@@ -705,7 +2697,7 @@ int scrubber (struct gendisk *disk)
 
 
 			/* Set priorities for SCSIVerify requests, for all threads */
-			if (s->priority == IDCHKPRIO) {
+			if (s->priority == IDCHKPRIO || s->priority == DLINEPRIO) {
 				for (i=0; i <= s->threads; i++) {
 
 					if (i == s->threads)
@@ -788,16 +2780,82 @@ int scrubber (struct gendisk *disk)
 				disk->scrubber->resptime_us = (uint64_t) s->resptime_us / s->reqcount;
 			disk->scrubber->reqcount = s->reqcount;
 
+			/* Partition rounds run once, when due, and then go back
+			 * to the continuous disk rounds they came between */
+			if (disk->scrubber->part_round) {
+				scrub_policy_advance(disk->scrubber, started);
+				disk->scrubber->part_round = 0;
+				if (disk->scrubber->state == 0 && !resume)
+					disk->scrubber->state = 1;
+				resume = 0;
+			/* Periodic rounds don't run back-to-back: go idle until
+			 * the next one is due */
+			} else if (disk->scrubber->period_s) {
+				scrub_sched_advance(disk->scrubber, started);
+				if (disk->scrubber->state == 0)
+					disk->scrubber->state = 1;
+			}
+
 			mutex_unlock(&disk->scrubber->sysfs_lock);
 
+			/* Continuous disk rounds never go idle, where partition
+			 * rounds are started: start those in between */
+			if (disk->scrubber->state == 0 &&
+			    scrub_policy_due(disk->scrubber)) {
+				resume = 1;
+				if (disk->scrubber->verbose)
+					printk(KERN_INFO "scrubber (%s): Starting scrubbing "
+						"round of partition %d.\n", disk->disk_name,
+						disk->scrubber->part_round);
+			}
+
 		} else {
 			set_current_state(TASK_INTERRUPTIBLE);
-			if (!kthread_should_stop()) {
+			if (!kthread_should_stop() &&
+			    scrub_wdirty_due(disk->scrubber)) {
+				/* Queue written chunks, to be served as jobs */
+				set_current_state(TASK_RUNNING);
+				scrub_wdirty_flush(disk->scrubber);
+			} else if (disk->scrubber->njobs && !kthread_should_stop()) {
+				/* Serve pending jobs one chunk at a time, so that
+				 * a round can start as soon as it's requested */
+				set_current_state(TASK_RUNNING);
+				serve_jobs(disk, BLK_SCRUB_PRIO_LOW, 1);
+			} else if (!kthread_should_stop() &&
+				   meta_due(disk->scrubber)) {
+				set_current_state(TASK_RUNNING);
+				meta_pass(disk);
+			} else if (!kthread_should_stop() &&
+				   scrub_policy_due(disk->scrubber)) {
+				set_current_state(TASK_RUNNING);
+				if (disk->scrubber->verbose)
+					printk(KERN_INFO "scrubber (%s): Starting scrubbing "
+						"round of partition %d.\n", disk->disk_name,
+						disk->scrubber->part_round);
+				disk->scrubber->state = 0;
+			} else if (!kthread_should_stop() &&
+				   !(timeout = sched_timeout(disk->scrubber))) {
+				set_current_state(TASK_RUNNING);
+				if (disk->scrubber->verbose)
+					printk(KERN_INFO "scrubber (%s): Starting periodic "
+						"scrubbing round.\n", disk->disk_name);
+				disk->scrubber->state = 0;
+			} else if (!kthread_should_stop() && disk->scrubber->rbdev) {
+				/* Don't keep the disk open while idle */
+				set_current_state(TASK_RUNNING);
+				scrub_read_put(disk->scrubber);
+			} else if (!kthread_should_stop()) {
 				/* Schedule the task out of the running queue */
-				schedule();
+				timeout = min(timeout,
+					scrub_wdirty_timeout(disk->scrubber));
+				schedule_timeout(min(timeout,
+					min(meta_timeout(disk->scrubber),
+					    scrub_policy_timeout(disk->scrubber))));
 			} else {
 				printk(KERN_INFO "scrubber (%s): Main scrubber thread decided to "
 					"terminate.\n", disk->disk_name);
+				set_current_state(TASK_RUNNING);
+				scrub_read_put(disk->scrubber);
 				break;
 			}
 		}
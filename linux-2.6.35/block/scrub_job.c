@@ -0,0 +1,486 @@
+/*
+ * Copyright (C) 2012 George Amvrosiadis <gamvrosi@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <linux/scrub.h>
+#include <linux/blkdev.h>
+#include <linux/module.h>
+#include <linux/completion.h>
+#include <linux/vmalloc.h>
+#include <asm/uaccess.h>
+
+/*
+ * Scrub jobs are ranges that should be scrubbed ahead of (or outside of)
+ * the regular scrubbing round. They are kept in a per-disk queue, sorted by
+ * priority and then by arrival, and are consumed by the scrubber thread.
+ */
+
+static void scrub_enqueue_job(struct disk_scrubber *s, struct scrub_job *job,
+	int front)
+{
+	struct scrub_job *pos;
+
+	/* Keep the queue sorted by priority, FIFO within the same priority */
+	list_for_each_entry(pos, &s->jobs, list) {
+		if (front ? pos->prio >= job->prio : pos->prio > job->prio) {
+			list_add_tail(&job->list, &pos->list);
+			return;
+		}
+	}
+	list_add_tail(&job->list, &s->jobs);
+}
+
+/**
+ * blk_scrub_range - queue a range of a disk for scrubbing
+ * @disk:	disk to scrub
+ * @start:	first sector of the range
+ * @len:	number of sectors in the range
+ * @prio:	BLK_SCRUB_PRIO_* (lower is more urgent)
+ * @end_io:	called from the scrubber thread when done (may be NULL)
+ * @private:	caller data, stored in the job
+ * @gfp_mask:	allocation flags for the job
+ *
+ * Urgent jobs (@prio below BLK_SCRUB_PRIO_NORMAL) are served before the
+ * next segment of an ongoing scrubbing round; the rest are interleaved with
+ * the round, or served when no round is in progress. May be called from
+ * atomic context, given an appropriate @gfp_mask.
+ */
+int blk_scrub_range(struct gendisk *disk, uint64_t start, uint64_t len,
+	int prio, scrub_end_io_t *end_io, void *private, gfp_t gfp_mask)
+{
+	struct disk_scrubber *s = disk->scrubber;
+	struct scrub_job *job;
+	unsigned long flags;
+
+	if (!s)
+		return -ENODEV;
+	if (!len || start >= get_capacity(disk))
+		return -EINVAL;
+	if (start + len > get_capacity(disk))
+		len = get_capacity(disk) - start;
+
+	job = kzalloc(sizeof(struct scrub_job), gfp_mask);
+	if (!job)
+		return -ENOMEM;
+
+	job->start = job->pos = start;
+	job->len = len;
+	job->prio = clamp(prio, BLK_SCRUB_PRIO_HIGH, BLK_SCRUB_PRIO_LOW);
+	job->end_io = end_io;
+	job->private = private;
+
+	spin_lock_irqsave(&s->joblock, flags);
+	scrub_enqueue_job(s, job, 0);
+	++s->njobs;
+	spin_unlock_irqrestore(&s->joblock, flags);
+
+	wake_up_process(s->task);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(blk_scrub_range);
+
+/*
+ * Rescans cover the error that triggered them, and find it again. Ranges
+ * reported bad are remembered for a while, so that they are counted,
+ * logged and passed to notifiers only once.
+ */
+#define BAD_RECENT_S	600 /* Seconds a bad range is remembered */
+
+/* Returns whether a range overlapping len sectors from sector was reported
+ * bad lately. Otherwise, remembers it in place of the oldest one. May be
+ * called from atomic context. */
+int scrub_bad_reported(struct disk_scrubber *s, uint64_t sector,
+	uint64_t len)
+{
+	struct scrub_bad *b, *old = &s->bad_recent[0];
+	unsigned long flags, now = jiffies;
+	int i, seen = 0;
+
+	spin_lock_irqsave(&s->bad_lock, flags);
+	for (i = 0; i < SCRUB_BAD_RECENT; i++) {
+		b = &s->bad_recent[i];
+		if (b->stamp && time_after(now, b->stamp + BAD_RECENT_S * HZ))
+			b->stamp = 0;
+		if (b->stamp && sector < b->sector + b->len &&
+		    b->sector < sector + len) {
+			seen = 1;
+			break;
+		}
+		if (!b->stamp || (old->stamp && time_before(b->stamp, old->stamp)))
+			old = b;
+	}
+	if (!seen) {
+		old->sector = sector;
+		old->len = len;
+		old->stamp = now ? now : 1;
+	}
+	spin_unlock_irqrestore(&s->bad_lock, flags);
+
+	return seen;
+}
+
+/**
+ * blk_scrub_rescan - queue a rescan around a medium error
+ * @disk:	disk the error was seen on
+ * @sector:	first sector known (or suspected) to be bad
+ * @len:	number of sectors known (or suspected) to be bad
+ * @gfp_mask:	allocation flags for the job
+ *
+ * Latent sector errors tend to cluster, so the neighborhood of an error is
+ * rescanned at a fine granularity, ahead of the scrubbing round. Rescans of
+ * overlapping neighborhoods are coalesced. Called on errors found by the
+ * scrubber, as well as on errors seen by regular reads, possibly from
+ * atomic context.
+ */
+int blk_scrub_rescan(struct gendisk *disk, uint64_t sector, uint64_t len,
+	gfp_t gfp_mask)
+{
+	struct disk_scrubber *s = disk->scrubber;
+	struct scrub_job *job, *pos;
+	uint64_t lo, hi;
+	unsigned long flags;
+
+	if (!s || !s->rescan_radius || sector >= get_capacity(disk))
+		return 0;
+
+	/* The rescan finds the error again: it was reported already */
+	scrub_bad_reported(s, sector, len);
+
+	lo = (sector > s->rescan_radius) ? sector - s->rescan_radius : 0;
+	hi = min_t(uint64_t, sector + len + s->rescan_radius,
+		get_capacity(disk));
+
+	job = kzalloc(sizeof(struct scrub_job), gfp_mask);
+	if (!job)
+		return -ENOMEM;
+
+	spin_lock_irqsave(&s->joblock, flags);
+	list_for_each_entry(pos, &s->jobs, list) {
+		/* Extend a pending rescan that still covers our start */
+		if (!(pos->flags & SCRUB_JOB_RESCAN) || lo < pos->pos ||
+		    lo > pos->start + pos->len)
+			continue;
+		if (hi > pos->start + pos->len)
+			pos->len = hi - pos->start;
+		spin_unlock_irqrestore(&s->joblock, flags);
+		kfree(job);
+		return 0;
+	}
+
+	job->start = job->pos = lo;
+	job->len = hi - lo;
+	job->prio = BLK_SCRUB_PRIO_HIGH;
+	job->flags = SCRUB_JOB_RESCAN;
+	job->chunk = s->rescan_chunk;
+	scrub_enqueue_job(s, job, 0);
+	++s->njobs;
+	spin_unlock_irqrestore(&s->joblock, flags);
+
+	wake_up_process(s->task);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(blk_scrub_rescan);
+
+/*
+ * Write verification batches are queued every wverify_delay_s. Under a
+ * steady write load, the same chunks get written again before their jobs
+ * are served, so ranges already pending are skipped, ranges touching a
+ * pending batch extend it, and the number of batch jobs is capped.
+ */
+
+/* Queues len sectors from start for write verification. Returns 1 if the
+ * range was queued, 0 if a pending job covers it already, or -EBUSY when
+ * SCRUB_WRITTEN_JOBS jobs are pending, in which case the caller keeps the
+ * range for the next batch. Called by the scrubber thread. */
+int scrub_queue_written(struct disk_scrubber *s, uint64_t start,
+	uint64_t len)
+{
+	struct scrub_job *job, *pos;
+	uint64_t end, hi = start + len;
+	unsigned long flags;
+	int n = 0, ret = 1;
+
+	job = kzalloc(sizeof(struct scrub_job), GFP_KERNEL);
+	if (!job)
+		return -ENOMEM;
+
+	spin_lock_irqsave(&s->joblock, flags);
+	list_for_each_entry(pos, &s->jobs, list) {
+		end = pos->start + pos->len;
+		/* Any pending job reaching the range verifies it */
+		if (start >= pos->pos && hi <= end) {
+			ret = 0;
+			goto out;
+		}
+		if (!(pos->flags & SCRUB_JOB_WRITTEN))
+			continue;
+		++n;
+		if (hi < pos->pos || start > end)
+			continue;
+		/* Extend an overlapping or adjoining batch job */
+		if (start < pos->pos) {
+			pos->pos = start;
+			if (start < pos->start)
+				pos->start = start;
+		}
+		pos->len = max(hi, end) - pos->start;
+		goto out;
+	}
+	if (n >= SCRUB_WRITTEN_JOBS) {
+		spin_unlock_irqrestore(&s->joblock, flags);
+		kfree(job);
+		return -EBUSY;
+	}
+
+	job->start = job->pos = start;
+	job->len = len;
+	job->prio = BLK_SCRUB_PRIO_LOW;
+	job->flags = SCRUB_JOB_WRITTEN;
+	scrub_enqueue_job(s, job, 0);
+	++s->njobs;
+	spin_unlock_irqrestore(&s->joblock, flags);
+
+	wake_up_process(s->task);
+	return 1;
+
+out:
+	spin_unlock_irqrestore(&s->joblock, flags);
+	kfree(job);
+	return ret;
+}
+
+/* Removes and returns the first job with priority no lower than maxprio */
+struct scrub_job *scrub_dequeue_job(struct disk_scrubber *s, int maxprio)
+{
+	struct scrub_job *job = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&s->joblock, flags);
+	if (!list_empty(&s->jobs)) {
+		job = list_first_entry(&s->jobs, struct scrub_job, list);
+		if (job->prio > maxprio)
+			job = NULL;
+		else {
+			list_del_init(&job->list);
+			--s->njobs;
+		}
+	}
+	spin_unlock_irqrestore(&s->joblock, flags);
+
+	return job;
+}
+
+/* Puts a partially served job back, ahead of jobs of the same priority */
+void scrub_requeue_job(struct disk_scrubber *s, struct scrub_job *job)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&s->joblock, flags);
+	scrub_enqueue_job(s, job, 1);
+	++s->njobs;
+	spin_unlock_irqrestore(&s->joblock, flags);
+}
+
+/* Completes a job that has been dequeued */
+void scrub_end_job(struct scrub_job *job)
+{
+	if (job->end_io)
+		job->end_io(job);
+	kfree(job);
+}
+
+/* Fails all pending jobs. Called when the scrubber goes away. */
+void scrub_flush_jobs(struct disk_scrubber *s)
+{
+	struct scrub_job *job;
+
+	while ((job = scrub_dequeue_job(s, BLK_SCRUB_PRIO_LOW)) != NULL) {
+		job->errors = -ENODEV;
+		scrub_end_job(job);
+	}
+}
+
+/*
+ * Bad sector notifications. Subsystems with redundancy (e.g. md) register
+ * to be told about the bad sectors found by the scrubber, so that they can
+ * rewrite them right away. Notifiers are called from the scrubber thread.
+ */
+static BLOCKING_NOTIFIER_HEAD(scrub_notifier_list);
+
+int register_scrub_notifier(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_register(&scrub_notifier_list, nb);
+}
+EXPORT_SYMBOL_GPL(register_scrub_notifier);
+
+int unregister_scrub_notifier(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_unregister(&scrub_notifier_list, nb);
+}
+EXPORT_SYMBOL_GPL(unregister_scrub_notifier);
+
+void scrub_notify_bad_sector(struct gendisk *disk, uint64_t sector,
+	uint64_t len)
+{
+	struct scrub_event ev = {
+		.disk	= disk,
+		.sector	= sector,
+		.len	= len,
+	};
+
+	blocking_notifier_call_chain(&scrub_notifier_list,
+		SCRUB_EVENT_BAD_SECTOR, &ev);
+}
+
+/* Asks notifiers for the metadata areas they keep on disk */
+void scrub_notify_metadata(struct gendisk *disk, scrub_extent_fn *report,
+	void *data)
+{
+	struct scrub_event ev = {
+		.disk	= disk,
+		.report	= report,
+		.data	= data,
+	};
+
+	blocking_notifier_call_chain(&scrub_notifier_list,
+		SCRUB_EVENT_METADATA, &ev);
+}
+
+/*
+ * BLKSCRUB ioctl. With BLK_SCRUB_F_WAIT, the caller may be killed while
+ * ranges are still queued, so the ranges live in the batch, which is freed
+ * by whoever drops the last reference: the caller or the last job.
+ */
+struct scrub_ioctl_range {
+	struct blk_scrub_range	r;
+	struct scrub_batch_wait	*wait;
+};
+
+struct scrub_batch_wait {
+	atomic_t		refs; /* Caller and queued jobs */
+	atomic_t		remaining; /* Jobs not served yet, plus caller */
+	struct completion	done;
+	struct scrub_ioctl_range ranges[0];
+};
+
+static void scrub_batch_put(struct scrub_batch_wait *wait)
+{
+	if (atomic_dec_and_test(&wait->refs))
+		vfree(wait);
+}
+
+static void scrub_ioctl_end_io(struct scrub_job *job)
+{
+	struct scrub_ioctl_range *ir = job->private;
+	struct scrub_batch_wait *wait = ir->wait;
+
+	ir->r.result = job->errors;
+	if (atomic_dec_and_test(&wait->remaining))
+		complete(&wait->done);
+	scrub_batch_put(wait);
+}
+
+/* Ranges that fail validation are given -EINVAL, and ranges not reached
+ * after a queuing error -ECANCELED. Returns 0 if any range was queued. */
+int blk_scrub_ioctl(struct block_device *bdev,
+	struct blk_scrub_batch __user *arg)
+{
+	struct gendisk *disk = bdev->bd_disk;
+	struct blk_scrub_batch batch;
+	struct scrub_batch_wait *wait;
+	struct scrub_ioctl_range *ir;
+	uint64_t start, nr_sects;
+	int i, ret = 0, queued = 0, wait_flag;
+
+	if (!disk->scrubber)
+		return -ENOTTY;
+	if (copy_from_user(&batch, arg, sizeof(batch)))
+		return -EFAULT;
+	if (!batch.count || batch.count > BLK_SCRUB_MAX_RANGES)
+		return -EINVAL;
+	wait_flag = batch.flags & BLK_SCRUB_F_WAIT;
+
+	wait = vmalloc(sizeof(struct scrub_batch_wait) +
+		batch.count * sizeof(struct scrub_ioctl_range));
+	if (!wait)
+		return -ENOMEM;
+	atomic_set(&wait->refs, 1);
+	atomic_set(&wait->remaining, 1);
+	init_completion(&wait->done);
+
+	for (i = 0; i < batch.count; i++) {
+		ir = &wait->ranges[i];
+		if (copy_from_user(&ir->r, &arg->ranges[i],
+				sizeof(struct blk_scrub_range))) {
+			scrub_batch_put(wait);
+			return -EFAULT;
+		}
+		ir->r.result = -ECANCELED;
+		ir->wait = wait;
+	}
+
+	/* Ranges are relative to the partition the ioctl was issued on */
+	start = get_start_sect(bdev);
+	nr_sects = bdev->bd_inode->i_size >> 9;
+
+	for (i = 0; i < batch.count; i++) {
+		ir = &wait->ranges[i];
+		if (!ir->r.len || ir->r.start >= nr_sects ||
+		    ir->r.len > nr_sects - ir->r.start) {
+			ir->r.result = -EINVAL;
+			continue;
+		}
+
+		ir->r.result = 0;
+		if (wait_flag) {
+			atomic_inc(&wait->refs);
+			atomic_inc(&wait->remaining);
+		}
+		ret = blk_scrub_range(disk, start + ir->r.start, ir->r.len,
+			ir->r.prio, wait_flag ? scrub_ioctl_end_io : NULL,
+			wait_flag ? ir : NULL, GFP_KERNEL);
+		if (ret) {
+			if (wait_flag) {
+				atomic_dec(&wait->remaining);
+				atomic_dec(&wait->refs);
+			}
+			ir->r.result = ret;
+			break;
+		}
+		++queued;
+	}
+	if (queued)
+		ret = 0;
+
+	/* Drop our own count and wait for all queued ranges. If we're
+	 * killed, the jobs go on, and the last one frees the batch. */
+	if (wait_flag && !atomic_dec_and_test(&wait->remaining) &&
+	    wait_for_completion_killable(&wait->done)) {
+		scrub_batch_put(wait);
+		return -EINTR;
+	}
+
+	for (i = 0; i < batch.count; i++) {
+		if (put_user(wait->ranges[i].r.result,
+				&arg->ranges[i].result)) {
+			ret = -EFAULT;
+			break;
+		}
+	}
+	scrub_batch_put(wait);
+	return ret;
+}
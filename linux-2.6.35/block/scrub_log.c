@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2012 George Amvrosiadis <gamvrosi@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <linux/scrub.h>
+#include <linux/module.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+
+/*
+ * Error log. The last SCRUB_ERRLOG_SIZE errors seen on a disk, by the
+ * scrubber or by regular requests, are kept in a ring buffer that can be
+ * read from the binary 'errors' sysfs file. Every error also triggers a
+ * KOBJ_CHANGE uevent on the scrubber kobject. Errors may be logged from
+ * atomic context, so uevents are sent from a work item.
+ */
+
+#define ERRLOG_MASK	(SCRUB_ERRLOG_SIZE - 1)
+
+static void scrub_errlog_work(struct work_struct *work)
+{
+	struct disk_scrubber *s =
+		container_of(work, struct disk_scrubber, errlog_work);
+	struct blk_scrub_error e;
+	char sector[48], sense[32], source[32];
+	char *envp[] = { sector, sense, source, NULL };
+	unsigned long flags;
+
+	for (;;) {
+		spin_lock_irqsave(&s->errlog_lock, flags);
+		if (s->errlog_sent == s->errlog_seq) {
+			spin_unlock_irqrestore(&s->errlog_lock, flags);
+			break;
+		}
+		/* Skip records that were overwritten in the meantime */
+		if (s->errlog_seq - s->errlog_sent > SCRUB_ERRLOG_SIZE)
+			s->errlog_sent = s->errlog_seq - SCRUB_ERRLOG_SIZE;
+		e = s->errlog[s->errlog_sent & ERRLOG_MASK];
+		++s->errlog_sent;
+		spin_unlock_irqrestore(&s->errlog_lock, flags);
+
+		snprintf(sector, sizeof(sector), "SCRUB_ERROR_SECTOR=%llu",
+			e.sector);
+		snprintf(sense, sizeof(sense), "SCRUB_ERROR_SENSE=%02x/%02x/%02x",
+			e.sense_key, e.asc, e.ascq);
+		snprintf(source, sizeof(source), "SCRUB_ERROR_SOURCE=%s",
+			(e.source == BLK_SCRUB_SRC_SCRUB) ? "scrub" : "foreground");
+		kobject_uevent_env(&s->kobj, KOBJ_CHANGE, envp);
+	}
+}
+
+int scrub_errlog_init(struct disk_scrubber *s)
+{
+	s->errlog_seq = s->errlog_sent = 0;
+	spin_lock_init(&s->errlog_lock);
+	INIT_WORK(&s->errlog_work, scrub_errlog_work);
+
+	s->errlog = kzalloc(SCRUB_ERRLOG_SIZE * sizeof(struct blk_scrub_error),
+		GFP_KERNEL);
+	return s->errlog ? 0 : -ENOMEM;
+}
+
+void scrub_errlog_exit(struct disk_scrubber *s)
+{
+	cancel_work_sync(&s->errlog_work);
+	kfree(s->errlog);
+}
+
+/**
+ * blk_scrub_log_error - record an error seen on a disk
+ * @disk:	disk the error was seen on
+ * @sector:	(first) sector of the error
+ * @key:	sense key
+ * @asc:	additional sense code
+ * @ascq:	additional sense code qualifier
+ * @source:	BLK_SCRUB_SRC_*
+ *
+ * May be called from atomic context.
+ */
+void blk_scrub_log_error(struct gendisk *disk, uint64_t sector,
+	unsigned char key, unsigned char asc, unsigned char ascq, int source)
+{
+	struct disk_scrubber *s = disk->scrubber;
+	struct blk_scrub_error *e;
+	unsigned long flags;
+
+	if (!s || !s->errlog)
+		return;
+
+	spin_lock_irqsave(&s->errlog_lock, flags);
+	e = &s->errlog[s->errlog_seq & ERRLOG_MASK];
+	e->seq = s->errlog_seq++;
+	e->sector = sector;
+	e->time_ns = ktime_to_ns(ktime_get_real());
+	e->sense_key = key;
+	e->asc = asc;
+	e->ascq = ascq;
+	e->source = source;
+	e->pad = 0;
+	spin_unlock_irqrestore(&s->errlog_lock, flags);
+
+	schedule_work(&s->errlog_work);
+}
+EXPORT_SYMBOL_GPL(blk_scrub_log_error);
+
+/*
+ * Recovered errors. A read that the drive only completes after heavy ECC or
+ * retries succeeds, but tells where the media is degrading. The disk is
+ * split in regions of recov_region sectors, and the regions that saw
+ * recovered errors are tracked. A region that collects recov_threshold of
+ * them is queued for a rescrub ahead of the round, at most once every
+ * recov_interval_s. Rescrubs see the same recovered errors again while the
+ * media stays bad, so the region keeps being rescrubbed at that rate until
+ * the errors thin out, and the extra scrubbing goes where it is needed.
+ */
+
+/* Returns the entry of the region starting at start, or the one with the
+ * oldest error if it isn't tracked. Called with recov_lock held. */
+static struct scrub_recov *scrub_recov_get(struct disk_scrubber *s,
+	uint64_t start)
+{
+	struct scrub_recov *r, *old = &s->recov[0];
+	int i;
+
+	for (i = 0; i < SCRUB_RECOV_MAX; i++) {
+		r = &s->recov[i];
+		if (r->stamp && r->start == start)
+			return r;
+		if (time_before(r->stamp, old->stamp))
+			old = r;
+	}
+
+	memset(old, 0, sizeof(*old));
+	old->start = start;
+	return old;
+}
+
+/**
+ * blk_scrub_recovered - record a recovered error seen on a disk
+ * @disk:	disk the error was seen on
+ * @sector:	sector the drive had to recover
+ * @asc:	additional sense code
+ * @ascq:	additional sense code qualifier
+ * @source:	BLK_SCRUB_SRC_*
+ *
+ * Logs the error, and queues a rescrub of its region once the region has
+ * seen enough of them. May be called from atomic context.
+ */
+void blk_scrub_recovered(struct gendisk *disk, uint64_t sector,
+	unsigned char asc, unsigned char ascq, int source)
+{
+	struct disk_scrubber *s = disk->scrubber;
+	struct scrub_recov *r;
+	unsigned long flags, now = get_seconds();
+	uint64_t start, region;
+	int rescrub = 0;
+
+	if (!s)
+		return;
+
+	atomic_inc(&s->recovered);
+	blk_scrub_log_error(disk, sector, 0x1, asc, ascq, source);
+
+	spin_lock_irqsave(&s->recov_lock, flags);
+	region = s->recov_region;
+	if (!region) {
+		spin_unlock_irqrestore(&s->recov_lock, flags);
+		return;
+	}
+	start = div64_u64(sector, region) * region;
+	r = scrub_recov_get(s, start);
+	r->stamp = now;
+	if (++r->errors >= s->recov_threshold &&
+	    !time_before(now, r->due)) {
+		r->errors = 0;
+		++r->rescrubs;
+		r->due = now + s->recov_interval_s;
+		rescrub = 1;
+	}
+	spin_unlock_irqrestore(&s->recov_lock, flags);
+
+	if (rescrub)
+		blk_scrub_range(disk, start, region, BLK_SCRUB_PRIO_NORMAL - 1,
+			NULL, NULL, GFP_ATOMIC);
+}
+EXPORT_SYMBOL_GPL(blk_scrub_recovered);
+
+/* Reads the records in the ring buffer, oldest first */
+static ssize_t scrub_errlog_read(struct file *filp, struct kobject *kobj,
+	struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+	struct disk_scrubber *s =
+		container_of(kobj, struct disk_scrubber, kobj);
+	size_t recsz = sizeof(struct blk_scrub_error);
+	uint64_t first, n, i;
+	unsigned long flags;
+	size_t len = 0;
+
+	spin_lock_irqsave(&s->errlog_lock, flags);
+	n = min_t(uint64_t, s->errlog_seq, SCRUB_ERRLOG_SIZE);
+	first = s->errlog_seq - n;
+
+	/* Only whole records are returned */
+	for (i = div_u64(off, recsz); i < n && len + recsz <= count; i++) {
+		memcpy(buf + len, &s->errlog[(first + i) & ERRLOG_MASK], recsz);
+		len += recsz;
+	}
+	spin_unlock_irqrestore(&s->errlog_lock, flags);
+
+	return len;
+}
+
+struct bin_attribute scrub_errlog_attr = {
+	.attr	= { .name = "errors", .mode = S_IRUSR },
+	.size	= 0,
+	.read	= scrub_errlog_read,
+};
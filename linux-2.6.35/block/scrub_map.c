@@ -0,0 +1,724 @@
+/*
+ * Copyright (C) 2012 George Amvrosiadis <gamvrosi@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <linux/scrub.h>
+#include <linux/fs.h>
+#include <linux/genhd.h>
+#include <linux/bitmap.h>
+#include <linux/vmalloc.h>
+#include <linux/blkdev.h>
+#include <asm/unaligned.h>
+
+/*
+ * Chunk maps. A map has one bit per 1MB chunk of the disk, and is (re)built
+ * by the scrubber thread from the filesystems on the disk.
+ *
+ * The allocation map marks chunks holding allocated blocks. When
+ * filesystem-aware scrubbing is on, it is rebuilt at the start of every
+ * round, and segments without allocated blocks are skipped, except for
+ * every free_interval-th round. Partitions without a filesystem that can
+ * report its allocated blocks are treated as fully allocated, and so is
+ * everything outside partitions (partition tables, gaps, the disk's tail).
+ *
+ * The metadata map marks chunks holding filesystem metadata (superblocks,
+ * group descriptors, bitmaps, inode tables, journal), as well as the
+ * metadata areas that other subsystems (e.g. md) report through the scrub
+ * notifier. The metadata tier is scrubbed more often than bulk data.
+ *
+ * The provisioning cache of thinly provisioned LUNs uses two maps: one for
+ * the chunks whose status is known, and one for the chunks holding mapped
+ * LBAs. See scrub_lbas_mapped().
+ */
+
+#define SCRUB_MAP_SHIFT	11 /* 1MB chunks */
+
+struct scrub_map_ctx {
+	struct scrub_map	*map;
+	sector_t		start; /* First sector of the partition */
+	sector_t		nr_sects; /* Sectors in the partition */
+};
+
+/* Marks len sectors starting from sector (relative to the disk) */
+static void scrub_map_mark(struct scrub_map *map, uint64_t sector,
+	uint64_t len)
+{
+	uint64_t first, last;
+
+	if (!len || sector >= map->nbits << SCRUB_MAP_SHIFT)
+		return;
+
+	first = sector >> SCRUB_MAP_SHIFT;
+	last = min_t(uint64_t, (sector + len - 1) >> SCRUB_MAP_SHIFT,
+		map->nbits - 1);
+	bitmap_set(map->bits, first, last - first + 1);
+}
+
+/* Unmarks the chunks that lie entirely within len sectors starting from
+ * sector, so that chunks shared with other partitions stay marked */
+static void scrub_map_clear(struct scrub_map *map, uint64_t sector,
+	uint64_t len)
+{
+	uint64_t first, last;
+
+	first = (sector + (1 << SCRUB_MAP_SHIFT) - 1) >> SCRUB_MAP_SHIFT;
+	last = min_t(uint64_t, (sector + len) >> SCRUB_MAP_SHIFT, map->nbits);
+	if (first < last)
+		bitmap_clear(map->bits, first, last - first);
+}
+
+/* Called by filesystems for each extent, relative to the partition */
+static int scrub_map_extent(void *data, sector_t sector, sector_t len)
+{
+	struct scrub_map_ctx *ctx = data;
+
+	if (sector >= ctx->nr_sects)
+		return 0;
+	if (len > ctx->nr_sects - sector)
+		len = ctx->nr_sects - sector;
+
+	scrub_map_mark(ctx->map, ctx->start + sector, len);
+	return 0;
+}
+
+/* Called by scrub notifiers for each extent, relative to the disk */
+static int scrub_map_disk_extent(void *data, sector_t sector, sector_t len)
+{
+	scrub_map_mark(data, sector, len);
+	return 0;
+}
+
+static uint64_t scrub_map_chunks(struct gendisk *disk)
+{
+	return (get_capacity(disk) + (1 << SCRUB_MAP_SHIFT) - 1) >>
+		SCRUB_MAP_SHIFT;
+}
+
+/* (Re)allocates a map of nbits chunks. The bits are left uninitialized. */
+static int scrub_map_alloc(struct scrub_map *map, uint64_t nbits)
+{
+	if (map->bits && map->nbits == nbits)
+		return 0;
+
+	scrub_map_free(map);
+	map->bits = vmalloc(BITS_TO_LONGS(nbits) * sizeof(unsigned long));
+	if (!map->bits)
+		return -ENOMEM;
+	map->nbits = nbits;
+	return 0;
+}
+
+static void scrub_map_part(struct disk_scrubber *s, struct scrub_map *map,
+	int type, struct hd_struct *part)
+{
+	struct scrub_map_ctx ctx = {
+		.map		= map,
+		.start		= part->start_sect,
+		.nr_sects	= part->nr_sects,
+	};
+	struct block_device *bdev;
+	struct super_block *sb;
+	int err = -EOPNOTSUPP;
+
+	bdev = bdget(part_devt(part));
+	if (bdev) {
+		sb = get_super(bdev);
+		if (sb) {
+			if (type == SCRUB_MAP_ALLOCATED && sb->s_op->scrub_allocated) {
+				scrub_map_clear(map, ctx.start, ctx.nr_sects);
+				err = sb->s_op->scrub_allocated(sb, scrub_map_extent,
+					&ctx);
+			} else if (type == SCRUB_MAP_METADATA &&
+				 sb->s_op->scrub_metadata)
+				err = sb->s_op->scrub_metadata(sb, scrub_map_extent,
+					&ctx);
+			drop_super(sb);
+		}
+		bdput(bdev);
+	}
+
+	if (err && err != -EOPNOTSUPP)
+		printk(KERN_INFO "scrubber (%s): cannot map partition %d (%d).\n",
+			s->disk_name, part->partno, err);
+
+	/* Be conservative about allocations we can't see into */
+	if (err && type == SCRUB_MAP_ALLOCATED)
+		scrub_map_mark(map, ctx.start, ctx.nr_sects);
+}
+
+/**
+ * scrub_map_build - rebuild a chunk map of a disk
+ * @s:		scrubber of the disk
+ * @map:	map to rebuild
+ * @type:	SCRUB_MAP_*
+ *
+ * Called by the scrubber thread. Returns 0 on success, in which case
+ * map->sectors holds the number of sectors in marked chunks.
+ */
+int scrub_map_build(struct disk_scrubber *s, struct scrub_map *map, int type)
+{
+	struct gendisk *disk = s->disk;
+	struct disk_part_iter piter;
+	struct hd_struct *part;
+	uint64_t nbits = scrub_map_chunks(disk);
+	int nparts = 0;
+
+	if (scrub_map_alloc(map, nbits))
+		return -ENOMEM;
+	/* Allocation maps start out full: partitions clear what they can
+	 * see into */
+	if (type == SCRUB_MAP_ALLOCATED)
+		bitmap_fill(map->bits, nbits);
+	else
+		bitmap_zero(map->bits, nbits);
+
+	disk_part_iter_init(&piter, disk, 0);
+	while ((part = disk_part_iter_next(&piter))) {
+		scrub_map_part(s, map, type, part);
+		++nparts;
+	}
+	disk_part_iter_exit(&piter);
+
+	/* No partition table: look at the whole disk */
+	if (!nparts)
+		scrub_map_part(s, map, type, &disk->part0);
+
+	if (type == SCRUB_MAP_METADATA)
+		scrub_notify_metadata(disk, scrub_map_disk_extent, map);
+
+	map->sectors = (uint64_t) bitmap_weight(map->bits, nbits) <<
+		SCRUB_MAP_SHIFT;
+	return 0;
+}
+
+void scrub_map_free(struct scrub_map *map)
+{
+	vfree(map->bits);
+	map->bits = NULL;
+	map->nbits = 0;
+	map->sectors = 0;
+}
+
+/* Returns whether any of count sectors starting from pos is marked. Maps
+ * that weren't built mark everything. */
+int scrub_map_marked(struct scrub_map *map, uint64_t pos, uint64_t count)
+{
+	uint64_t first = pos >> SCRUB_MAP_SHIFT;
+	uint64_t last = (pos + count - 1) >> SCRUB_MAP_SHIFT;
+
+	if (!map->bits || !count || last >= map->nbits)
+		return 1;
+
+	return find_next_bit(map->bits, last + 1, first) <= last;
+}
+
+/* Finds the first run of marked chunks at or after pos. Returns 0 if there
+ * is none, otherwise fills in the run in sectors. */
+int scrub_map_next(struct scrub_map *map, uint64_t pos, uint64_t *start,
+	uint64_t *len)
+{
+	uint64_t first, end;
+
+	if (!map->bits || pos >= map->nbits << SCRUB_MAP_SHIFT)
+		return 0;
+
+	first = find_next_bit(map->bits, map->nbits, pos >> SCRUB_MAP_SHIFT);
+	if (first >= map->nbits)
+		return 0;
+	end = find_next_zero_bit(map->bits, map->nbits, first);
+
+	*start = max(first << SCRUB_MAP_SHIFT, pos);
+	*len = (end << SCRUB_MAP_SHIFT) - *start;
+	return 1;
+}
+
+/*
+ * Provisioning cache. On thinly provisioned LUNs, segments whose LBAs are
+ * all deallocated (or anchored) have nothing on the medium to verify, and
+ * verifying them only costs back-end bandwidth on the array. The status of
+ * a chunk is looked up with GET LBA STATUS the first time a segment covers
+ * it, and stays cached until the block layer sees a write or discard to
+ * the chunk (see blk_scrub_written()). Writes that race with a lookup only
+ * discard the part of its result from the first chunk written onwards.
+ *
+ * The maps are only (re)allocated and set by the scrubber thread. Other
+ * contexts only clear known bits, under lbas_lock.
+ */
+
+#define LBAS_RESP_LEN	520 /* Header and 32 LBA status descriptors */
+#define LBAS_DESC_LEN	16
+
+#define LBAS_MAPPED	0 /* Provisioning status: mapped (or unknown) */
+#define LBAS_DEALLOC	1 /* Deallocated */
+#define LBAS_ANCHORED	2 /* Anchored */
+
+/* Notes that chunks first to last were written (or invalidated), for the
+ * lookups in flight that may cover them. Called with lbas_lock held. */
+static void lbas_raced(struct disk_scrubber *s, uint64_t first, uint64_t last)
+{
+	struct scrub_lbas_lookup *l;
+	int i;
+
+	for (i = 0; i < SCRUB_LBAS_QUERIES; i++) {
+		l = &s->lbas_lookups[i];
+		if (l->busy && last >= l->chunk)
+			l->raced = min(l->raced, max(first, l->chunk));
+	}
+}
+
+static int scrub_lbas_init(struct disk_scrubber *s)
+{
+	struct scrub_map known = { NULL }, mapped = { NULL };
+	struct scrub_map old_known, old_mapped;
+	uint64_t nbits = scrub_map_chunks(s->disk);
+	unsigned long flags;
+
+	if (s->lbas_known.bits && s->lbas_known.nbits == nbits)
+		return 0;
+
+	if (scrub_map_alloc(&known, nbits) || scrub_map_alloc(&mapped, nbits)) {
+		scrub_map_free(&known);
+		scrub_map_free(&mapped);
+		return -ENOMEM;
+	}
+	bitmap_zero(known.bits, nbits);
+	bitmap_zero(mapped.bits, nbits);
+
+	spin_lock_irqsave(&s->lbas_lock, flags);
+	old_known = s->lbas_known;
+	old_mapped = s->lbas_mapped;
+	s->lbas_known = known;
+	s->lbas_mapped = mapped;
+	/* Lookups in flight were for the old maps */
+	lbas_raced(s, 0, ~0ULL);
+	spin_unlock_irqrestore(&s->lbas_lock, flags);
+
+	scrub_map_free(&old_known);
+	scrub_map_free(&old_mapped);
+	return 0;
+}
+
+void scrub_lbas_free(struct disk_scrubber *s)
+{
+	scrub_map_free(&s->lbas_known);
+	scrub_map_free(&s->lbas_mapped);
+}
+
+/* Looks up the status of the LBAs from the start of chunk onwards, and
+ * caches the status of the chunks the response covers */
+static void scrub_lbas_query(struct disk_scrubber *s, uint64_t chunk)
+{
+	uint64_t lba = chunk << SCRUB_MAP_SHIFT, end, dlba, dlen, full;
+	unsigned int shift = ilog2(scrub_block_sectors(s->disk));
+	struct scrub_lbas_lookup *l = NULL;
+	unsigned char *resp, *d;
+	unsigned long flags;
+	int res, i, n;
+
+	resp = kmalloc(LBAS_RESP_LEN, GFP_KERNEL);
+	if (!resp)
+		return;
+
+	/* Take a lookup slot, so that racing writes can be told apart */
+	spin_lock_irqsave(&s->lbas_lock, flags);
+	for (i = 0; i < SCRUB_LBAS_QUERIES; i++) {
+		if (!s->lbas_lookups[i].busy) {
+			l = &s->lbas_lookups[i];
+			l->busy = 1;
+			l->chunk = chunk;
+			l->raced = ~0ULL;
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&s->lbas_lock, flags);
+	if (!l)
+		goto out_free;
+
+	res = scsi_get_lba_status(s->disk, lba, resp, LBAS_RESP_LEN);
+	if (res) {
+		/* Don't keep asking devices that don't support it */
+		if (res == SG_LIB_CAT_INVALID_OP || res == SG_LIB_CAT_ILLEGAL_REQ) {
+			s->lbp = 0;
+			if (s->verbose)
+				printk(KERN_INFO "scrubber (%s): GET LBA STATUS not "
+					"supported, scrubbing all LBAs.\n", s->disk_name);
+		}
+		goto out;
+	}
+	s->lbp = 1;
+
+	/* The parameter data length doesn't count its own 4 bytes */
+	n = ((int) get_unaligned_be32(resp) - 4) / LBAS_DESC_LEN;
+	n = clamp(n, 0, (LBAS_RESP_LEN - 8) / LBAS_DESC_LEN);
+
+	/* Descriptors are contiguous, starting from lba. They are in
+	 * logical blocks, which may be larger than sectors. */
+	end = lba;
+	for (i = 0; i < n; i++) {
+		d = resp + 8 + i * LBAS_DESC_LEN;
+		dlba = get_unaligned_be64(d) << shift;
+		dlen = (uint64_t) get_unaligned_be32(d + 8) << shift;
+		if (dlba != end || !dlen)
+			break;
+		end = dlba + dlen;
+	}
+	n = i;
+	if (end == lba)
+		goto out;
+
+	spin_lock_irqsave(&s->lbas_lock, flags);
+	/* Writes that raced with the command may have mapped more LBAs: keep
+	 * only what's before the first chunk they touched */
+	end = min_t(uint64_t, end, s->lbas_known.nbits << SCRUB_MAP_SHIFT);
+	if (l->raced != ~0ULL)
+		end = min(end, l->raced << SCRUB_MAP_SHIFT);
+	if (end <= lba) {
+		spin_unlock_irqrestore(&s->lbas_lock, flags);
+		goto out;
+	}
+	full = end >> SCRUB_MAP_SHIFT;
+
+	bitmap_clear(s->lbas_mapped.bits, chunk,
+		((end + (1 << SCRUB_MAP_SHIFT) - 1) >> SCRUB_MAP_SHIFT) - chunk);
+	for (i = 0; i < n; i++) {
+		d = resp + 8 + i * LBAS_DESC_LEN;
+		if ((d[12] & 0xf) == LBAS_DEALLOC || (d[12] & 0xf) == LBAS_ANCHORED)
+			continue;
+		scrub_map_mark(&s->lbas_mapped, get_unaligned_be64(d) << shift,
+			(uint64_t) get_unaligned_be32(d + 8) << shift);
+	}
+	if (full > chunk)
+		bitmap_set(s->lbas_known.bits, chunk, full - chunk);
+	/* A partly covered chunk is known to be mapped, if it is */
+	if (full < s->lbas_known.nbits && test_bit(full, s->lbas_mapped.bits))
+		set_bit(full, s->lbas_known.bits);
+	spin_unlock_irqrestore(&s->lbas_lock, flags);
+out:
+	spin_lock_irqsave(&s->lbas_lock, flags);
+	l->busy = 0;
+	spin_unlock_irqrestore(&s->lbas_lock, flags);
+out_free:
+	kfree(resp);
+}
+
+/**
+ * scrub_lbas_mapped - check whether a range holds mapped LBAs
+ * @s:		scrubber of the disk
+ * @pos:	first sector of the range
+ * @count:	number of sectors in the range
+ *
+ * Called by the scrubber thread. Returns 0 only if all of the range is known
+ * to be deallocated. Devices that can't report the provisioning status of
+ * their LBAs are considered fully mapped.
+ */
+int scrub_lbas_mapped(struct disk_scrubber *s, uint64_t pos, uint64_t count)
+{
+	uint64_t chunk, last;
+
+	/* GET LBA STATUS needs a request based (SCSI) queue */
+	if (!s->lbp || !count || !s->disk->queue->request_fn)
+		return 1;
+	if (scrub_lbas_init(s))
+		return 1;
+
+	last = (pos + count - 1) >> SCRUB_MAP_SHIFT;
+	if (last >= s->lbas_known.nbits)
+		return 1;
+
+	for (chunk = pos >> SCRUB_MAP_SHIFT; chunk <= last; chunk++) {
+		if (!test_bit(chunk, s->lbas_known.bits))
+			scrub_lbas_query(s, chunk);
+		if (!test_bit(chunk, s->lbas_known.bits) ||
+		    test_bit(chunk, s->lbas_mapped.bits))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Write times. On flash, retention errors grow with the time since cells
+ * were programmed, so the flash profile scrubs the data written longest
+ * ago first. The time of the last write is kept for SCRUB_FLASH_CHUNKS
+ * equal chunks of the disk, once the first flash pass has allocated the
+ * table. Chunks not written since have an unknown (zero) time, and are
+ * scrubbed first.
+ */
+int scrub_wtime_init(struct disk_scrubber *s)
+{
+	uint32_t *wtime;
+
+	if (s->wtime)
+		return 0;
+
+	wtime = vmalloc(SCRUB_FLASH_CHUNKS * sizeof(uint32_t));
+	if (!wtime)
+		return -ENOMEM;
+	memset(wtime, 0, SCRUB_FLASH_CHUNKS * sizeof(uint32_t));
+
+	/* Writers may see the table as soon as it's published */
+	smp_wmb();
+	s->wtime = wtime;
+	return 0;
+}
+
+void scrub_wtime_free(struct disk_scrubber *s)
+{
+	vfree(s->wtime);
+	s->wtime = NULL;
+}
+
+/* Returns the write time chunk of pos */
+unsigned int scrub_wtime_chunk(struct gendisk *disk, uint64_t pos)
+{
+	uint64_t cap = get_capacity(disk);
+
+	if (!cap || pos >= cap)
+		return SCRUB_FLASH_CHUNKS - 1;
+	return (unsigned int) div64_u64(pos * SCRUB_FLASH_CHUNKS, cap);
+}
+
+/* Returns the first sector of a write time chunk */
+uint64_t scrub_wtime_start(struct gendisk *disk, unsigned int chunk)
+{
+	uint64_t cap = get_capacity(disk);
+
+	if (chunk >= SCRUB_FLASH_CHUNKS)
+		return cap;
+	return div64_u64(cap * chunk + SCRUB_FLASH_CHUNKS - 1,
+		SCRUB_FLASH_CHUNKS);
+}
+
+static void scrub_wtime_stamp(struct gendisk *disk, uint64_t sector,
+	uint64_t len)
+{
+	uint32_t *wtime = disk->scrubber->wtime;
+	uint32_t now = (uint32_t) get_seconds() | 1;
+	unsigned int c, last;
+
+	last = scrub_wtime_chunk(disk, sector + len - 1);
+	for (c = scrub_wtime_chunk(disk, sector); c <= last; c++)
+		wtime[c] = now;
+}
+
+/*
+ * Write verification. Write errors (high-fly or off-track writes) only
+ * show up when the data is read back, which may be a full round later.
+ * When wverify_delay_s is set, the 1MB chunks written to are marked in a
+ * dirty map. Once the oldest mark is wverify_delay_s old, the marked
+ * chunks are queued as low priority scrub jobs, with runs separated by
+ * small gaps coalesced into one job, and the map starts over. Runs that a
+ * pending job covers are skipped, runs touching a pending batch job extend
+ * it, and past SCRUB_WRITTEN_JOBS pending jobs, the rest of the batch is
+ * marked again for the next one. The jobs
+ * are served when there's no round, or interleaved with it, like any
+ * other job, at the idle I/O priority of the scrubber.
+ *
+ * Writes mark the active map under wdirty_lock. The flush swaps it with a
+ * clear map, so that writes can go on marking while the batch is queued.
+ */
+
+#define WDIRTY_GAP	4 /* Clean chunks between runs in the same job */
+
+/* Allocates (or frees, when the delay is 0) the dirty maps. Called with
+ * sysfs_lock held. */
+int scrub_wdirty_init(struct disk_scrubber *s)
+{
+	struct scrub_map dirty = { NULL }, flush = { NULL }, old_dirty;
+	struct scrub_map old_flush;
+	uint64_t nbits = scrub_map_chunks(s->disk);
+	unsigned long flags;
+
+	if (s->wverify_delay_s) {
+		if (s->wdirty.bits && s->wdirty.nbits == nbits)
+			return 0;
+		if (scrub_map_alloc(&dirty, nbits) ||
+		    scrub_map_alloc(&flush, nbits)) {
+			scrub_map_free(&dirty);
+			scrub_map_free(&flush);
+			return -ENOMEM;
+		}
+		bitmap_zero(dirty.bits, nbits);
+		bitmap_zero(flush.bits, nbits);
+	}
+
+	spin_lock_irqsave(&s->wdirty_lock, flags);
+	old_dirty = s->wdirty;
+	old_flush = s->wflush;
+	s->wdirty = dirty;
+	s->wflush = flush;
+	s->wdirty_since = 0;
+	spin_unlock_irqrestore(&s->wdirty_lock, flags);
+
+	scrub_map_free(&old_dirty);
+	scrub_map_free(&old_flush);
+	return 0;
+}
+
+void scrub_wdirty_free(struct disk_scrubber *s)
+{
+	scrub_map_free(&s->wdirty);
+	scrub_map_free(&s->wflush);
+}
+
+/* Returns whether a batch of written chunks is due for verification */
+int scrub_wdirty_due(struct disk_scrubber *s)
+{
+	unsigned long since = s->wdirty_since;
+
+	return s->wverify_delay_s && since &&
+		!time_before(get_seconds(),
+			since + (unsigned long) s->wverify_delay_s);
+}
+
+/* Returns the time until the next batch is due */
+long scrub_wdirty_timeout(struct disk_scrubber *s)
+{
+	unsigned long since = s->wdirty_since, due, now = get_seconds();
+
+	if (!s->wverify_delay_s || !since)
+		return MAX_SCHEDULE_TIMEOUT;
+	due = since + (unsigned long) s->wverify_delay_s;
+	if (!time_before(now, due))
+		return 1;
+	return msecs_to_jiffies(min(due - now, 3600UL) * 1000);
+}
+
+static void scrub_wdirty_mark(struct disk_scrubber *s, uint64_t sector,
+	uint64_t len)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&s->wdirty_lock, flags);
+	if (s->wdirty.bits &&
+	    sector < s->wdirty.nbits << SCRUB_MAP_SHIFT) {
+		scrub_map_mark(&s->wdirty, sector, len);
+		if (!s->wdirty_since)
+			s->wdirty_since = get_seconds();
+	}
+	spin_unlock_irqrestore(&s->wdirty_lock, flags);
+}
+
+/* Queues the written chunks for verification. Called by the scrubber
+ * thread. */
+void scrub_wdirty_flush(struct disk_scrubber *s)
+{
+	struct scrub_map map;
+	uint64_t pos = 0, start, len, next, nlen;
+	uint64_t cap = get_capacity(s->disk);
+	unsigned long flags;
+	int jobs = 0, kept = 0, ret = 0;
+
+	mutex_lock(&s->sysfs_lock);
+	if (!s->wdirty.bits) {
+		mutex_unlock(&s->sysfs_lock);
+		return;
+	}
+
+	spin_lock_irqsave(&s->wdirty_lock, flags);
+	map = s->wdirty;
+	s->wdirty = s->wflush;
+	s->wflush = map;
+	s->wdirty_since = 0;
+	spin_unlock_irqrestore(&s->wdirty_lock, flags);
+
+	while (scrub_map_next(&map, pos, &start, &len)) {
+		while (scrub_map_next(&map, start + len, &next, &nlen) &&
+		       next - (start + len) <= WDIRTY_GAP << SCRUB_MAP_SHIFT)
+			len = next + nlen - start;
+		if (start >= cap)
+			break;
+		len = min(len, cap - start);
+		pos = start + len;
+		/* Past the job cap, leave the rest to the next batch */
+		if (ret >= 0)
+			ret = scrub_queue_written(s, start, len);
+		if (ret < 0) {
+			scrub_wdirty_mark(s, start, len);
+			++kept;
+			continue;
+		}
+		if (ret) {
+			s->wverified += len;
+			++jobs;
+		}
+	}
+	bitmap_zero(map.bits, map.nbits);
+	mutex_unlock(&s->sysfs_lock);
+
+	if (s->verbose > 1)
+		printk(KERN_INFO "scrubber (%s): Queued %d ranges of written "
+			"sectors for verification, kept %d for the next "
+			"batch.\n", s->disk_name, jobs, kept);
+}
+
+/* Returns the number of sectors in chunks written since the last batch.
+ * Called with sysfs_lock held. */
+uint64_t scrub_wdirty_pending(struct disk_scrubber *s)
+{
+	uint64_t n = 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&s->wdirty_lock, flags);
+	if (s->wdirty.bits)
+		n = (uint64_t) bitmap_weight(s->wdirty.bits, s->wdirty.nbits);
+	spin_unlock_irqrestore(&s->wdirty_lock, flags);
+
+	return n << SCRUB_MAP_SHIFT;
+}
+
+/**
+ * blk_scrub_written - note a write to a range of a disk
+ * @disk:	disk written to
+ * @sector:	first sector written (or discarded), relative to the disk
+ * @len:	number of sectors written
+ * @discard:	whether the range was discarded rather than written
+ *
+ * Invalidates the cached provisioning status of the range. Written data
+ * also gets its write time stamped, and is marked for verification.
+ * Called by the block layer for every write and discard to a disk with a
+ * scrubber, possibly from atomic context.
+ */
+void blk_scrub_written(struct gendisk *disk, uint64_t sector, uint64_t len,
+	int discard)
+{
+	struct disk_scrubber *s = disk->scrubber;
+	uint64_t first, last;
+	unsigned long flags;
+
+	if (!s || !len)
+		return;
+
+	if (s->wtime && !discard)
+		scrub_wtime_stamp(disk, sector, len);
+	if (s->wdirty.bits && !discard)
+		scrub_wdirty_mark(s, sector, len);
+
+	if (!s->lbas_known.bits)
+		return;
+
+	spin_lock_irqsave(&s->lbas_lock, flags);
+	if (s->lbas_known.bits &&
+	    sector < s->lbas_known.nbits << SCRUB_MAP_SHIFT) {
+		first = sector >> SCRUB_MAP_SHIFT;
+		last = min_t(uint64_t, (sector + len - 1) >> SCRUB_MAP_SHIFT,
+			s->lbas_known.nbits - 1);
+		bitmap_clear(s->lbas_known.bits, first, last - first + 1);
+		lbas_raced(s, first, last);
+	}
+	spin_unlock_irqrestore(&s->lbas_lock, flags);
+}
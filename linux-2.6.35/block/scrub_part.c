@@ -0,0 +1,474 @@
+/*
+ * Copyright (C) 2012 George Amvrosiadis <gamvrosi@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <linux/scrub.h>
+#include <linux/blkdev.h>
+
+/*
+ * Partition policies. Every partition of a disk with a scrubber gets a
+ * 'scrubber' directory of its own, under /sys/block/<disk>/<part>. By
+ * default, partitions are scrubbed along with the rest of the disk. A
+ * partition with a policy of its own is left out of the disk rounds, and
+ * is scrubbed in rounds of its own instead, every period_s seconds, with
+ * its own strategy, priority and delay between commands (the rest of the
+ * parameters are the disk's). This way, an archive can be scrubbed often
+ * and fast, while a latency sensitive partition is only scrubbed rarely,
+ * and gently. Partition rounds are run by the disk's scrubber thread, in
+ * between disk rounds, within the disk's time-of-day windows.
+ *
+ * Policies are kept in a list on the disk's scrubber, under sysfs_lock.
+ * Partition rounds only refer to their partition by number, so that the
+ * partition may go away at any time.
+ */
+
+static const char *policy_strategies[SCRUB_STRAT_NUM + 1] = {
+	"disk", "seql", "stag", "char", "hybr" };
+static const char *policy_priorities[SCRUB_PRIO_NUM + 1] = {
+	"disk", "realtime", "idlechk", "deadline" };
+
+static struct kobj_type scrub_policy_ktype;
+
+/* Returns the policy of partition partno, if it has a scrubber directory.
+ * Called with sysfs_lock held. */
+struct scrub_policy *scrub_policy_find(struct disk_scrubber *s, int partno)
+{
+	struct scrub_policy *p;
+
+	list_for_each_entry(p, &s->policies, list)
+		if (p->partno == partno)
+			return p;
+	return NULL;
+}
+
+/* Picks the partition whose round is due the longest, if any, for the
+ * next round. Returns whether one was picked. */
+int scrub_policy_due(struct disk_scrubber *s)
+{
+	struct scrub_policy *p, *due = NULL;
+	unsigned long now = get_seconds();
+
+	mutex_lock(&s->sysfs_lock);
+	if (!scrub_window_wait(s, now)) {
+		list_for_each_entry(p, &s->policies, list) {
+			if (!p->own || !p->period_s ||
+			    time_before(now, p->next_start))
+				continue;
+			if (!due || time_before(p->next_start, due->next_start))
+				due = p;
+		}
+	}
+	if (due) {
+		s->part_round = due->partno;
+		++due->rounds;
+	}
+	mutex_unlock(&s->sysfs_lock);
+
+	return due != NULL;
+}
+
+/* Returns the time until the next partition round is due */
+long scrub_policy_timeout(struct disk_scrubber *s)
+{
+	struct scrub_policy *p;
+	unsigned long now = get_seconds(), wait = ULONG_MAX;
+
+	mutex_lock(&s->sysfs_lock);
+	list_for_each_entry(p, &s->policies, list) {
+		if (!p->own || !p->period_s)
+			continue;
+		if (!time_before(now, p->next_start)) {
+			wait = scrub_window_wait(s, now);
+			break;
+		}
+		wait = min(wait, p->next_start - now);
+	}
+	mutex_unlock(&s->sysfs_lock);
+
+	if (wait == ULONG_MAX)
+		return MAX_SCHEDULE_TIMEOUT;
+	if (!wait)
+		return 1;
+	/* Check back at least hourly, in case the clock was changed */
+	return msecs_to_jiffies(min(wait, 3600UL) * 1000);
+}
+
+/* Schedules the next round of the partition of the round that started at
+ * 'started'. Called with sysfs_lock held. */
+void scrub_policy_advance(struct disk_scrubber *s, unsigned long started)
+{
+	struct scrub_policy *p = scrub_policy_find(s, s->part_round);
+	unsigned long now = get_seconds();
+
+	if (!p)
+		return;
+
+	p->next_start = started + (unsigned long) p->period_s;
+	if (time_before(p->next_start, now))
+		p->next_start = now;
+}
+
+/*
+ * sysfs parts below
+ */
+struct scrub_policy_entry {
+	struct attribute attr;
+	ssize_t (*show)(struct scrub_policy *, char *);
+	ssize_t (*store)(struct scrub_policy *, const char *, size_t);
+};
+
+/* Prints names, with the one in use in brackets */
+static ssize_t policy_show_names(const char **names, int n, int cur,
+	char *page)
+{
+	int i, len = 0;
+
+	for (i = 0; i < n; i++) {
+		if (i == cur)
+			len += sprintf(page+len, "[%s] ", names[i]);
+		else
+			len += sprintf(page+len, "%s ", names[i]);
+	}
+
+	len += sprintf(page+len, "\n");
+	return len;
+}
+
+/* Length of a written value, without its trailing newline */
+#define policy_len(page)	((int) strcspn((page), "\n"))
+
+/* Returns the index of name in names, or -1 */
+static int policy_find_name(const char **names, int n, const char *page)
+{
+	char name[SCRUB_PRIO_NAME_MAX];
+	size_t len;
+	int i;
+
+	strlcpy(name, page, sizeof(name));
+	len = strlen(name);
+	if (len && name[len-1] == '\n')
+		name[len-1] = '\0';
+
+	for (i = 0; i < n; i++)
+		if (!strcmp(name, names[i]))
+			return i;
+	return -1;
+}
+
+static ssize_t policy_own_show(struct scrub_policy *p, char *page)
+{
+	if (p->own)
+		return sprintf(page, "disk [own]\n");
+	return sprintf(page, "[disk] own\n");
+}
+
+static ssize_t policy_own_store(struct scrub_policy *p, const char *page,
+	size_t count)
+{
+	static const char *modes[] = { "disk", "own" };
+	struct scrub_policy *q;
+	int own, n = 0;
+
+	own = policy_find_name(modes, ARRAY_SIZE(modes), page);
+	if (own < 0) {
+		printk(KERN_ERR "scrubber (%s): policy '%.*s' not found.\n",
+			p->ds->disk_name, policy_len(page), page);
+		return count;
+	}
+
+	/* Disk rounds only leave out so many partitions */
+	list_for_each_entry(q, &p->ds->policies, list)
+		n += q->own;
+	if (own && !p->own && n >= SCRUB_POLICY_MAX) {
+		printk(KERN_ERR "scrubber (%s): Only %d partitions can have "
+			"policies of their own.\n", p->ds->disk_name,
+			SCRUB_POLICY_MAX);
+		return count;
+	}
+
+	if (own && !p->own)
+		p->next_start = get_seconds();
+	p->own = own;
+
+	return count;
+}
+
+static ssize_t policy_strategy_show(struct scrub_policy *p, char *page)
+{
+	return policy_show_names(policy_strategies, SCRUB_STRAT_NUM + 1,
+		p->strategy, page);
+}
+
+static ssize_t policy_strategy_store(struct scrub_policy *p,
+	const char *page, size_t count)
+{
+	int i = policy_find_name(policy_strategies, SCRUB_STRAT_NUM + 1, page);
+
+	if (i < 0)
+		printk(KERN_ERR "scrubber (%s): strategy '%.*s' not found.\n",
+			p->ds->disk_name, policy_len(page), page);
+	/* Characterization samples the whole disk, not a partition */
+	else if (!strcmp(policy_strategies[i], "char"))
+		printk(KERN_ERR "scrubber (%s): strategy '%s' doesn't apply to "
+			"partitions.\n", p->ds->disk_name, policy_strategies[i]);
+	else
+		p->strategy = i;
+
+	return count;
+}
+
+static ssize_t policy_priority_show(struct scrub_policy *p, char *page)
+{
+	return policy_show_names(policy_priorities, SCRUB_PRIO_NUM + 1,
+		p->priority, page);
+}
+
+static ssize_t policy_priority_store(struct scrub_policy *p,
+	const char *page, size_t count)
+{
+	int i = policy_find_name(policy_priorities, SCRUB_PRIO_NUM + 1, page);
+
+	if (i < 0)
+		printk(KERN_ERR "scrubber (%s): priority '%.*s' not found.\n",
+			p->ds->disk_name, policy_len(page), page);
+	else
+		p->priority = i;
+
+	return count;
+}
+
+static ssize_t policy_delayms_show(struct scrub_policy *p, char *page)
+{
+	return sprintf(page, "%llu\n", p->delayms);
+}
+
+static ssize_t policy_delayms_store(struct scrub_policy *p,
+	const char *page, size_t count)
+{
+	char *q = (char *) page;
+
+	p->delayms = simple_strtoull(q, &q, 10);
+
+	return count;
+}
+
+static ssize_t policy_period_s_show(struct scrub_policy *p, char *page)
+{
+	return sprintf(page, "%llu\n", p->period_s);
+}
+
+static ssize_t policy_period_s_store(struct scrub_policy *p,
+	const char *page, size_t count)
+{
+	char *q = (char *) page;
+
+	p->period_s = simple_strtoull(q, &q, 10);
+	p->next_start = get_seconds();
+
+	return count;
+}
+
+static ssize_t policy_next_s_show(struct scrub_policy *p, char *page)
+{
+	unsigned long now = get_seconds();
+
+	if (!p->own || !p->period_s)
+		return sprintf(page, "-1\n");
+	if (time_before(now, p->next_start))
+		return sprintf(page, "%lu\n", p->next_start - now);
+	return sprintf(page, "0\n");
+}
+
+static ssize_t policy_rounds_show(struct scrub_policy *p, char *page)
+{
+	return sprintf(page, "%u\n", p->rounds);
+}
+
+static struct scrub_policy_entry policy_own_entry = {
+	.attr = {.name = "policy", .mode = S_IRUGO | S_IWUSR },
+	.show = policy_own_show,
+	.store = policy_own_store,
+};
+
+static struct scrub_policy_entry policy_strategy_entry = {
+	.attr = {.name = "strategy", .mode = S_IRUGO | S_IWUSR },
+	.show = policy_strategy_show,
+	.store = policy_strategy_store,
+};
+
+static struct scrub_policy_entry policy_priority_entry = {
+	.attr = {.name = "priority", .mode = S_IRUGO | S_IWUSR },
+	.show = policy_priority_show,
+	.store = policy_priority_store,
+};
+
+static struct scrub_policy_entry policy_delayms_entry = {
+	.attr = {.name = "delayms", .mode = S_IRUGO | S_IWUSR },
+	.show = policy_delayms_show,
+	.store = policy_delayms_store,
+};
+
+static struct scrub_policy_entry policy_period_s_entry = {
+	.attr = {.name = "period_s", .mode = S_IRUGO | S_IWUSR },
+	.show = policy_period_s_show,
+	.store = policy_period_s_store,
+};
+
+static struct scrub_policy_entry policy_next_s_entry = {
+	.attr = {.name = "next_s", .mode = S_IRUGO },
+	.show = policy_next_s_show,
+};
+
+static struct scrub_policy_entry policy_rounds_entry = {
+	.attr = {.name = "rounds", .mode = S_IRUGO },
+	.show = policy_rounds_show,
+};
+
+static struct attribute *policy_attrs[] = {
+	&policy_own_entry.attr,
+	&policy_strategy_entry.attr,
+	&policy_priority_entry.attr,
+	&policy_delayms_entry.attr,
+	&policy_period_s_entry.attr,
+	&policy_next_s_entry.attr,
+	&policy_rounds_entry.attr,
+	NULL,
+};
+
+#define to_policy_entry(atr) \
+	container_of((atr), struct scrub_policy_entry, attr)
+
+static ssize_t policy_attr_show(struct kobject *kobj, struct attribute *attr,
+	char *page)
+{
+	struct scrub_policy_entry *entry = to_policy_entry(attr);
+	struct scrub_policy *p = container_of(kobj, struct scrub_policy, kobj);
+	ssize_t res;
+
+	if (!entry->show)
+		return -EIO;
+	mutex_lock(&p->ds->sysfs_lock);
+	res = entry->show(p, page);
+	mutex_unlock(&p->ds->sysfs_lock);
+	return res;
+}
+
+static ssize_t policy_attr_store(struct kobject *kobj, struct attribute *attr,
+	const char *page, size_t length)
+{
+	struct scrub_policy_entry *entry = to_policy_entry(attr);
+	struct scrub_policy *p = container_of(kobj, struct scrub_policy, kobj);
+	ssize_t res;
+
+	if (!entry->store)
+		return -EIO;
+	mutex_lock(&p->ds->sysfs_lock);
+	res = entry->store(p, page, length);
+	mutex_unlock(&p->ds->sysfs_lock);
+	return res;
+}
+
+static void policy_release(struct kobject *kobj)
+{
+	kfree(container_of(kobj, struct scrub_policy, kobj));
+}
+
+static struct sysfs_ops policy_sysfs_ops = {
+	.show	= policy_attr_show,
+	.store	= policy_attr_store,
+};
+
+static struct kobj_type scrub_policy_ktype = {
+	.sysfs_ops	= &policy_sysfs_ops,
+	.default_attrs	= policy_attrs,
+	.release	= policy_release,
+};
+
+/**
+ * blk_register_scrub_part - add the scrubber directory of a partition
+ * @disk:	disk the partition is on
+ * @part:	partition
+ *
+ * Called for the partitions present when the disk's scrubber registers,
+ * and for the partitions added later on.
+ */
+int blk_register_scrub_part(struct gendisk *disk, struct hd_struct *part)
+{
+	struct disk_scrubber *s = disk->scrubber;
+	struct scrub_policy *p;
+	int ret;
+
+	if (!s || !part->partno)
+		return 0;
+
+	p = kzalloc(sizeof(struct scrub_policy), GFP_KERNEL);
+	if (!p)
+		return -ENOMEM;
+
+	p->ds = s;
+	p->partno = part->partno;
+	p->own = 0;
+	p->strategy = 0;
+	p->priority = 0;
+	p->delayms = 0;
+	p->period_s = 0;
+	p->next_start = get_seconds();
+	p->rounds = 0;
+
+	ret = kobject_init_and_add(&p->kobj, &scrub_policy_ktype,
+		&part_to_dev(part)->kobj, "%s", "scrubber");
+	if (ret < 0) {
+		kobject_put(&p->kobj);
+		return ret;
+	}
+
+	mutex_lock(&s->sysfs_lock);
+	list_add_tail(&p->list, &s->policies);
+	mutex_unlock(&s->sysfs_lock);
+
+	kobject_uevent(&p->kobj, KOBJ_ADD);
+	return 0;
+}
+
+/**
+ * blk_unregister_scrub_part - remove the scrubber directory of a partition
+ * @disk:	disk the partition is on
+ * @partno:	partition number
+ *
+ * Called when the partition goes away, or the disk's scrubber does.
+ */
+void blk_unregister_scrub_part(struct gendisk *disk, int partno)
+{
+	struct disk_scrubber *s = disk->scrubber;
+	struct scrub_policy *p;
+
+	if (!s)
+		return;
+
+	mutex_lock(&s->sysfs_lock);
+	p = scrub_policy_find(s, partno);
+	if (p)
+		list_del(&p->list);
+	mutex_unlock(&s->sysfs_lock);
+
+	if (!p)
+		return;
+
+	kobject_uevent(&p->kobj, KOBJ_REMOVE);
+	kobject_del(&p->kobj);
+	kobject_put(&p->kobj);
+}
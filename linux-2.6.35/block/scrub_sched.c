@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2012 George Amvrosiadis <gamvrosi@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <linux/scrub.h>
+#include <linux/time.h>
+#include <linux/ctype.h>
+
+/*
+ * Periodic scrubbing. Rounds are started automatically every period_s
+ * seconds, and only run within the configured time-of-day windows. The
+ * first round of each disk is staggered by a fraction of the period, so
+ * that disks registered together don't all start scrubbing at once.
+ */
+
+#define SECS_PER_DAY	86400
+
+static atomic_t scrub_slots = ATOMIC_INIT(0);
+
+/* Returns the next stagger slot. Slots are spread across the period using
+ * the golden ratio, so any number of disks ends up evenly spaced. */
+unsigned int scrub_sched_slot(void)
+{
+	return (unsigned int) atomic_inc_return(&scrub_slots) - 1;
+}
+
+/* Returns the offset of the first round of the disk, within the period */
+static unsigned long scrub_stagger_offset(struct disk_scrubber *s)
+{
+	uint32_t frac = (uint32_t) s->slot * 2654435769U;
+
+	return (unsigned long) (((uint64_t) frac * s->period_s) >> 32);
+}
+
+/* Schedules the first automatic round after the period was (re)set */
+void scrub_sched_reset(struct disk_scrubber *s)
+{
+	s->next_start = get_seconds();
+	if (s->stagger)
+		s->next_start += scrub_stagger_offset(s);
+}
+
+/* Schedules the next automatic round, after one started at 'started' */
+void scrub_sched_advance(struct disk_scrubber *s, unsigned long started)
+{
+	unsigned long now = get_seconds();
+
+	s->next_start = started + (unsigned long) s->period_s;
+	if (time_before(s->next_start, now))
+		s->next_start = now;
+}
+
+static unsigned long scrub_time_of_day(unsigned long now)
+{
+	long local = (long) now - sys_tz.tz_minuteswest * 60;
+
+	return (unsigned long) (local % SECS_PER_DAY + SECS_PER_DAY) %
+		SECS_PER_DAY;
+}
+
+/* Returns 0 if scrubbing is allowed now, or the number of seconds until
+ * the next window opens. Called with sysfs_lock held. */
+unsigned long scrub_window_wait(struct disk_scrubber *s, unsigned long now)
+{
+	unsigned long tod, wait, best = SECS_PER_DAY;
+	int i;
+
+	if (!s->nwindows)
+		return 0;
+
+	tod = scrub_time_of_day(now);
+	for (i = 0; i < s->nwindows; i++) {
+		struct scrub_window *w = &s->windows[i];
+
+		/* Windows may wrap around midnight (e.g. 22:00-06:00) */
+		if (w->start <= w->end) {
+			if (tod >= w->start && tod < w->end)
+				return 0;
+		} else if (tod >= w->start || tod < w->end) {
+			return 0;
+		}
+
+		wait = (w->start + SECS_PER_DAY - tod) % SECS_PER_DAY;
+		if (wait < best)
+			best = wait;
+	}
+
+	return best ? best : 1;
+}
+
+/* Parses "HH:MM" into seconds of the day. Returns the number of characters
+ * consumed, or 0 on error. */
+static int scrub_parse_tod(const char *p, unsigned int *secs)
+{
+	char *end;
+	unsigned long hh, mm;
+
+	if (!isdigit(*p))
+		return 0;
+	hh = simple_strtoul(p, &end, 10);
+	if (*end != ':' || !isdigit(end[1]))
+		return 0;
+	mm = simple_strtoul(end + 1, &end, 10);
+	if (hh > 24 || mm > 59 || (hh == 24 && mm))
+		return 0;
+
+	*secs = hh * 3600 + mm * 60;
+	return end - p;
+}
+
+/* Parses a list of windows of the form "HH:MM-HH:MM [HH:MM-HH:MM ...]".
+ * An empty list, or "all", allows scrubbing at any time. */
+int scrub_parse_windows(const char *p, struct scrub_window *w)
+{
+	int n = 0, len;
+
+	while (*p) {
+		while (isspace(*p) || *p == ',')
+			p++;
+		if (!*p)
+			break;
+		if (!strncmp(p, "all", 3))
+			return 0;
+		if (n == SCRUB_WINDOWS_MAX)
+			return -EINVAL;
+
+		if (!(len = scrub_parse_tod(p, &w[n].start)))
+			return -EINVAL;
+		p += len;
+		if (*p++ != '-')
+			return -EINVAL;
+		if (!(len = scrub_parse_tod(p, &w[n].end)))
+			return -EINVAL;
+		p += len;
+		if (w[n].start == w[n].end)
+			return -EINVAL;
+		n++;
+	}
+
+	return n;
+}
+
+int scrub_print_windows(struct disk_scrubber *s, char *page)
+{
+	int i, len = 0;
+
+	if (!s->nwindows)
+		return sprintf(page, "all\n");
+
+	for (i = 0; i < s->nwindows; i++)
+		len += sprintf(page + len, "%02u:%02u-%02u:%02u ",
+			s->windows[i].start / 3600, (s->windows[i].start / 60) % 60,
+			s->windows[i].end / 3600, (s->windows[i].end / 60) % 60);
+	len += sprintf(page + len, "\n");
+
+	return len;
+}
@@ -41,25 +41,6 @@
 #define SPC_SK_COPY_ABORTED 0xa
 #define SPC_SK_ABORTED_COMMAND 0xb
 
-/* Utilities can use these process status values for syntax errors and
- * file (device node) problems (e.g. not found or permissions). */
-
-/* The sg_err_category_sense() function returns one of the following.
- * These may be used as process status values (on exit). Notice that
- * some of the lower values correspond to SCSI sense key values. */
-#define SG_LIB_CAT_NOT_READY 2	/* interpreted from sense buffer */
-#define SG_LIB_CAT_MEDIUM_HARD 3	/* medium or hardware error, blank check */
-#define SG_LIB_CAT_MEDIUM_HARD_WITH_INFO 18	/* medium or hardware error sense key plus 'info' field */
-#define SG_LIB_CAT_ILLEGAL_REQ 5	/* Illegal request (not invalid opcode) */
-#define SG_LIB_CAT_UNIT_ATTENTION 6	/* interpreted from sense buffer */
-#define SG_LIB_CAT_INVALID_OP 9		/* (Illegal request,) Invalid opcode */
-#define SG_LIB_CAT_ABORTED_COMMAND 11	/* interpreted from sense buffer */
-#define SG_LIB_FILE_ERROR 15
-#define SG_LIB_CAT_NO_SENSE 20		/* sense data with key of "no sense" */
-#define SG_LIB_CAT_RECOVERED 21	/* Successful command after recovered err */
-#define SG_LIB_CAT_SENSE 98	/* Something else is in the sense buffer */
-#define SG_LIB_CAT_OTHER 99	/* Some other error/warning has occurred */
-
 #define SENSE_BUFF_LEN 32       /* Arbitrary, could be larger */
 #define DEF_PT_TIMEOUT 60       /* 60 seconds */
 #define DEF_TIMEOUT 60000       /* 60,000 millisecs (60 seconds) */
@@ -67,6 +48,21 @@
 #define VERIFY10_CMD 0x2f
 #define VERIFY10_CMDLEN 10
 
+#define SAT_ATA_PASS_THROUGH16 0x85
+#define SAT_ATA_PASS_THROUGH16_LEN 16
+#define SAT_ATA_RETURN_DESC 9	/* ATA Status Return sense data descriptor */
+#define ATA_READ_VERIFY_SECTORS_EXT 0x42
+#define ATA_PT_NON_DATA 3	/* Protocol field: non-data */
+#define ATA_ERR_UNC 0x40	/* Error register: uncorrectable data */
+#define ATA_ERR_IDNF 0x10	/* Error register: ID not found */
+
+#define SERVICE_ACTION_IN_16 0x9e
+#define GET_LBA_STATUS_SA 0x12
+#define GET_LBA_STATUS_CMDLEN 16
+
+#define REASSIGN_BLKS_CMD 0x07
+#define REASSIGN_BLKS_CMDLEN 6
+
 #define SG_LIB_DRIVER_MASK	0x0f
 #define SG_LIB_DRIVER_SENSE	0x08
 
@@ -418,6 +414,32 @@ static int sg_get_sense_info_fld(const unsigned char * sensep, int sb_len,
 	}
 }
 
+/* Extracts the LBA of the first failing sector from the ATA registers in
+ * the ATA Status Return descriptor of (descriptor format) sense data. Only
+ * valid for uncorrectable or ID-not-found errors. Returns 1 if found. */
+static int sg_get_ata_lba(const unsigned char * sensep, int sb_len,
+	uint64_t * lba_outp)
+{
+	const unsigned char * ucp;
+	uint64_t ull;
+
+	ucp = sg_scsi_sense_desc_find(sensep, sb_len, SAT_ATA_RETURN_DESC);
+	if (!ucp || (ucp[1] < 0xc) || !(ucp[3] & (ATA_ERR_UNC | ATA_ERR_IDNF)))
+		return 0;
+
+	/* LBA (23:0) is laid out as 7:0 in byte 7, 15:8 in 9, 23:16 in 11 */
+	ull = ((uint64_t) ucp[11] << 16) | (ucp[9] << 8) | ucp[7];
+	if (ucp[2] & 0x1)	/* extend: 48-bit registers are valid */
+		ull |= ((uint64_t) ucp[10] << 40) | ((uint64_t) ucp[8] << 32) |
+			((uint64_t) ucp[6] << 24);
+	else
+		ull |= (uint64_t) (ucp[12] & 0xf) << 24;
+
+	if (lba_outp)
+		*lba_outp = ull;
+	return 1;
+}
+
 static void destruct_scsi_pt_obj(struct sg_pt_scsi * ptp)
 {
 	if (ptp)
@@ -433,7 +455,7 @@ static void destruct_scsi_pt_obj(struct sg_pt_scsi * ptp)
  * SG_LIB_CAT_NOT_READY -> device not ready, SG_LIB_CAT_ABORTED_COMMAND,
  * -1 -> other failure */
 static int sg_ll_verify10(struct gendisk *disk, int vrprotect, int dpo,
-	int bytechk, uint64_t lba, int veri_len, unsigned int * infop,
+	int bytechk, uint64_t lba, int veri_len, struct scrub_sense * sensep,
 	int verbose)
 {
 	int k, res, ret, sense_cat;
@@ -481,6 +503,15 @@ static int sg_ll_verify10(struct gendisk *disk, int vrprotect, int dpo,
 			printk(KERN_INFO "SCSIVerify (%s): verify (10): return code -2\n",
 				disk->disk_name);
 
+		if (sensep) {
+			struct sg_scsi_sense_hdr ssh;
+
+			sg_scsi_normalize_sense(sense_b, ptp->io_hdr.sb_len_wr, &ssh);
+			sensep->key = ssh.sense_key;
+			sensep->asc = ssh.asc;
+			sensep->ascq = ssh.ascq;
+		}
+
 		switch (sense_cat) {
 			case SG_LIB_CAT_NOT_READY:
 			case SG_LIB_CAT_INVALID_OP:
@@ -490,6 +521,12 @@ static int sg_ll_verify10(struct gendisk *disk, int vrprotect, int dpo,
 				ret = sense_cat;
 				break;
 			case SG_LIB_CAT_RECOVERED:
+				/* Passed, but tell where the drive had to recover */
+				if (sensep && !sg_get_sense_info_fld(sense_b,
+						ptp->io_hdr.sb_len_wr, &sensep->info))
+					sensep->info = lba;
+				ret = 0;
+				break;
 			case SG_LIB_CAT_NO_SENSE:
 				ret = 0;
 				break;
@@ -501,8 +538,8 @@ static int sg_ll_verify10(struct gendisk *disk, int vrprotect, int dpo,
 				slen = ptp->io_hdr.sb_len_wr;
 				valid = sg_get_sense_info_fld(sense_b, slen, &ull);
 				if (valid) {
-					if (infop)
-						*infop = (unsigned int)ull;
+					if (sensep)
+						sensep->info = ull;
 					ret = SG_LIB_CAT_MEDIUM_HARD_WITH_INFO;
 				} else
 					ret = SG_LIB_CAT_MEDIUM_HARD;
@@ -523,15 +560,384 @@ static int sg_ll_verify10(struct gendisk *disk, int vrprotect, int dpo,
 	return ret;
 }
 
-int scsi_verify(struct gendisk *disk, uint64_t lba, unsigned int count)
+/* Invokes ATA READ VERIFY SECTORS EXT through a SCSI ATA PASS-THROUGH (16)
+ * command (SAT). Note that 'veri_len' is in blocks, up to 65536. This avoids
+ * the translation of VERIFY (10) by the SATL, and the LBA of a medium error
+ * is taken straight from the ATA registers. Return values are as for
+ * sg_ll_verify10(); SG_LIB_CAT_INVALID_OP means there is no SATL. */
+static int sg_ll_ata_verify16(struct gendisk *disk, uint64_t lba,
+	unsigned int veri_len, struct scrub_sense * sensep, int verbose)
+{
+	int k, res, ret, sense_cat;
+	unsigned char aCmdBlk[SAT_ATA_PASS_THROUGH16_LEN] =
+		{SAT_ATA_PASS_THROUGH16, 0, 0, 0, 0, 0, 0, 0,
+		 0, 0, 0, 0, 0, 0, 0, 0};
+	unsigned char sense_b[SENSE_BUFF_LEN];
+	struct sg_pt_scsi * ptp;
+
+	if (0 == veri_len || veri_len > 65536)
+		return SG_LIB_CAT_ILLEGAL_REQ;
+
+	aCmdBlk[1] = (ATA_PT_NON_DATA << 1) | 0x1;	/* extend */
+	aCmdBlk[5] = (unsigned char)((veri_len >> 8) & 0xff);
+	aCmdBlk[6] = (unsigned char)(veri_len & 0xff);
+	aCmdBlk[7] = (unsigned char)((lba >> 24) & 0xff);
+	aCmdBlk[8] = (unsigned char)(lba & 0xff);
+	aCmdBlk[9] = (unsigned char)((lba >> 32) & 0xff);
+	aCmdBlk[10] = (unsigned char)((lba >> 8) & 0xff);
+	aCmdBlk[11] = (unsigned char)((lba >> 40) & 0xff);
+	aCmdBlk[12] = (unsigned char)((lba >> 16) & 0xff);
+	aCmdBlk[13] = 0x40;	/* LBA mode */
+	aCmdBlk[14] = ATA_READ_VERIFY_SECTORS_EXT;
+
+	if (verbose > 3) {
+		printk(KERN_INFO "SCSIVerify (%s):    ATA pass-through(16) cdb: \n",
+			disk->disk_name);
+		for (k = 0; k < SAT_ATA_PASS_THROUGH16_LEN; ++k)
+			printk(KERN_INFO "SCSIVerify (%s):         %02x \n", disk->disk_name,
+				aCmdBlk[k]);
+	}
+
+	ptp = construct_scsi_pt_obj();
+	if (NULL == ptp) {
+		if (verbose > 1)
+			printk(KERN_INFO "SCSIVerify (%s): ATA pass-through(16): out of "
+				"memory\n", disk->disk_name);
+		return -1;
+	}
+
+	set_scsi_pt_cdb(ptp, aCmdBlk, sizeof(aCmdBlk));
+	set_scsi_pt_sense(ptp, sense_b, sizeof(sense_b));
+	res = do_scsi_pt(ptp, disk, DEF_PT_TIMEOUT, verbose);
+	ret = sg_cmds_process_resp(disk, ptp, "ATA pass-through (16)", res,
+		sense_b, verbose, &sense_cat);
+
+	if (-2 == ret) {
+		if (sensep) {
+			struct sg_scsi_sense_hdr ssh;
+
+			sg_scsi_normalize_sense(sense_b, ptp->io_hdr.sb_len_wr, &ssh);
+			sensep->key = ssh.sense_key;
+			sensep->asc = ssh.asc;
+			sensep->ascq = ssh.ascq;
+		}
+
+		switch (sense_cat) {
+			case SG_LIB_CAT_NOT_READY:
+			case SG_LIB_CAT_INVALID_OP:
+			case SG_LIB_CAT_ILLEGAL_REQ:
+			case SG_LIB_CAT_UNIT_ATTENTION:
+			case SG_LIB_CAT_ABORTED_COMMAND:
+				ret = sense_cat;
+				break;
+			case SG_LIB_CAT_RECOVERED:
+				if (sensep && !sg_get_sense_info_fld(sense_b,
+						ptp->io_hdr.sb_len_wr, &sensep->info))
+					sensep->info = lba;
+				ret = 0;
+				break;
+			case SG_LIB_CAT_NO_SENSE:
+				ret = 0;
+				break;
+			case SG_LIB_CAT_MEDIUM_HARD:
+			{
+				int slen;
+				uint64_t ull = 0;
+
+				slen = ptp->io_hdr.sb_len_wr;
+				if (sg_get_ata_lba(sense_b, slen, &ull) ||
+				    sg_get_sense_info_fld(sense_b, slen, &ull)) {
+					if (sensep)
+						sensep->info = ull;
+					ret = SG_LIB_CAT_MEDIUM_HARD_WITH_INFO;
+				} else
+					ret = SG_LIB_CAT_MEDIUM_HARD;
+			}
+				break;
+			default:
+				ret = -1;
+				break;
+		}
+	} else if (0 != ret)
+		ret = -1;
+
+	if (verbose > 2)
+		printk(KERN_INFO "SCSIVerify (%s): ATA pass-through (16): return "
+			"code %d\n", disk->disk_name, ret);
+
+	destruct_scsi_pt_obj(ptp);
+	return ret;
+}
+
+/* Invokes a SCSI GET LBA STATUS command (SBC-3). The response, of at most
+ * 'alloc_len' bytes, is placed in 'resp'. Return values are as for
+ * sg_ll_verify10(), without the medium error categories. */
+static int sg_ll_get_lba_status(struct gendisk *disk, uint64_t start_llba,
+	void * resp, int alloc_len, int verbose)
+{
+	int k, res, ret, sense_cat;
+	unsigned char getLbaStatCmd[GET_LBA_STATUS_CMDLEN];
+	unsigned char sense_b[SENSE_BUFF_LEN];
+	struct sg_pt_scsi * ptp;
+
+	memset(getLbaStatCmd, 0, sizeof(getLbaStatCmd));
+	getLbaStatCmd[0] = SERVICE_ACTION_IN_16;
+	getLbaStatCmd[1] = GET_LBA_STATUS_SA;
+	for (k = 0; k < 8; ++k)
+		getLbaStatCmd[2 + k] = (start_llba >> (56 - 8 * k)) & 0xff;
+	getLbaStatCmd[10] = (unsigned char)((alloc_len >> 24) & 0xff);
+	getLbaStatCmd[11] = (unsigned char)((alloc_len >> 16) & 0xff);
+	getLbaStatCmd[12] = (unsigned char)((alloc_len >> 8) & 0xff);
+	getLbaStatCmd[13] = (unsigned char)(alloc_len & 0xff);
+
+	if (verbose > 3) {
+		printk(KERN_INFO "SCSIVerify (%s):    Get LBA status cdb: \n",
+			disk->disk_name);
+		for (k = 0; k < GET_LBA_STATUS_CMDLEN; ++k)
+			printk(KERN_INFO "SCSIVerify (%s):         %02x \n",
+				disk->disk_name, getLbaStatCmd[k]);
+	}
+
+	ptp = construct_scsi_pt_obj();
+	if (NULL == ptp) {
+		if (verbose > 1)
+			printk(KERN_INFO "SCSIVerify (%s): get LBA status: out of "
+				"memory\n", disk->disk_name);
+		return -1;
+	}
+
+	set_scsi_pt_cdb(ptp, getLbaStatCmd, sizeof(getLbaStatCmd));
+	set_scsi_pt_sense(ptp, sense_b, sizeof(sense_b));
+	ptp->io_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+	ptp->io_hdr.dxferp = resp;
+	ptp->io_hdr.dxfer_len = alloc_len;
+	res = do_scsi_pt(ptp, disk, DEF_PT_TIMEOUT, verbose);
+	ret = sg_cmds_process_resp(disk, ptp, "get LBA status", res, sense_b,
+		verbose, &sense_cat);
+
+	if (-2 == ret) {
+		switch (sense_cat) {
+			case SG_LIB_CAT_NOT_READY:
+			case SG_LIB_CAT_INVALID_OP:
+			case SG_LIB_CAT_ILLEGAL_REQ:
+			case SG_LIB_CAT_UNIT_ATTENTION:
+			case SG_LIB_CAT_ABORTED_COMMAND:
+				ret = sense_cat;
+				break;
+			case SG_LIB_CAT_RECOVERED:
+			case SG_LIB_CAT_NO_SENSE:
+				ret = 0;
+				break;
+			default:
+				ret = -1;
+				break;
+		}
+	} else if (0 != ret)
+		ret = -1;
+
+	if (verbose > 2)
+		printk(KERN_INFO "SCSIVerify (%s): get LBA status: return code "
+			"%d\n", disk->disk_name, ret);
+
+	destruct_scsi_pt_obj(ptp);
+	return ret;
+}
+
+/*
+ * The scrubber addresses the disk in 512 byte sectors, like the rest of
+ * the block layer, while commands address it in logical blocks, which are
+ * 4096 bytes on 4Kn drives. Sectors are converted to logical blocks (and
+ * reported LBAs back to sectors) right here, when commands are built.
+ * Ranges that don't fall on block boundaries are widened to the blocks
+ * they touch.
+ */
+
+/* Returns the number of sectors per logical block of the disk */
+unsigned int scrub_block_sectors(struct gendisk *disk)
+{
+	return queue_logical_block_size(disk->queue) >> 9;
+}
+
+/* Returns the logical block of sector, and the number of logical blocks
+ * count sectors from there touch in blocks */
+static uint64_t scrub_to_blocks(struct gendisk *disk, uint64_t sector,
+	unsigned int count, unsigned int *blocks)
+{
+	unsigned int shift = ilog2(scrub_block_sectors(disk));
+	uint64_t end = sector + count + (1 << shift) - 1;
+
+	*blocks = (unsigned int) ((end >> shift) - (sector >> shift));
+	return sector >> shift;
+}
+
+/* Fetches the provisioning status of the logical blocks starting from the
+ * one holding sector into resp (parameter data of GET LBA STATUS, in
+ * logical blocks). Returns 0 on success, or the SG_LIB_CAT_* of the
+ * failure. */
+int scsi_get_lba_status(struct gendisk *disk, uint64_t sector, void *resp,
+	int alloc_len)
+{
+	struct disk_scrubber *s = disk->scrubber;
+	unsigned int blocks;
+	int res;
+
+	res = sg_ll_get_lba_status(disk,
+		scrub_to_blocks(disk, sector, 1, &blocks), resp, alloc_len,
+		s->verbose);
+	return (res >= 0) ? res : SG_LIB_CAT_OTHER;
+}
+
+static int sg_ll_reassign_blocks(struct gendisk *disk, int longlba,
+	int longlist, void * paramp, int param_len, int verbose)
+{
+	int k, res, ret, sense_cat;
+	unsigned char reassCmdBlk[REASSIGN_BLKS_CMDLEN] =
+		{REASSIGN_BLKS_CMD, 0, 0, 0, 0, 0};
+	unsigned char sense_b[SENSE_BUFF_LEN];
+	struct sg_pt_scsi * ptp;
+
+	reassCmdBlk[1] = (unsigned char)(((longlba << 1) & 0x2) |
+		(longlist & 0x1));
+
+	if (verbose > 3) {
+		printk(KERN_INFO "SCSIVerify (%s):    reassign blocks cdb: \n",
+			disk->disk_name);
+		for (k = 0; k < REASSIGN_BLKS_CMDLEN; ++k)
+			printk(KERN_INFO "SCSIVerify (%s):         %02x \n",
+				disk->disk_name, reassCmdBlk[k]);
+	}
+
+	ptp = construct_scsi_pt_obj();
+	if (NULL == ptp) {
+		if (verbose > 1)
+			printk(KERN_INFO "SCSIVerify (%s): reassign blocks: out of "
+				"memory\n", disk->disk_name);
+		return -1;
+	}
+
+	set_scsi_pt_cdb(ptp, reassCmdBlk, sizeof(reassCmdBlk));
+	set_scsi_pt_sense(ptp, sense_b, sizeof(sense_b));
+	ptp->io_hdr.dxfer_direction = SG_DXFER_TO_DEV;
+	ptp->io_hdr.dxferp = paramp;
+	ptp->io_hdr.dxfer_len = param_len;
+	res = do_scsi_pt(ptp, disk, DEF_PT_TIMEOUT, verbose);
+	ret = sg_cmds_process_resp(disk, ptp, "reassign blocks", res, sense_b,
+		verbose, &sense_cat);
+
+	if (-2 == ret) {
+		switch (sense_cat) {
+			case SG_LIB_CAT_NOT_READY:
+			case SG_LIB_CAT_INVALID_OP:
+			case SG_LIB_CAT_ILLEGAL_REQ:
+			case SG_LIB_CAT_UNIT_ATTENTION:
+			case SG_LIB_CAT_ABORTED_COMMAND:
+				ret = sense_cat;
+				break;
+			case SG_LIB_CAT_RECOVERED:
+			case SG_LIB_CAT_NO_SENSE:
+				ret = 0;
+				break;
+			default:
+				ret = -1;
+				break;
+		}
+	} else if (0 != ret)
+		ret = -1;
+
+	if (verbose > 2)
+		printk(KERN_INFO "SCSIVerify (%s): reassign blocks: return code "
+			"%d\n", disk->disk_name, ret);
+
+	destruct_scsi_pt_obj(ptp);
+	return ret;
+}
+
+/* Has the drive move count sectors starting from sector to spare blocks,
+ * keeping their data. The blocks are listed one by one, with 8-byte LBAs.
+ * Returns 0 on success, or the SG_LIB_CAT_* of the failure. */
+int scsi_reassign_blocks(struct gendisk *disk, uint64_t sector,
+	unsigned int count)
+{
+	struct disk_scrubber *s = disk->scrubber;
+	unsigned char *param;
+	uint64_t lba;
+	int i, k, len, res;
+
+	lba = scrub_to_blocks(disk, sector, count, &count);
+	len = 4 + 8 * count;
+	param = kzalloc(len, GFP_KERNEL);
+	if (!param)
+		return SG_LIB_CAT_OTHER;
+
+	/* Header: defect list length, then the LBAs */
+	param[2] = ((len - 4) >> 8) & 0xff;
+	param[3] = (len - 4) & 0xff;
+	for (i = 0; i < count; ++i)
+		for (k = 0; k < 8; ++k)
+			param[4 + 8 * i + k] = ((lba + i) >> (56 - 8 * k)) & 0xff;
+
+	res = sg_ll_reassign_blocks(disk, 1, 0, param, len, s->verbose);
+	kfree(param);
+	return (res >= 0) ? res : SG_LIB_CAT_OTHER;
+}
+
+/* Returns whether verifications should go through ATA pass-through. In
+ * auto mode, the first verification probes for a SATL with a one sector
+ * READ VERIFY SECTORS EXT, and falls back to VERIFY (10) if the command
+ * is rejected. */
+static int scrub_use_ata(struct gendisk *disk)
+{
+	struct disk_scrubber *s = disk->scrubber;
+	int res;
+
+	switch (s->vcmd) {
+		case SCRUB_VCMD_VERIFY10:
+			return 0;
+		case SCRUB_VCMD_ATA16:
+			return 1;
+	}
+
+	if (s->ata_pt < 0) {
+		res = sg_ll_ata_verify16(disk, 0, 1, NULL, s->verbose);
+		/* A medium error still means the command got through */
+		s->ata_pt = (res == 0 || res == SG_LIB_CAT_MEDIUM_HARD ||
+			res == SG_LIB_CAT_MEDIUM_HARD_WITH_INFO);
+		if (s->verbose)
+			printk(KERN_INFO "scrubber (%s): using %s\n", disk->disk_name,
+				s->ata_pt ? "ATA pass-through (16)" : "Verify(10)");
+	}
+
+	return s->ata_pt;
+}
+
+/* Verifies count sectors starting from sector. The sense data of a failed
+ * verification is returned in sense, along with the (first) sector of the
+ * logical block a medium error occurred at, if the drive reported it. */
+int scsi_verify(struct gendisk *disk, uint64_t sector, unsigned int count,
+	struct scrub_sense *sense)
 {
 	struct disk_scrubber *s = disk->scrubber;
 	int res = 0;
 	int bytechk = 0;
-	unsigned int info = 0;
+	struct scrub_sense ss;
+	uint64_t lba, ull;
 
-	res = sg_ll_verify10(disk, s->vrprotect, s->dpo, bytechk,
-				lba, count, &info, s->verbose);
+	lba = scrub_to_blocks(disk, sector, count, &count);
+	memset(&ss, 0, sizeof(ss));
+	if (scrub_use_ata(disk))
+		res = sg_ll_ata_verify16(disk, lba, count, &ss, s->verbose);
+	else
+		res = sg_ll_verify10(disk, s->vrprotect, s->dpo, bytechk,
+					lba, count, &ss, s->verbose);
+	ull = ss.info;
+	ss.info *= scrub_block_sectors(disk);
+	if (sense)
+		*sense = ss;
+
+	/* A recovered error is a success, but a sign of degrading media */
+	if (0 == res && SPC_SK_RECOVERED_ERROR == ss.key)
+		blk_scrub_recovered(disk, ss.info, ss.asc, ss.ascq,
+			BLK_SCRUB_SRC_SCRUB);
 
 	if (0 != res) {
 		switch (res) {
@@ -561,7 +967,7 @@ int scsi_verify(struct gendisk *disk, uint64_t lba, unsigned int count)
 				break;
 			case SG_LIB_CAT_MEDIUM_HARD_WITH_INFO:
 				printk(KERN_INFO "SCSIVerify (%s): medium or hardware error, reported"
-						" lba=0x%u\n", disk->disk_name, info);
+						" lba=%llu\n", disk->disk_name, ull);
 				break;
 			default:
 				printk(KERN_INFO "SCSIVerify (%s): Verify(10) failed near lba=%llu "
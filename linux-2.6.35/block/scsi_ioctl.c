@@ -414,6 +414,10 @@ static void sg_kern_complete_rq(struct request *rq, int error)
 {
 	struct completion *waiting = rq->end_io_data;
 
+	/* Drivers that fail BLOCK_PC requests without a SCSI status (e.g.
+	 * nbd) must not look like a successful verification */
+	if (error && !rq->errors)
+		rq->errors = DID_ERROR << 16;
 	rq->end_io_data = NULL;
 	__blk_put_request(rq->q, rq);
 
@@ -429,6 +433,7 @@ static int sg_kern_io(struct request_queue *q, struct gendisk *bd_disk,
 {
 	unsigned long start_time;
 	int writing = 0, ret = 0;
+	unsigned int shift;
 	struct request *rq;
 	char sense[SCSI_SENSE_BUFFERSIZE];
 	unsigned char *vCmdBlk;
@@ -464,24 +469,30 @@ static int sg_kern_io(struct request_queue *q, struct gendisk *bd_disk,
 		return -EFAULT;
 	}
 
-	if (hdr->iovec_count) {
-		ret = blk_rq_map_user_iov(q, rq, NULL, hdr->dxferp,
-			hdr->iovec_count, hdr->dxfer_len, GFP_KERNEL);
-	} else if (hdr->dxfer_len) {
-		ret = blk_rq_map_user(q, rq, NULL, hdr->dxferp,
-			hdr->dxfer_len, GFP_KERNEL);
-	}
-
-	if (ret)
-		goto out;
-
-	bio = rq->bio;
-	rq->bio = NULL;
 	memset(sense, 0, sizeof(sense));
 	rq->sense = sense;
 	rq->sense_len = 0;
 	rq->retries = 0;
 
+	/* Commands that transfer data (e.g. GET LBA STATUS) take the regular
+	 * path, with a kernel buffer */
+	if (hdr->dxfer_len) {
+		ret = blk_rq_map_kern(q, rq, hdr->dxferp, hdr->dxfer_len,
+			GFP_KERNEL);
+		if (ret)
+			goto out;
+
+		start_time = jiffies;
+		blk_execute_rq(q, bd_disk, rq, 0);
+		hdr->duration = jiffies_to_msecs(jiffies - start_time);
+
+		/* Kernel mapped bios are released on completion */
+		return blk_complete_sghdr_rq(rq, hdr, NULL);
+	}
+
+	bio = rq->bio;
+	rq->bio = NULL;
+
 	start_time = jiffies;
 
 	/* ignore return value. All information is passed back to caller
@@ -506,16 +517,38 @@ static int sg_kern_io(struct request_queue *q, struct gendisk *bd_disk,
 		bio_get(bio);
 	}
 
+	/* The CDB addresses logical blocks, which may be larger than the
+	 * 512-byte sectors of the bio and request */
+	shift = ilog2(queue_logical_block_size(q) >> 9);
+
 	vCmdBlk = hdr->cmdp;
-	if (vCmdBlk != NULL) {
+	if (vCmdBlk != NULL && vCmdBlk[0] == ATA_16) {
+		/* READ VERIFY SECTORS EXT through ATA PASS-THROUGH(16) */
+		bio->bi_sector = ((sector_t) vCmdBlk[11] << 40) |
+				 ((sector_t) vCmdBlk[9]  << 32) |
+				 ((sector_t) vCmdBlk[7]  << 24) |
+				 (vCmdBlk[12] << 16 & 0x00ff0000) |
+				 (vCmdBlk[10] <<  8 & 0x0000ff00) |
+				 (vCmdBlk[8]        & 0x000000ff);
+		bio->bi_sector <<= shift;
+		rq->__sector = bio->bi_sector;
+
+		/* A count of 0 stands for 65536 blocks */
+		bio->bi_size = ((vCmdBlk[5] << 8 & 0x0000ff00) |
+				(vCmdBlk[6]      & 0x000000ff)) << (9 + shift);
+		if (!bio->bi_size)
+			bio->bi_size = 65536 << (9 + shift);
+		rq->__data_len = bio->bi_size;
+	} else if (vCmdBlk != NULL) {
 		bio->bi_sector = (vCmdBlk[2] << 24 & 0xff000000) |
 				 (vCmdBlk[3] << 16 & 0x00ff0000) |
 				 (vCmdBlk[4] <<  8 & 0x0000ff00) |
 				 (vCmdBlk[5]       & 0x000000ff);
+		bio->bi_sector <<= shift;
 		rq->__sector = bio->bi_sector;
 
 		bio->bi_size = ((vCmdBlk[7] << 8 & 0x0000ff00) |
-				(vCmdBlk[8]      & 0x000000ff)) << 9;
+				(vCmdBlk[8]      & 0x000000ff)) << (9 + shift);
 		rq->__data_len = bio->bi_size;
 		/* printk(KERN_INFO "scrubber: Attention! Sector = %lu, Data length = %u",
 			rq->__sector, rq->__data_len); */
@@ -50,6 +50,7 @@
 #include <linux/raid/md_p.h>
 #include <linux/raid/md_u.h>
 #include <linux/slab.h>
+#include <linux/scrub.h>
 #include "md.h"
 #include "bitmap.h"
 
@@ -3668,6 +3669,98 @@ metadata_store(mddev_t *mddev, const char *buf, size_t len)
 static struct md_sysfs_entry md_metadata =
 __ATTR(metadata_version, S_IRUGO|S_IWUSR, metadata_show, metadata_store);
 
+#ifdef CONFIG_BLK_DEV_SCRUB
+/*
+ * 'verify' checks an array for latent sector errors with the scrubbers of
+ * its members, rather than by reading and comparing their data, so that it
+ * costs no bus bandwidth or CPU. The members are verified in parallel, one
+ * window at a time. The bad sectors they find are rewritten from redundancy
+ * through the scrub notifier, which is the only time data is read, and
+ * counted in mismatch_cnt. The jobs are queued as urgent, as the scrubbers
+ * serve only those outside their time windows.
+ */
+#define MD_VERIFY_WINDOW	(16*1024) /* sectors per member */
+
+struct md_verify {
+	atomic_t		remaining;
+	atomic_t		bad_sectors;
+	struct completion	done;
+};
+
+static void md_verify_end_io(struct scrub_job *job)
+{
+	struct md_verify *v = job->private;
+
+	if (job->bad_sectors)
+		atomic_add(job->bad_sectors, &v->bad_sectors);
+	if (atomic_dec_and_test(&v->remaining))
+		complete(&v->done);
+}
+
+static int md_verify_supported(mddev_t *mddev)
+{
+	mdk_rdev_t *rdev;
+	int members = 0;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(rdev, &mddev->disks, same_set) {
+		if (rdev->raid_disk < 0 || test_bit(Faulty, &rdev->flags))
+			continue;
+		if (!rdev->bdev->bd_disk->scrubber) {
+			rcu_read_unlock();
+			return 0;
+		}
+		members++;
+	}
+	rcu_read_unlock();
+	return members;
+}
+
+/* Verifies the next window of all in-sync members, starting at member
+ * sector j. Returns the number of sectors verified, or 0 on failure.
+ */
+static sector_t md_verify_window(mddev_t *mddev, sector_t j,
+				 sector_t max_sectors)
+{
+	struct md_verify v;
+	mdk_rdev_t *rdev;
+	sector_t sectors = min_t(sector_t, MD_VERIFY_WINDOW, max_sectors - j);
+	int members = 0;
+
+	atomic_set(&v.remaining, 1);
+	atomic_set(&v.bad_sectors, 0);
+	init_completion(&v.done);
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(rdev, &mddev->disks, same_set) {
+		if (rdev->raid_disk < 0 ||
+		    test_bit(Faulty, &rdev->flags) ||
+		    !test_bit(In_sync, &rdev->flags))
+			continue;
+		atomic_inc(&v.remaining);
+		if (blk_scrub_range(rdev->bdev->bd_disk,
+				    get_start_sect(rdev->bdev) +
+				    rdev->data_offset + j, sectors,
+				    BLK_SCRUB_PRIO_HIGH, md_verify_end_io, &v,
+				    GFP_ATOMIC)) {
+			atomic_dec(&v.remaining);
+			continue;
+		}
+		members++;
+	}
+	rcu_read_unlock();
+
+	/* Jobs reference v, so wait for them even if asked to stop */
+	if (!atomic_dec_and_test(&v.remaining))
+		wait_for_completion(&v.done);
+
+	if (!members)
+		return 0;
+	mddev->resync_mismatches += atomic_read(&v.bad_sectors);
+	return sectors;
+}
+#endif /* CONFIG_BLK_DEV_SCRUB */
+
 static ssize_t
 action_show(mddev_t *mddev, char *page)
 {
@@ -3681,6 +3774,8 @@ action_show(mddev_t *mddev, char *page)
 		else if (test_bit(MD_RECOVERY_SYNC, &mddev->recovery)) {
 			if (!test_bit(MD_RECOVERY_REQUESTED, &mddev->recovery))
 				type = "resync";
+			else if (test_bit(MD_RECOVERY_VERIFY, &mddev->recovery))
+				type = "verify";
 			else if (test_bit(MD_RECOVERY_CHECK, &mddev->recovery))
 				type = "check";
 			else
@@ -3728,6 +3823,14 @@ action_store(mddev_t *mddev, const char *page, size_t len)
 	} else {
 		if (cmd_match(page, "check"))
 			set_bit(MD_RECOVERY_CHECK, &mddev->recovery);
+#ifdef CONFIG_BLK_DEV_SCRUB
+		else if (cmd_match(page, "verify")) {
+			if (!md_verify_supported(mddev))
+				return -EOPNOTSUPP;
+			set_bit(MD_RECOVERY_VERIFY, &mddev->recovery);
+			set_bit(MD_RECOVERY_CHECK, &mddev->recovery);
+		}
+#endif
 		else if (!cmd_match(page, "repair"))
 			return -EINVAL;
 		set_bit(MD_RECOVERY_REQUESTED, &mddev->recovery);
@@ -6598,7 +6701,9 @@ void md_do_sync(mddev_t *mddev)
 		return;
 
 	if (test_bit(MD_RECOVERY_SYNC, &mddev->recovery)) {
-		if (test_bit(MD_RECOVERY_CHECK, &mddev->recovery))
+		if (test_bit(MD_RECOVERY_VERIFY, &mddev->recovery))
+			desc = "data-verify";
+		else if (test_bit(MD_RECOVERY_CHECK, &mddev->recovery))
 			desc = "data-check";
 		else if (test_bit(MD_RECOVERY_REQUESTED, &mddev->recovery))
 			desc = "requested-resync";
@@ -6680,6 +6785,9 @@ void md_do_sync(mddev_t *mddev)
 		 * which defaults to physical size, but can be virtual size
 		 */
 		max_sectors = mddev->resync_max_sectors;
+		/* verify works on the members, whatever the layout */
+		if (test_bit(MD_RECOVERY_VERIFY, &mddev->recovery))
+			max_sectors = mddev->dev_sectors;
 		mddev->resync_mismatches = 0;
 		/* we don't use the checkpoint if there's a bitmap */
 		if (test_bit(MD_RECOVERY_REQUESTED, &mddev->recovery))
@@ -6775,6 +6883,11 @@ void md_do_sync(mddev_t *mddev)
 		if (kthread_should_stop())
 			goto interrupted;
 
+#ifdef CONFIG_BLK_DEV_SCRUB
+		if (test_bit(MD_RECOVERY_VERIFY, &mddev->recovery))
+			sectors = md_verify_window(mddev, j, max_sectors);
+		else
+#endif
 		sectors = mddev->pers->sync_request(mddev, j, &skipped,
 						  currspeed < speed_min(mddev));
 		if (sectors == 0) {
@@ -6784,7 +6897,9 @@ void md_do_sync(mddev_t *mddev)
 
 		if (!skipped) { /* actual IO requested */
 			io_sectors += sectors;
-			atomic_add(sectors, &mddev->recovery_active);
+			/* verify windows are complete when we get here */
+			if (!test_bit(MD_RECOVERY_VERIFY, &mddev->recovery))
+				atomic_add(sectors, &mddev->recovery_active);
 		}
 
 		j += sectors;
@@ -6853,7 +6968,8 @@ void md_do_sync(mddev_t *mddev)
 	wait_event(mddev->recovery_wait, !atomic_read(&mddev->recovery_active));
 
 	/* tell personality that we are finished */
-	mddev->pers->sync_request(mddev, max_sectors, &skipped, 1);
+	if (!test_bit(MD_RECOVERY_VERIFY, &mddev->recovery))
+		mddev->pers->sync_request(mddev, max_sectors, &skipped, 1);
 
 	if (!test_bit(MD_RECOVERY_CHECK, &mddev->recovery) &&
 	    mddev->curr_resync > 2) {
@@ -7119,6 +7235,7 @@ void md_check_recovery(mddev_t *mddev)
 		} else if ((spares = remove_and_add_spares(mddev))) {
 			clear_bit(MD_RECOVERY_SYNC, &mddev->recovery);
 			clear_bit(MD_RECOVERY_CHECK, &mddev->recovery);
+			clear_bit(MD_RECOVERY_VERIFY, &mddev->recovery);
 			clear_bit(MD_RECOVERY_REQUESTED, &mddev->recovery);
 			set_bit(MD_RECOVERY_RECOVER, &mddev->recovery);
 		} else if (mddev->recovery_cp < MaxSector) {
@@ -7208,6 +7325,173 @@ static struct notifier_block md_notifier = {
 	.priority	= INT_MAX, /* before any real devices */
 };
 
+#ifdef CONFIG_BLK_DEV_SCRUB
+/*
+ * Bad sectors found by the block layer scrubber on a member device are
+ * handed to the personality, which rewrites them from redundancy so that
+ * the drive can remap them, rather than waiting for a check/repair pass
+ * or a normal read to trip over them. The scrubber also asks for the
+ * metadata areas (superblock, internal bitmap) on member devices, which
+ * it scrubs more often than data.
+ */
+#define MD_SCRUB_LOCK_TRIES	50
+
+/* A verify pass may be stopped with the mddev locked while it waits for
+ * the scrubber, so the scrubber doesn't wait for the lock for long. */
+static int md_scrub_lock(mddev_t *mddev)
+{
+	int tries;
+
+	for (tries = 0; !mddev_trylock(mddev); tries++) {
+		if (tries == MD_SCRUB_LOCK_TRIES)
+			return -EBUSY;
+		msleep(100);
+	}
+	return 0;
+}
+
+/* Bad sectors are rewritten by md_scrub_work, which may wait for the lock
+ * as long as it takes, rather than by the scrubber itself. */
+struct md_scrub_bad {
+	struct list_head	list;
+	dev_t			disk;
+	sector_t		sector;	/* relative to the disk */
+	sector_t		len;
+};
+
+static LIST_HEAD(md_scrub_bad_list);
+static DEFINE_SPINLOCK(md_scrub_bad_lock);
+
+static void md_scrub_fix(mddev_t *mddev, struct md_scrub_bad *bad)
+{
+	mdk_rdev_t *rdev, *rtmp;
+
+	rdev_for_each(rdev, rtmp, mddev) {
+		char b[BDEVNAME_SIZE];
+		sector_t start, sector;
+
+		if (disk_devt(rdev->bdev->bd_disk) != bad->disk ||
+		    rdev->raid_disk < 0 ||
+		    test_bit(Faulty, &rdev->flags) ||
+		    !test_bit(In_sync, &rdev->flags))
+			continue;
+		start = get_start_sect(rdev->bdev) + rdev->data_offset;
+		if (bad->sector < start ||
+		    bad->sector >= start + mddev->dev_sectors)
+			continue;
+
+		sector = bad->sector - start;
+		printk(KERN_INFO "md: %s: scrubber found bad sector %llu "
+		       "on %s, rewriting\n", mdname(mddev),
+		       (unsigned long long)sector,
+		       bdevname(rdev->bdev, b));
+		mddev->pers->scrub_fix(mddev, rdev, sector,
+			min_t(sector_t, bad->len,
+			      mddev->dev_sectors - sector));
+	}
+}
+
+static void md_scrub_work_fn(struct work_struct *ws)
+{
+	struct md_scrub_bad *bad;
+	struct list_head *tmp;
+	mddev_t *mddev;
+
+	for (;;) {
+		spin_lock(&md_scrub_bad_lock);
+		if (list_empty(&md_scrub_bad_list)) {
+			spin_unlock(&md_scrub_bad_lock);
+			break;
+		}
+		bad = list_first_entry(&md_scrub_bad_list,
+				       struct md_scrub_bad, list);
+		list_del(&bad->list);
+		spin_unlock(&md_scrub_bad_lock);
+
+		for_each_mddev(mddev, tmp) {
+			if (mddev_lock(mddev))
+				continue;
+			if (mddev->pers && mddev->pers->scrub_fix &&
+			    !mddev->ro)
+				md_scrub_fix(mddev, bad);
+			mddev_unlock(mddev);
+		}
+		kfree(bad);
+	}
+}
+
+static DECLARE_WORK(md_scrub_work, md_scrub_work_fn);
+
+static void md_scrub_bad_sector(struct scrub_event *ev)
+{
+	struct md_scrub_bad *bad;
+
+	bad = kmalloc(sizeof(*bad), GFP_NOIO);
+	if (!bad) {
+		printk(KERN_WARNING "md: not rewriting bad sector %llu "
+		       "on %s\n", (unsigned long long)ev->sector,
+		       ev->disk->disk_name);
+		return;
+	}
+	bad->disk = disk_devt(ev->disk);
+	bad->sector = ev->sector;
+	bad->len = ev->len;
+
+	spin_lock(&md_scrub_bad_lock);
+	list_add_tail(&bad->list, &md_scrub_bad_list);
+	spin_unlock(&md_scrub_bad_lock);
+	schedule_work(&md_scrub_work);
+}
+
+static void md_scrub_metadata(struct scrub_event *ev)
+{
+	struct list_head *tmp;
+	mddev_t *mddev;
+	mdk_rdev_t *rdev, *rtmp;
+
+	for_each_mddev(mddev, tmp) {
+		if (md_scrub_lock(mddev))
+			continue;
+		rdev_for_each(rdev, rtmp, mddev) {
+			sector_t start;
+
+			if (rdev->bdev->bd_disk != ev->disk || !rdev->sb_size)
+				continue;
+			start = get_start_sect(rdev->bdev) + rdev->sb_start;
+			ev->report(ev->data, start, (rdev->sb_size + 511) >> 9);
+
+			/* The internal bitmap is placed relative to the sb */
+			if (mddev->bitmap && !mddev->bitmap_info.file &&
+			    !mddev->bitmap_info.external &&
+			    mddev->bitmap_info.offset)
+				ev->report(ev->data,
+					   start + mddev->bitmap_info.offset,
+					   mddev->bitmap->file_pages <<
+					   (PAGE_SHIFT - 9));
+		}
+		mddev_unlock(mddev);
+	}
+}
+
+static int md_notify_scrub(struct notifier_block *this,
+			   unsigned long code, void *x)
+{
+	switch (code) {
+	case SCRUB_EVENT_BAD_SECTOR:
+		md_scrub_bad_sector(x);
+		return NOTIFY_OK;
+	case SCRUB_EVENT_METADATA:
+		md_scrub_metadata(x);
+		return NOTIFY_OK;
+	}
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block md_scrub_notifier = {
+	.notifier_call	= md_notify_scrub,
+};
+#endif /* CONFIG_BLK_DEV_SCRUB */
+
 static void md_geninit(void)
 {
 	dprintk("md: sizeof(mdp_super_t) = %d\n", (int)sizeof(mdp_super_t));
@@ -7229,6 +7513,9 @@ static int __init md_init(void)
 			    md_probe, NULL, NULL);
 
 	register_reboot_notifier(&md_notifier);
+#ifdef CONFIG_BLK_DEV_SCRUB
+	register_scrub_notifier(&md_scrub_notifier);
+#endif
 	raid_table_header = register_sysctl_table(raid_root_table);
 
 	md_geninit();
@@ -7315,6 +7602,10 @@ static __exit void md_exit(void)
 	unregister_blkdev(MD_MAJOR,"md");
 	unregister_blkdev(mdp_major, "mdp");
 	unregister_reboot_notifier(&md_notifier);
+#ifdef CONFIG_BLK_DEV_SCRUB
+	unregister_scrub_notifier(&md_scrub_notifier);
+	flush_work(&md_scrub_work);
+#endif
 	unregister_sysctl_table(raid_table_header);
 	remove_proc_entry("mdstat", NULL);
 	for_each_mddev(mddev, tmp) {
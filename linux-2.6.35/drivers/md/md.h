@@ -212,6 +212,8 @@ struct mddev_s
 	 * REQUEST:  user-space has requested a sync (used with SYNC)
 	 * CHECK:    user-space request for check-only, no repair
 	 * RESHAPE:  A reshape is happening
+	 * VERIFY:   user-space request for a check with the members'
+	 *           scrubbers, rather than by reading (used with CHECK)
 	 *
 	 * If neither SYNC or RESHAPE are set, then it is a recovery.
 	 */
@@ -225,6 +227,7 @@ struct mddev_s
 #define	MD_RECOVERY_CHECK	7
 #define MD_RECOVERY_RESHAPE	8
 #define	MD_RECOVERY_FROZEN	9
+#define	MD_RECOVERY_VERIFY	10
 
 	unsigned long			recovery;
 	int				recovery_disabled; /* if we detect that recovery
@@ -372,7 +375,24 @@ struct mdk_personality
 	 * array.
 	 */
 	void *(*takeover) (mddev_t *mddev);
+	/* scrub_fix rewrites sectors of a member, relative to its
+	 * data_offset, that the block layer scrubber found to be bad.
+	 * Called with the mddev locked, from a context that may block.
+	 */
+	void (*scrub_fix) (mddev_t *mddev, mdk_rdev_t *rdev,
+			   sector_t sector, int sectors);
+};
+
+#ifdef CONFIG_BLK_DEV_SCRUB
+/* A scrub_fix request queued for the personality's thread */
+struct md_scrub_fix {
+	struct list_head	list;
+	dev_t			dev;	/* member the sectors are bad on */
+	int			raid_disk;
+	sector_t		sector;	/* relative to data_offset */
+	int			sectors;
 };
+#endif /* CONFIG_BLK_DEV_SCRUB */
 
 
 struct md_sysfs_entry {
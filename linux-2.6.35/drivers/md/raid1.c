@@ -1600,6 +1600,93 @@ static void fix_read_error(conf_t *conf, int read_disk,
 	}
 }
 
+#ifdef CONFIG_BLK_DEV_SCRUB
+/*
+ * Bad sectors found by the scrubber are rewritten from the other mirrors
+ * by fix_read_error, just like the sectors of a failed read. As that has
+ * to run in raid1d, the sectors are queued for it here.
+ */
+static void raid1_scrub_fix(mddev_t *mddev, mdk_rdev_t *rdev,
+			    sector_t sector, int sectors)
+{
+	conf_t *conf = mddev->private;
+	struct md_scrub_fix *fix;
+	unsigned long flags;
+
+	fix = kmalloc(sizeof(*fix), GFP_NOIO);
+	if (!fix)
+		return;
+	fix->dev = rdev->bdev->bd_dev;
+	fix->raid_disk = rdev->raid_disk;
+	fix->sector = sector;
+	fix->sectors = sectors;
+
+	spin_lock_irqsave(&conf->device_lock, flags);
+	list_add_tail(&fix->list, &conf->scrub_list);
+	spin_unlock_irqrestore(&conf->device_lock, flags);
+	md_wakeup_thread(mddev->thread);
+}
+
+static int freeze_array_idle(conf_t *conf)
+{
+	/* Like freeze_array, but raid1d has no failed request of its
+	 * own here, so we wait for nr_pending to match nr_queued.
+	 * Resync requests need raid1d to complete, so we don't wait
+	 * for a raised barrier to drop. We fail instead, and the
+	 * caller retries the next time raid1d runs.
+	 */
+	spin_lock_irq(&conf->resync_lock);
+	if (conf->barrier) {
+		spin_unlock_irq(&conf->resync_lock);
+		return 0;
+	}
+	conf->barrier++;
+	conf->nr_waiting++;
+	wait_event_lock_irq(conf->wait_barrier,
+			    conf->nr_pending == conf->nr_queued,
+			    conf->resync_lock,
+			    ({ flush_pending_writes(conf);
+			       raid1_unplug(conf->mddev->queue); }));
+	spin_unlock_irq(&conf->resync_lock);
+	return 1;
+}
+
+static void handle_scrub_fixes(conf_t *conf)
+{
+	mddev_t *mddev = conf->mddev;
+	struct md_scrub_fix *fix;
+	mdk_rdev_t *rdev;
+	unsigned long flags;
+
+	if (list_empty(&conf->scrub_list) || !freeze_array_idle(conf))
+		return;
+
+	for (;;) {
+		spin_lock_irqsave(&conf->device_lock, flags);
+		if (list_empty(&conf->scrub_list)) {
+			spin_unlock_irqrestore(&conf->device_lock, flags);
+			break;
+		}
+		fix = list_first_entry(&conf->scrub_list, struct md_scrub_fix,
+				       list);
+		list_del(&fix->list);
+		spin_unlock_irqrestore(&conf->device_lock, flags);
+
+		/* The member may have been replaced since the fix was queued */
+		rdev = NULL;
+		if (fix->raid_disk < conf->raid_disks)
+			rdev = conf->mirrors[fix->raid_disk].rdev;
+		if (mddev->ro == 0 &&
+		    rdev && rdev->bdev->bd_dev == fix->dev &&
+		    test_bit(In_sync, &rdev->flags))
+			fix_read_error(conf, fix->raid_disk, fix->sector,
+				       fix->sectors);
+		kfree(fix);
+	}
+	unfreeze_array(conf);
+}
+#endif /* CONFIG_BLK_DEV_SCRUB */
+
 static void raid1d(mddev_t *mddev)
 {
 	r1bio_t *r1_bio;
@@ -1723,6 +1810,9 @@ static void raid1d(mddev_t *mddev)
 		}
 		cond_resched();
 	}
+#ifdef CONFIG_BLK_DEV_SCRUB
+	handle_scrub_fixes(conf);
+#endif
 	if (unplug)
 		unplug_slaves(mddev);
 }
@@ -2021,6 +2111,9 @@ static conf_t *setup_conf(mddev_t *mddev)
 	conf->raid_disks = mddev->raid_disks;
 	conf->mddev = mddev;
 	INIT_LIST_HEAD(&conf->retry_list);
+#ifdef CONFIG_BLK_DEV_SCRUB
+	INIT_LIST_HEAD(&conf->scrub_list);
+#endif
 
 	spin_lock_init(&conf->resync_lock);
 	init_waitqueue_head(&conf->wait_barrier);
@@ -2174,6 +2267,14 @@ static int stop(mddev_t *mddev)
 	md_unregister_thread(mddev->thread);
 	mddev->thread = NULL;
 	blk_sync_queue(mddev->queue); /* the unplug fn references 'conf'*/
+#ifdef CONFIG_BLK_DEV_SCRUB
+	while (!list_empty(&conf->scrub_list)) {
+		struct md_scrub_fix *fix = list_first_entry(&conf->scrub_list,
+						struct md_scrub_fix, list);
+		list_del(&fix->list);
+		kfree(fix);
+	}
+#endif
 	if (conf->r1bio_pool)
 		mempool_destroy(conf->r1bio_pool);
 	kfree(conf->mirrors);
@@ -2372,6 +2473,9 @@ static struct mdk_personality raid1_personality =
 	.check_reshape	= raid1_reshape,
 	.quiesce	= raid1_quiesce,
 	.takeover	= raid1_takeover,
+#ifdef CONFIG_BLK_DEV_SCRUB
+	.scrub_fix	= raid1_scrub_fix,
+#endif
 };
 
 static int __init raid_init(void)
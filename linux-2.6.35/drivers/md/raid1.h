@@ -33,6 +33,10 @@ struct r1_private_data_s {
 	spinlock_t		device_lock;
 
 	struct list_head	retry_list;
+#ifdef CONFIG_BLK_DEV_SCRUB
+	/* bad sectors found by the scrubber, to be fixed by raid1d */
+	struct list_head	scrub_list;
+#endif
 	/* queue pending writes and submit them on unplug */
 	struct bio_list		pending_bio_list;
 	/* queue of writes that have been unplugged */
@@ -1652,6 +1652,142 @@ static void fix_read_error(conf_t *conf, mddev_t *mddev, r10bio_t *r10_bio)
 	}
 }
 
+#ifdef CONFIG_BLK_DEV_SCRUB
+/*
+ * Bad sectors found by the scrubber are rewritten from the other copies
+ * by fix_read_error, just like the sectors of a failed read. As that has
+ * to run in raid10d, the sectors are queued for it here.
+ */
+static void raid10_scrub_fix(mddev_t *mddev, mdk_rdev_t *rdev,
+			     sector_t sector, int sectors)
+{
+	conf_t *conf = mddev->private;
+	struct md_scrub_fix *fix;
+	unsigned long flags;
+
+	fix = kmalloc(sizeof(*fix), GFP_NOIO);
+	if (!fix)
+		return;
+	fix->dev = rdev->bdev->bd_dev;
+	fix->raid_disk = rdev->raid_disk;
+	fix->sector = sector;
+	fix->sectors = sectors;
+
+	spin_lock_irqsave(&conf->device_lock, flags);
+	list_add_tail(&fix->list, &conf->scrub_list);
+	spin_unlock_irqrestore(&conf->device_lock, flags);
+	md_wakeup_thread(mddev->thread);
+}
+
+static int freeze_array_idle(conf_t *conf)
+{
+	/* Like freeze_array, but raid10d has no failed request of its
+	 * own here, so we wait for nr_pending to match nr_queued.
+	 * Resync requests need raid10d to complete, so we don't wait
+	 * for a raised barrier to drop. We fail instead, and the
+	 * caller retries the next time raid10d runs.
+	 */
+	spin_lock_irq(&conf->resync_lock);
+	if (conf->barrier) {
+		spin_unlock_irq(&conf->resync_lock);
+		return 0;
+	}
+	conf->barrier++;
+	conf->nr_waiting++;
+	wait_event_lock_irq(conf->wait_barrier,
+			    conf->nr_pending == conf->nr_queued,
+			    conf->resync_lock,
+			    ({ flush_pending_writes(conf);
+			       raid10_unplug(conf->mddev->queue); }));
+	spin_unlock_irq(&conf->resync_lock);
+	return 1;
+}
+
+/* Maps a fix back to the virtual sectors it covers, one chunk at a time,
+ * and hands each piece to fix_read_error as if a read of it had failed.
+ */
+static void scrub_fix_sectors(conf_t *conf, r10bio_t *r10_bio,
+			      struct md_scrub_fix *fix)
+{
+	mddev_t *mddev = conf->mddev;
+	sector_t sector = fix->sector;
+	int sectors = fix->sectors;
+	int s, slot;
+
+	while (sectors) {
+		s = min_t(sector_t, sectors,
+			  conf->chunk_mask + 1 - (sector & conf->chunk_mask));
+
+		r10_bio->mddev = mddev;
+		r10_bio->state = 0;
+		r10_bio->sector = raid10_find_virt(conf, sector,
+						   fix->raid_disk);
+		r10_bio->sectors = s;
+		if (r10_bio->sector >= mddev->array_sectors)
+			break;
+		raid10_find_phys(conf, r10_bio);
+
+		for (slot = 0; slot < conf->copies; slot++)
+			if (r10_bio->devs[slot].devnum == fix->raid_disk &&
+			    r10_bio->devs[slot].addr == sector)
+				break;
+		if (slot < conf->copies) {
+			r10_bio->read_slot = slot;
+			fix_read_error(conf, mddev, r10_bio);
+		}
+
+		sectors -= s;
+		sector += s;
+	}
+}
+
+static void handle_scrub_fixes(conf_t *conf)
+{
+	mddev_t *mddev = conf->mddev;
+	struct md_scrub_fix *fix;
+	r10bio_t *r10_bio;
+	mdk_rdev_t *rdev;
+	unsigned long flags;
+
+	if (list_empty(&conf->scrub_list))
+		return;
+	/* Not from the mempool: it may be depleted by queued requests
+	 * which can't complete while the array is frozen.
+	 */
+	r10_bio = r10bio_pool_alloc(GFP_NOIO, conf);
+	if (!r10_bio)
+		return;
+	if (!freeze_array_idle(conf)) {
+		r10bio_pool_free(r10_bio, conf);
+		return;
+	}
+
+	for (;;) {
+		spin_lock_irqsave(&conf->device_lock, flags);
+		if (list_empty(&conf->scrub_list)) {
+			spin_unlock_irqrestore(&conf->device_lock, flags);
+			break;
+		}
+		fix = list_first_entry(&conf->scrub_list, struct md_scrub_fix,
+				       list);
+		list_del(&fix->list);
+		spin_unlock_irqrestore(&conf->device_lock, flags);
+
+		/* The member may have been replaced since the fix was queued */
+		rdev = NULL;
+		if (fix->raid_disk < conf->raid_disks)
+			rdev = conf->mirrors[fix->raid_disk].rdev;
+		if (mddev->ro == 0 &&
+		    rdev && rdev->bdev->bd_dev == fix->dev &&
+		    test_bit(In_sync, &rdev->flags))
+			scrub_fix_sectors(conf, r10_bio, fix);
+		kfree(fix);
+	}
+	unfreeze_array(conf);
+	r10bio_pool_free(r10_bio, conf);
+}
+#endif /* CONFIG_BLK_DEV_SCRUB */
+
 static void raid10d(mddev_t *mddev)
 {
 	r10bio_t *r10_bio;
@@ -1739,6 +1875,9 @@ static void raid10d(mddev_t *mddev)
 		}
 		cond_resched();
 	}
+#ifdef CONFIG_BLK_DEV_SCRUB
+	handle_scrub_fixes(conf);
+#endif
 	if (unplug)
 		unplug_slaves(mddev);
 }
@@ -2233,6 +2372,9 @@ static conf_t *setup_conf(mddev_t *mddev)
 
 	spin_lock_init(&conf->device_lock);
 	INIT_LIST_HEAD(&conf->retry_list);
+#ifdef CONFIG_BLK_DEV_SCRUB
+	INIT_LIST_HEAD(&conf->scrub_list);
+#endif
 
 	spin_lock_init(&conf->resync_lock);
 	init_waitqueue_head(&conf->wait_barrier);
@@ -2396,6 +2538,14 @@ static int stop(mddev_t *mddev)
 	md_unregister_thread(mddev->thread);
 	mddev->thread = NULL;
 	blk_sync_queue(mddev->queue); /* the unplug fn references 'conf'*/
+#ifdef CONFIG_BLK_DEV_SCRUB
+	while (!list_empty(&conf->scrub_list)) {
+		struct md_scrub_fix *fix = list_first_entry(&conf->scrub_list,
+						struct md_scrub_fix, list);
+		list_del(&fix->list);
+		kfree(fix);
+	}
+#endif
 	if (conf->r10bio_pool)
 		mempool_destroy(conf->r10bio_pool);
 	kfree(conf->mirrors);
@@ -2486,6 +2636,9 @@ static struct mdk_personality raid10_personality =
 	.quiesce	= raid10_quiesce,
 	.size		= raid10_size,
 	.takeover	= raid10_takeover,
+#ifdef CONFIG_BLK_DEV_SCRUB
+	.scrub_fix	= raid10_scrub_fix,
+#endif
 };
 
 static int __init raid_init(void)
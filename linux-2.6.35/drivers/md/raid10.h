@@ -39,6 +39,10 @@ struct r10_private_data_s {
 	sector_t chunk_mask;
 
 	struct list_head	retry_list;
+#ifdef CONFIG_BLK_DEV_SCRUB
+	/* bad sectors found by the scrubber, to be fixed by raid10d */
+	struct list_head	scrub_list;
+#endif
 	/* queue pending writes and submit them on unplug */
 	struct bio_list		pending_bio_list;
 
@@ -3000,6 +3000,20 @@ static void handle_stripe_expansion(raid5_conf_t *conf, struct stripe_head *sh,
  *
  */
 
+#ifdef CONFIG_BLK_DEV_SCRUB
+/* Syncs started by handle_scrub_fixes aren't accounted by md_do_sync */
+static void raid5_done_sync(struct stripe_head *sh, int ok)
+{
+	if (!test_and_clear_bit(STRIPE_SCRUB_FIX, &sh->state))
+		md_done_sync(sh->raid_conf->mddev, STRIPE_SECTORS, ok);
+}
+#else
+static void raid5_done_sync(struct stripe_head *sh, int ok)
+{
+	md_done_sync(sh->raid_conf->mddev, STRIPE_SECTORS, ok);
+}
+#endif /* CONFIG_BLK_DEV_SCRUB */
+
 static void handle_stripe5(struct stripe_head *sh)
 {
 	raid5_conf_t *conf = sh->raid_conf;
@@ -3117,7 +3131,7 @@ static void handle_stripe5(struct stripe_head *sh)
 	if (s.failed > 1 && s.to_read+s.to_write+s.written)
 		handle_failed_stripe(conf, sh, &s, disks, &return_bi);
 	if (s.failed > 1 && s.syncing) {
-		md_done_sync(conf->mddev, STRIPE_SECTORS,0);
+		raid5_done_sync(sh, 0);
 		clear_bit(STRIPE_SYNCING, &sh->state);
 		s.syncing = 0;
 	}
@@ -3193,7 +3207,7 @@ static void handle_stripe5(struct stripe_head *sh)
 		handle_parity_checks5(conf, sh, &s, disks);
 
 	if (s.syncing && s.locked == 0 && test_bit(STRIPE_INSYNC, &sh->state)) {
-		md_done_sync(conf->mddev, STRIPE_SECTORS,1);
+		raid5_done_sync(sh, 1);
 		clear_bit(STRIPE_SYNCING, &sh->state);
 	}
 
@@ -3409,7 +3423,7 @@ static void handle_stripe6(struct stripe_head *sh)
 	if (s.failed > 2 && s.to_read+s.to_write+s.written)
 		handle_failed_stripe(conf, sh, &s, disks, &return_bi);
 	if (s.failed > 2 && s.syncing) {
-		md_done_sync(conf->mddev, STRIPE_SECTORS,0);
+		raid5_done_sync(sh, 0);
 		clear_bit(STRIPE_SYNCING, &sh->state);
 		s.syncing = 0;
 	}
@@ -3492,7 +3506,7 @@ static void handle_stripe6(struct stripe_head *sh)
 		handle_parity_checks6(conf, sh, &s, &r6s, disks);
 
 	if (s.syncing && s.locked == 0 && test_bit(STRIPE_INSYNC, &sh->state)) {
-		md_done_sync(conf->mddev, STRIPE_SECTORS,1);
+		raid5_done_sync(sh, 1);
 		clear_bit(STRIPE_SYNCING, &sh->state);
 	}
 
@@ -4419,6 +4433,8 @@ static inline sector_t sync_request(mddev_t *mddev, sector_t sector_nr, int *ski
 	spin_lock(&sh->lock);
 	set_bit(STRIPE_SYNCING, &sh->state);
 	clear_bit(STRIPE_INSYNC, &sh->state);
+	/* A scrubber fix in progress now completes this sync */
+	clear_bit(STRIPE_SCRUB_FIX, &sh->state);
 	spin_unlock(&sh->lock);
 
 	handle_stripe(sh);
@@ -4492,6 +4508,104 @@ static int  retry_aligned_read(raid5_conf_t *conf, struct bio *raid_bio)
 }
 
 
+#ifdef CONFIG_BLK_DEV_SCRUB
+/*
+ * Bad sectors found by the scrubber are fixed by syncing the stripes that
+ * hold them, as resync does. The sync reads the bad block from the
+ * member, where it fails with R5_ReadError and is rebuilt and rewritten
+ * by handle_stripe. A block already up to date in the stripe cache is
+ * flagged R5_ReadError directly, so it is rewritten from the cache.
+ * Bad parity is fixed the same way.
+ * STRIPE_SCRUB_FIX keeps these syncs out of md_do_sync's accounting.
+ */
+static void raid5_scrub_fix(mddev_t *mddev, mdk_rdev_t *rdev,
+			    sector_t sector, int sectors)
+{
+	raid5_conf_t *conf = mddev->private;
+	struct md_scrub_fix *fix;
+	unsigned long flags;
+
+	fix = kmalloc(sizeof(*fix), GFP_NOIO);
+	if (!fix)
+		return;
+	fix->dev = rdev->bdev->bd_dev;
+	fix->raid_disk = rdev->raid_disk;
+	fix->sector = sector & ~((sector_t)STRIPE_SECTORS-1);
+	fix->sectors = sector + sectors - fix->sector;
+
+	spin_lock_irqsave(&conf->device_lock, flags);
+	list_add_tail(&fix->list, &conf->scrub_list);
+	spin_unlock_irqrestore(&conf->device_lock, flags);
+	md_wakeup_thread(mddev->thread);
+}
+
+static void handle_scrub_fixes(raid5_conf_t *conf)
+{
+	mddev_t *mddev = conf->mddev;
+	struct md_scrub_fix *fix;
+	struct stripe_head *sh;
+	struct r5dev *dev;
+	mdk_rdev_t *rdev;
+	unsigned long flags;
+
+	for (;;) {
+		spin_lock_irqsave(&conf->device_lock, flags);
+		if (list_empty(&conf->scrub_list)) {
+			spin_unlock_irqrestore(&conf->device_lock, flags);
+			break;
+		}
+		fix = list_first_entry(&conf->scrub_list, struct md_scrub_fix,
+				       list);
+		list_del(&fix->list);
+		spin_unlock_irqrestore(&conf->device_lock, flags);
+
+		/* The member may have been replaced since the fix was queued */
+		rdev = NULL;
+		if (fix->raid_disk < conf->raid_disks)
+			rdev = conf->disks[fix->raid_disk].rdev;
+		if (mddev->ro || mddev->reshape_position != MaxSector ||
+		    mddev->degraded >= conf->max_degraded ||
+		    !rdev || rdev->bdev->bd_dev != fix->dev ||
+		    !test_bit(In_sync, &rdev->flags))
+			fix->sectors = 0;
+
+		while (fix->sectors > 0 && fix->sector < mddev->dev_sectors) {
+			/* raid5d must not wait for a free stripe: it is the
+			 * one freeing them. What's left is retried on its
+			 * next run, which releasing the busy stripes causes.
+			 */
+			sh = get_active_stripe(conf, fix->sector, 0, 1, 0);
+			if (!sh) {
+				spin_lock_irqsave(&conf->device_lock, flags);
+				list_add(&fix->list, &conf->scrub_list);
+				spin_unlock_irqrestore(&conf->device_lock,
+						       flags);
+				return;
+			}
+			spin_lock(&sh->lock);
+			if (!test_bit(STRIPE_SYNCING, &sh->state)) {
+				set_bit(STRIPE_SCRUB_FIX, &sh->state);
+				set_bit(STRIPE_SYNCING, &sh->state);
+				clear_bit(STRIPE_INSYNC, &sh->state);
+			}
+			/* A cached block isn't read again: rewrite it */
+			dev = &sh->dev[fix->raid_disk];
+			if (test_bit(R5_UPTODATE, &dev->flags) &&
+			    !test_bit(R5_LOCKED, &dev->flags))
+				set_bit(R5_ReadError, &dev->flags);
+			spin_unlock(&sh->lock);
+
+			handle_stripe(sh);
+			release_stripe(sh);
+
+			fix->sector += STRIPE_SECTORS;
+			fix->sectors -= STRIPE_SECTORS;
+		}
+		kfree(fix);
+	}
+}
+#endif /* CONFIG_BLK_DEV_SCRUB */
+
 /*
  * This is our raid5 kernel thread.
  *
@@ -4508,6 +4622,9 @@ static void raid5d(mddev_t *mddev)
 	pr_debug("+++ raid5d active\n");
 
 	md_check_recovery(mddev);
+#ifdef CONFIG_BLK_DEV_SCRUB
+	handle_scrub_fixes(conf);
+#endif
 
 	handled = 0;
 	spin_lock_irq(&conf->device_lock);
@@ -4702,6 +4819,14 @@ static void raid5_free_percpu(raid5_conf_t *conf)
 
 static void free_conf(raid5_conf_t *conf)
 {
+#ifdef CONFIG_BLK_DEV_SCRUB
+	while (!list_empty(&conf->scrub_list)) {
+		struct md_scrub_fix *fix = list_first_entry(&conf->scrub_list,
+						struct md_scrub_fix, list);
+		list_del(&fix->list);
+		kfree(fix);
+	}
+#endif
 	shrink_stripes(conf);
 	raid5_free_percpu(conf);
 	kfree(conf->disks);
@@ -4836,6 +4961,9 @@ static raid5_conf_t *setup_conf(mddev_t *mddev)
 	INIT_LIST_HEAD(&conf->hold_list);
 	INIT_LIST_HEAD(&conf->delayed_list);
 	INIT_LIST_HEAD(&conf->bitmap_list);
+#ifdef CONFIG_BLK_DEV_SCRUB
+	INIT_LIST_HEAD(&conf->scrub_list);
+#endif
 	INIT_LIST_HEAD(&conf->inactive_list);
 	atomic_set(&conf->active_stripes, 0);
 	atomic_set(&conf->preread_active_stripes, 0);
@@ -5653,6 +5781,7 @@ static void raid5_finish_reshape(mddev_t *mddev)
 	}
 }
 
+
 static void raid5_quiesce(mddev_t *mddev, int state)
 {
 	raid5_conf_t *conf = mddev->private;
@@ -5943,6 +6072,9 @@ static struct mdk_personality raid6_personality =
 	.finish_reshape = raid5_finish_reshape,
 	.quiesce	= raid5_quiesce,
 	.takeover	= raid6_takeover,
+#ifdef CONFIG_BLK_DEV_SCRUB
+	.scrub_fix	= raid5_scrub_fix,
+#endif
 };
 static struct mdk_personality raid5_personality =
 {
@@ -5965,6 +6097,9 @@ static struct mdk_personality raid5_personality =
 	.finish_reshape = raid5_finish_reshape,
 	.quiesce	= raid5_quiesce,
 	.takeover	= raid5_takeover,
+#ifdef CONFIG_BLK_DEV_SCRUB
+	.scrub_fix	= raid5_scrub_fix,
+#endif
 };
 
 static struct mdk_personality raid4_personality =
@@ -5988,6 +6123,9 @@ static struct mdk_personality raid4_personality =
 	.finish_reshape = raid5_finish_reshape,
 	.quiesce	= raid5_quiesce,
 	.takeover	= raid4_takeover,
+#ifdef CONFIG_BLK_DEV_SCRUB
+	.scrub_fix	= raid5_scrub_fix,
+#endif
 };
 
 static int __init raid5_init(void)
@@ -303,6 +303,7 @@ struct r6_state {
 #define	STRIPE_BIOFILL_RUN	14
 #define	STRIPE_COMPUTE_RUN	15
 #define	STRIPE_OPS_REQ_PENDING	16
+#define	STRIPE_SCRUB_FIX	17 /* synced for the scrubber, not md_do_sync */
 
 /*
  * Operation request flags
@@ -374,6 +375,10 @@ struct raid5_private_data {
 	struct list_head	hold_list; /* preread ready stripes */
 	struct list_head	delayed_list; /* stripes that have plugged requests */
 	struct list_head	bitmap_list; /* stripes delaying awaiting bitmap update */
+#ifdef CONFIG_BLK_DEV_SCRUB
+	/* bad sectors found by the scrubber, to be fixed by raid5d */
+	struct list_head	scrub_list;
+#endif
 	struct bio		*retry_read_aligned; /* currently retrying aligned bios   */
 	struct bio		*retry_read_aligned_list; /* aligned bios retry list  */
 	atomic_t		preread_active_stripes; /* stripes with scheduled io */
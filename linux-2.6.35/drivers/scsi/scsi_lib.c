@@ -1070,7 +1070,7 @@ int scsi_setup_blk_pc_cmnd(struct scsi_device *sdev, struct request *req)
 			return ret;
 	} else {
 #ifdef CONFIG_BLK_DEV_SCRUB
-		if (!req->cmd || req->cmd[0] != 0x2f)
+		if (!req->cmd || (req->cmd[0] != 0x2f && req->cmd[0] != ATA_16))
 			BUG_ON(blk_rq_bytes(req));
 #else
 		BUG_ON(blk_rq_bytes(req));
@@ -1082,7 +1082,8 @@ int scsi_setup_blk_pc_cmnd(struct scsi_device *sdev, struct request *req)
 
 	cmd->cmd_len = req->cmd_len;
 #ifdef CONFIG_BLK_DEV_SCRUB
-	if (!blk_rq_bytes(req) || (req->cmd && req->cmd[0] == 0x2f))
+	if (!blk_rq_bytes(req) || (req->cmd &&
+	    (req->cmd[0] == 0x2f || req->cmd[0] == ATA_16)))
 #else
 	if (!blk_rq_bytes(req))
 #endif /* CONFIG_BLK_DEV_SCRUB */
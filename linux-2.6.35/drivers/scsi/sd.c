@@ -1147,6 +1147,41 @@ static unsigned int sd_completed_bytes(struct scsi_cmnd *scmd)
 	return (bad_lba - start_lba) * scmd->device->sector_size;
 }
 
+#ifdef CONFIG_BLK_DEV_SCRUB
+/*
+ * Log a medium or hardware error seen on a regular request with the
+ * scrubber, and have it rescan the neighborhood of medium errors, since
+ * latent sector errors tend to cluster. Recovered errors are passed on as
+ * well, so that degrading regions are scrubbed more often.
+ */
+static void sd_scrub_error(struct scsi_cmnd *scmd,
+			   struct scsi_sense_hdr *sshdr)
+{
+	struct request *rq = scmd->request;
+	u64 sector = blk_rq_pos(rq), len = blk_rq_sectors(rq), bad_lba;
+
+	if (!blk_fs_request(rq) || !rq->rq_disk->scrubber)
+		return;
+
+	if (scsi_get_sense_info_fld(scmd->sense_buffer, SCSI_SENSE_BUFFERSIZE,
+				    &bad_lba) && scmd->device->sector_size >= 512) {
+		len = scmd->device->sector_size >> 9;
+		sector = bad_lba * len;
+	}
+
+	if (sshdr->sense_key == RECOVERED_ERROR) {
+		blk_scrub_recovered(rq->rq_disk, sector, sshdr->asc,
+				    sshdr->ascq, BLK_SCRUB_SRC_FOREGROUND);
+		return;
+	}
+
+	blk_scrub_log_error(rq->rq_disk, sector, sshdr->sense_key, sshdr->asc,
+			    sshdr->ascq, BLK_SCRUB_SRC_FOREGROUND);
+	if (sshdr->sense_key == MEDIUM_ERROR)
+		blk_scrub_rescan(rq->rq_disk, sector, len, GFP_ATOMIC);
+}
+#endif /* CONFIG_BLK_DEV_SCRUB */
+
 /**
  *	sd_done - bottom half handler: called when the lower level
  *	driver has completed (successfully or otherwise) a scsi command.
@@ -1187,9 +1222,15 @@ static int sd_done(struct scsi_cmnd *SCpnt)
 	case HARDWARE_ERROR:
 	case MEDIUM_ERROR:
 		good_bytes = sd_completed_bytes(SCpnt);
+#ifdef CONFIG_BLK_DEV_SCRUB
+		sd_scrub_error(SCpnt, &sshdr);
+#endif /* CONFIG_BLK_DEV_SCRUB */
 		break;
 	case RECOVERED_ERROR:
 		good_bytes = scsi_bufflen(SCpnt);
+#ifdef CONFIG_BLK_DEV_SCRUB
+		sd_scrub_error(SCpnt, &sshdr);
+#endif /* CONFIG_BLK_DEV_SCRUB */
 		break;
 	case NO_SENSE:
 		/* This indicates a false check condition, so ignore it.  An
@@ -1808,6 +1808,132 @@ ext3_fsblk_t ext3_count_free_blocks(struct super_block *sb)
 #endif
 }
 
+#ifdef CONFIG_BLK_DEV_SCRUB
+/**
+ * ext3_scrub_allocated() -- report allocated blocks to the scrubber
+ * @sb:		superblock
+ * @fn:		called for each run of allocated blocks, in 512-byte sectors
+ * @data:	passed to @fn
+ *
+ * Walks the block bitmap of each block group. Blocks allocated while the
+ * walk is in progress may be missed.
+ */
+int ext3_scrub_allocated(struct super_block *sb, scrub_extent_fn *fn,
+			 void *data)
+{
+	unsigned long group, ngroups = EXT3_SB(sb)->s_groups_count;
+	ext3_grpblk_t start, end, max;
+	ext3_fsblk_t first;
+	struct buffer_head *bh;
+	int shift = sb->s_blocksize_bits - 9;
+	int err = 0;
+
+	smp_rmb();
+	for (group = 0; group < ngroups && !err; group++) {
+		bh = read_block_bitmap(sb, group);
+		if (!bh)
+			return -EIO;
+
+		first = ext3_group_first_block_no(sb, group);
+		if (group == ngroups - 1)
+			max = le32_to_cpu(EXT3_SB(sb)->s_es->s_blocks_count) - first;
+		else
+			max = EXT3_BLOCKS_PER_GROUP(sb);
+
+		start = ext2_find_next_bit(bh->b_data, max, 0);
+		while (start < max) {
+			end = ext3_find_next_zero_bit(bh->b_data, max, start);
+			err = fn(data, (sector_t) (first + start) << shift,
+				 (sector_t) (end - start) << shift);
+			if (err)
+				break;
+			start = ext2_find_next_bit(bh->b_data, max, end);
+		}
+		brelse(bh);
+		cond_resched();
+	}
+
+	return err;
+}
+
+static int ext3_scrub_report(scrub_extent_fn *fn, void *data, int shift,
+			     ext3_fsblk_t block, unsigned long count)
+{
+	if (!count)
+		return 0;
+	return fn(data, (sector_t) block << shift, (sector_t) count << shift);
+}
+
+/**
+ * ext3_scrub_metadata() -- report metadata blocks to the scrubber
+ * @sb:		superblock
+ * @fn:		called for each run of metadata blocks, in 512-byte sectors
+ * @data:	passed to @fn
+ *
+ * Reports the superblock and group descriptor copies, the bitmaps and the
+ * inode table of each block group, and the blocks of an internal journal.
+ */
+int ext3_scrub_metadata(struct super_block *sb, scrub_extent_fn *fn,
+			void *data)
+{
+	struct ext3_sb_info *sbi = EXT3_SB(sb);
+	unsigned long group, ngroups = sbi->s_groups_count;
+	struct ext3_group_desc *gdp;
+	journal_t *journal = sbi->s_journal;
+	unsigned long count, len = 0, start = 0;
+	unsigned int i, pblk;
+	int shift = sb->s_blocksize_bits - 9;
+	int err = 0;
+
+	smp_rmb();
+	for (group = 0; group < ngroups && !err; group++) {
+		gdp = ext3_get_group_desc(sb, group, NULL);
+		if (!gdp)
+			continue;
+
+		/* Superblock and group descriptor copies */
+		count = 0;
+		if (ext3_bg_has_super(sb, group))
+			count = 1 + ext3_bg_num_gdb(sb, group) +
+				le16_to_cpu(sbi->s_es->s_reserved_gdt_blocks);
+		err = ext3_scrub_report(fn, data, shift,
+					ext3_group_first_block_no(sb, group), count);
+
+		if (!err)
+			err = ext3_scrub_report(fn, data, shift,
+					le32_to_cpu(gdp->bg_block_bitmap), 1);
+		if (!err)
+			err = ext3_scrub_report(fn, data, shift,
+					le32_to_cpu(gdp->bg_inode_bitmap), 1);
+		if (!err)
+			err = ext3_scrub_report(fn, data, shift,
+					le32_to_cpu(gdp->bg_inode_table),
+					sbi->s_itb_per_group);
+	}
+
+	/* The journal inode, unless the journal lives on another device */
+	if (err || !journal || !sbi->s_es->s_journal_inum ||
+	    journal->j_dev != journal->j_fs_dev)
+		return err;
+
+	for (i = 0; i < journal->j_maxlen && !err; i++) {
+		if (journal_bmap(journal, i, &pblk))
+			break;
+		if (len && pblk == start + len) {
+			++len;
+			continue;
+		}
+		err = ext3_scrub_report(fn, data, shift, start, len);
+		start = pblk;
+		len = 1;
+	}
+	if (!err)
+		err = ext3_scrub_report(fn, data, shift, start, len);
+
+	return err;
+}
+#endif
+
 static inline int test_root(int a, int b)
 {
 	int num = b;
@@ -797,6 +797,10 @@ static const struct super_operations ext3_sops = {
 	.quota_write	= ext3_quota_write,
 #endif
 	.bdev_try_to_free_page = bdev_try_to_free_page,
+#ifdef CONFIG_BLK_DEV_SCRUB
+	.scrub_allocated = ext3_scrub_allocated,
+	.scrub_metadata	= ext3_scrub_metadata,
+#endif
 };
 
 static const struct export_operations ext3_export_ops = {
@@ -660,6 +660,135 @@ ext4_fsblk_t ext4_count_free_blocks(struct super_block *sb)
 #endif
 }
 
+#ifdef CONFIG_BLK_DEV_SCRUB
+/**
+ * ext4_scrub_allocated() -- report allocated blocks to the scrubber
+ * @sb:		superblock
+ * @fn:		called for each run of allocated blocks, in 512-byte sectors
+ * @data:	passed to @fn
+ *
+ * Walks the block bitmap of each block group. Blocks allocated while the
+ * walk is in progress may be missed.
+ */
+int ext4_scrub_allocated(struct super_block *sb, scrub_extent_fn *fn,
+			 void *data)
+{
+	ext4_group_t group, ngroups = ext4_get_groups_count(sb);
+	ext4_grpblk_t start, end, max;
+	ext4_fsblk_t first;
+	struct buffer_head *bh;
+	int shift = sb->s_blocksize_bits - 9;
+	int err = 0;
+
+	for (group = 0; group < ngroups && !err; group++) {
+		bh = ext4_read_block_bitmap(sb, group);
+		if (!bh)
+			return -EIO;
+
+		first = ext4_group_first_block_no(sb, group);
+		if (group == ngroups - 1)
+			max = ext4_blocks_count(EXT4_SB(sb)->s_es) - first;
+		else
+			max = EXT4_BLOCKS_PER_GROUP(sb);
+
+		start = ext4_find_next_bit(bh->b_data, max, 0);
+		while (start < max) {
+			end = ext4_find_next_zero_bit(bh->b_data, max, start);
+			err = fn(data, (sector_t) (first + start) << shift,
+				 (sector_t) (end - start) << shift);
+			if (err)
+				break;
+			start = ext4_find_next_bit(bh->b_data, max, end);
+		}
+		brelse(bh);
+		cond_resched();
+	}
+
+	return err;
+}
+
+static int ext4_scrub_report(scrub_extent_fn *fn, void *data, int shift,
+			     ext4_fsblk_t block, unsigned long count)
+{
+	if (!count)
+		return 0;
+	return fn(data, (sector_t) block << shift, (sector_t) count << shift);
+}
+
+/**
+ * ext4_scrub_metadata() -- report metadata blocks to the scrubber
+ * @sb:		superblock
+ * @fn:		called for each run of metadata blocks, in 512-byte sectors
+ * @data:	passed to @fn
+ *
+ * Reports the superblock and group descriptor copies, the bitmaps and the
+ * inode table of each block group, and the blocks of an internal journal.
+ */
+int ext4_scrub_metadata(struct super_block *sb, scrub_extent_fn *fn,
+			void *data)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	ext4_group_t group, ngroups = ext4_get_groups_count(sb);
+	struct ext4_group_desc *gdp;
+	journal_t *journal = sbi->s_journal;
+	unsigned long long pblk, start = 0;
+	unsigned long count, len = 0, i;
+	int shift = sb->s_blocksize_bits - 9;
+	int err = 0;
+
+	for (group = 0; group < ngroups && !err; group++) {
+		gdp = ext4_get_group_desc(sb, group, NULL);
+		if (!gdp)
+			continue;
+
+		/* Superblock and group descriptor copies */
+		count = ext4_bg_has_super(sb, group);
+		if (!EXT4_HAS_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_META_BG) ||
+		    group < le32_to_cpu(sbi->s_es->s_first_meta_bg) *
+			    sbi->s_desc_per_block) {
+			if (count)
+				count += ext4_bg_num_gdb(sb, group) +
+					le16_to_cpu(sbi->s_es->s_reserved_gdt_blocks);
+		} else
+			count += ext4_bg_num_gdb(sb, group);
+		err = ext4_scrub_report(fn, data, shift,
+					ext4_group_first_block_no(sb, group), count);
+
+		if (!err)
+			err = ext4_scrub_report(fn, data, shift,
+						ext4_block_bitmap(sb, gdp), 1);
+		if (!err)
+			err = ext4_scrub_report(fn, data, shift,
+						ext4_inode_bitmap(sb, gdp), 1);
+		if (!err)
+			err = ext4_scrub_report(fn, data, shift,
+						ext4_inode_table(sb, gdp),
+						sbi->s_itb_per_group);
+	}
+
+	/* The journal inode, unless the journal lives on another device */
+	if (err || !journal || !sbi->s_es->s_journal_inum ||
+	    journal->j_dev != journal->j_fs_dev)
+		return err;
+
+	for (i = 0; i < journal->j_maxlen && !err; i++) {
+		if (jbd2_journal_bmap(journal, i, &pblk))
+			break;
+		if (len && pblk == start + len) {
+			++len;
+			continue;
+		}
+		err = ext4_scrub_report(fn, data, shift, start, len);
+		start = pblk;
+		len = 1;
+	}
+	if (!err)
+		err = ext4_scrub_report(fn, data, shift, start, len);
+
+	return err;
+}
+#endif
+
 static inline int test_root(ext4_group_t a, int b)
 {
 	int num = b;
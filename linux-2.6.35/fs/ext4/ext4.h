@@ -1495,6 +1495,12 @@ extern int ext4_has_free_blocks(struct ext4_sb_info *sbi, s64 nblocks);
 extern void ext4_add_groupblocks(handle_t *handle, struct super_block *sb,
 				ext4_fsblk_t block, unsigned long count);
 extern ext4_fsblk_t ext4_count_free_blocks(struct super_block *);
+#ifdef CONFIG_BLK_DEV_SCRUB
+extern int ext4_scrub_allocated(struct super_block *, scrub_extent_fn *,
+				void *);
+extern int ext4_scrub_metadata(struct super_block *, scrub_extent_fn *,
+			       void *);
+#endif
 extern void ext4_check_blocks_bitmap(struct super_block *);
 extern struct ext4_group_desc * ext4_get_group_desc(struct super_block * sb,
 						    ext4_group_t block_group,
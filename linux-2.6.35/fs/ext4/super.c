@@ -1114,6 +1114,10 @@ static const struct super_operations ext4_sops = {
 	.quota_write	= ext4_quota_write,
 #endif
 	.bdev_try_to_free_page = bdev_try_to_free_page,
+#ifdef CONFIG_BLK_DEV_SCRUB
+	.scrub_allocated = ext4_scrub_allocated,
+	.scrub_metadata	= ext4_scrub_metadata,
+#endif
 };
 
 static const struct super_operations ext4_nojournal_sops = {
@@ -1133,6 +1137,10 @@ static const struct super_operations ext4_nojournal_sops = {
 	.quota_write	= ext4_quota_write,
 #endif
 	.bdev_try_to_free_page = bdev_try_to_free_page,
+#ifdef CONFIG_BLK_DEV_SCRUB
+	.scrub_allocated = ext4_scrub_allocated,
+	.scrub_metadata	= ext4_scrub_metadata,
+#endif
 };
 
 static const struct export_operations ext4_export_ops = {
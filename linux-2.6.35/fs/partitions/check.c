@@ -369,6 +369,9 @@ void delete_partition(struct gendisk *disk, int partno)
 	if (!part)
 		return;
 
+#ifdef CONFIG_BLK_DEV_SCRUB
+	blk_unregister_scrub_part(disk, partno);
+#endif
 	blk_free_devt(part_devt(part));
 	rcu_assign_pointer(ptbl->part[partno], NULL);
 	rcu_assign_pointer(ptbl->last_lookup, NULL);
@@ -466,6 +469,11 @@ struct hd_struct *add_partition(struct gendisk *disk, int partno,
 	if (!dev_get_uevent_suppress(ddev))
 		kobject_uevent(&pdev->kobj, KOBJ_ADD);
 
+#ifdef CONFIG_BLK_DEV_SCRUB
+	/* Partitions scanned before the scrubber registers are added by it */
+	blk_register_scrub_part(disk, p);
+#endif
+
 	return p;
 
 out_free_stats:
@@ -850,6 +850,12 @@ extern void ext3_free_blocks_sb (handle_t *handle, struct super_block *sb,
 				 ext3_fsblk_t block, unsigned long count,
 				unsigned long *pdquot_freed_blocks);
 extern ext3_fsblk_t ext3_count_free_blocks (struct super_block *);
+#ifdef CONFIG_BLK_DEV_SCRUB
+extern int ext3_scrub_allocated(struct super_block *, scrub_extent_fn *,
+				void *);
+extern int ext3_scrub_metadata(struct super_block *, scrub_extent_fn *,
+			       void *);
+#endif
 extern void ext3_check_blocks_bitmap (struct super_block *);
 extern struct ext3_group_desc * ext3_get_group_desc(struct super_block * sb,
 						    unsigned int block_group,
@@ -309,6 +309,7 @@ struct inodes_stat_t {
 #define BLKALIGNOFF _IO(0x12,122)
 #define BLKPBSZGET _IO(0x12,123)
 #define BLKDISCARDZEROES _IO(0x12,124)
+#define BLKSCRUB _IO(0x12,125)	/* queue ranges for scrubbing (see scrub.h) */
 
 #define BMAP_IOCTL 1		/* obsolete - kept for compatibility */
 #define FIBMAP	   _IO(0x00,1)	/* bmap access */
@@ -1555,6 +1556,11 @@ extern ssize_t vfs_readv(struct file *, const struct iovec __user *,
 extern ssize_t vfs_writev(struct file *, const struct iovec __user *,
 		unsigned long, loff_t *);
 
+#ifdef CONFIG_BLK_DEV_SCRUB
+/* Called for each extent reported to the scrubber (in 512-byte sectors) */
+typedef int (scrub_extent_fn)(void *data, sector_t sector, sector_t len);
+#endif
+
 struct super_operations {
    	struct inode *(*alloc_inode)(struct super_block *sb);
 	void (*destroy_inode)(struct inode *);
@@ -1580,6 +1586,10 @@ struct super_operations {
 	ssize_t (*quota_write)(struct super_block *, int, const char *, size_t, loff_t);
 #endif
 	int (*bdev_try_to_free_page)(struct super_block*, struct page*, gfp_t);
+#ifdef CONFIG_BLK_DEV_SCRUB
+	int (*scrub_allocated)(struct super_block *, scrub_extent_fn *, void *);
+	int (*scrub_metadata)(struct super_block *, scrub_extent_fn *, void *);
+#endif
 };
 
 /*
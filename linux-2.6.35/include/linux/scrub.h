@@ -19,6 +19,59 @@
 #ifndef _LINUX_SCRUB_H
 #define _LINUX_SCRUB_H
 
+#include <linux/types.h>
+
+/* Scrub job priorities (lower is more urgent, as with ioprio levels) */
+#define BLK_SCRUB_PRIO_HIGH	0
+#define BLK_SCRUB_PRIO_NORMAL	4
+#define BLK_SCRUB_PRIO_LOW	7
+
+/* Flags for BLKSCRUB batches */
+#define BLK_SCRUB_F_WAIT	(1 << 0) /* Wait for all ranges to be scrubbed */
+
+#define BLK_SCRUB_MAX_RANGES	1024
+
+/* A range to be scrubbed, as passed to the BLKSCRUB ioctl. Sectors are
+ * 512 bytes, relative to the start of the block device the ioctl is
+ * issued on. 'result' is set to 0 for ranges queued, or a negative errno:
+ * -EINVAL for invalid ranges, -ECANCELED for ranges left out after a
+ * queuing error. The ioctl succeeds if any range was queued. If
+ * BLK_SCRUB_F_WAIT is set, 'result' is the number of failed verifications
+ * in the range once scrubbed, and the wait may be interrupted by a fatal
+ * signal (-EINTR), leaving the ranges queued. */
+struct blk_scrub_range {
+	__u64	start;
+	__u64	len;
+	__u32	prio;
+	__s32	result;
+};
+
+struct blk_scrub_batch {
+	__u32	count; /* Number of ranges that follow */
+	__u32	flags;
+	struct blk_scrub_range ranges[0];
+};
+
+/* Sources of error log records */
+#define BLK_SCRUB_SRC_SCRUB	0 /* Found by the scrubber */
+#define BLK_SCRUB_SRC_FOREGROUND 1 /* Seen on a regular request */
+
+/* A record of the error log of a disk, as read from the binary 'errors'
+ * file in its scrubber sysfs directory, oldest first. 'seq' goes up by one
+ * for every error logged, so a gap means records were overwritten before
+ * they were read. */
+struct blk_scrub_error {
+	__u64	seq;
+	__u64	sector; /* 512-byte sector, relative to the disk */
+	__u64	time_ns; /* Wall clock time the error was logged */
+	__u8	sense_key;
+	__u8	asc;
+	__u8	ascq;
+	__u8	source; /* BLK_SCRUB_SRC_* */
+	__u32	pad;
+};
+
+#ifdef __KERNEL__
 #ifdef CONFIG_BLK_DEV_SCRUB
 
 #include <linux/kernel.h>
@@ -28,13 +81,181 @@
 #include <linux/err.h>
 #include <linux/genhd.h>
 #include <linux/fs.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/notifier.h>
+#include <linux/workqueue.h>
 #include <scsi/sg.h>
 //#include <linux/timer.h>
 
+/* Result categories returned by scsi_verify(), as in sg3_utils. Notice
+ * that some of the lower values correspond to SCSI sense key values. */
+#define SG_LIB_CAT_NOT_READY 2	/* interpreted from sense buffer */
+#define SG_LIB_CAT_MEDIUM_HARD 3	/* medium or hardware error, blank check */
+#define SG_LIB_CAT_MEDIUM_HARD_WITH_INFO 18	/* medium or hardware error sense key plus 'info' field */
+#define SG_LIB_CAT_ILLEGAL_REQ 5	/* Illegal request (not invalid opcode) */
+#define SG_LIB_CAT_UNIT_ATTENTION 6	/* interpreted from sense buffer */
+#define SG_LIB_CAT_INVALID_OP 9		/* (Illegal request,) Invalid opcode */
+#define SG_LIB_CAT_ABORTED_COMMAND 11	/* interpreted from sense buffer */
+#define SG_LIB_FILE_ERROR 15
+#define SG_LIB_CAT_NO_SENSE 20		/* sense data with key of "no sense" */
+#define SG_LIB_CAT_RECOVERED 21	/* Successful command after recovered err */
+#define SG_LIB_CAT_SENSE 98	/* Something else is in the sense buffer */
+#define SG_LIB_CAT_OTHER 99	/* Some other error/warning has occurred */
+
 #define SCRUB_STRAT_NAME_MAX	10
-#define SCRUB_STRAT_NUM		3
+#define SCRUB_STRAT_NUM		4
 #define SCRUB_PRIO_NAME_MAX	10
-#define SCRUB_PRIO_NUM		2
+#define SCRUB_PRIO_NUM		3
+#define SCRUB_WINDOWS_MAX	4
+#define SCRUB_ERRLOG_SIZE	256 /* Records per disk, a power of 2 */
+#define SCRUB_ZONES		16 /* Zones of the bandwidth profile */
+#define SCRUB_SEEK_POINTS	8 /* Points of the seek curve */
+#define SCRUB_WEAK_MAX		64 /* Weak sectors remembered per disk */
+#define SCRUB_RECOV_MAX		16 /* Regions tracked for recovered errors */
+#define SCRUB_PARTS_MAX		32 /* Sub-ranges scrubbed in parallel */
+#define SCRUB_FLASH_CHUNKS	4096 /* Chunks with a write time */
+#define SCRUB_POLICY_MAX	16 /* Partitions kept out of disk rounds */
+#define SCRUB_BAD_RECENT	16 /* Bad ranges remembered, to report once */
+#define SCRUB_LBAS_QUERIES	8 /* GET LBA STATUS lookups in flight */
+#define SCRUB_WRITTEN_JOBS	64 /* Write verification jobs pending */
+
+/* Commands used to verify sectors */
+#define SCRUB_VCMD_AUTO		0 /* ATA pass-through if there's a SATL */
+#define SCRUB_VCMD_VERIFY10	1 /* SCSI VERIFY (10) */
+#define SCRUB_VCMD_ATA16	2 /* ATA PASS-THROUGH (16) READ VERIFY EXT */
+
+/* Engines used to scrub segments */
+#define SCRUB_ENGINE_AUTO	0 /* Read where VERIFY isn't supported */
+#define SCRUB_ENGINE_VERIFY	1 /* SCSI VERIFY, or its ATA equivalent */
+#define SCRUB_ENGINE_READ	2 /* READ bios, data discarded */
+#define SCRUB_READ_PAGES	32 /* Pages of the read engine's buffer */
+
+/* Skipping of deallocated LBAs on thinly provisioned LUNs */
+#define SCRUB_THIN_AUTO		0 /* If the device supports discard */
+#define SCRUB_THIN_ON		1
+#define SCRUB_THIN_OFF		2
+
+/* Flash profile */
+#define SCRUB_FLASH_AUTO	0 /* On non-rotational queues */
+#define SCRUB_FLASH_ON		1
+#define SCRUB_FLASH_OFF		2
+
+/* Orders of regions in staggered scrubbing */
+#define SCRUB_STAG_LINEAR	0 /* Ascending, from the first region */
+#define SCRUB_STAG_ROTATE	1 /* Ascending, from an offset moving per round */
+#define SCRUB_STAG_RANDOM	2 /* Ascending, from a random offset */
+#define SCRUB_STAG_VDC		3 /* Van der Corput permutation, rotating */
+
+/* Actions taken on weak sectors */
+#define SCRUB_WEAK_NONE		0
+#define SCRUB_WEAK_REWRITE	1 /* Notifiers (e.g. md) rewrite them */
+#define SCRUB_WEAK_REASSIGN	2 /* SCSI REASSIGN BLOCKS */
+
+/* A range of sectors that verifies, but only slowly */
+struct scrub_weak {
+	uint64_t	sector;
+	unsigned int	len;
+	unsigned int	count; /* Times found slow */
+	uint32_t	us; /* Last response time */
+	unsigned long	stamp; /* Last time found slow (seconds) */
+};
+
+/* A GET LBA STATUS lookup in flight, from chunk onwards */
+struct scrub_lbas_lookup {
+	int		busy;
+	uint64_t	chunk;
+	uint64_t	raced; /* First chunk written since it started */
+};
+
+/* A range recently reported bad */
+struct scrub_bad {
+	uint64_t	sector;
+	uint64_t	len;
+	unsigned long	stamp; /* When reported (jiffies, 0: unused) */
+};
+
+/* A region where the drive had to recover data */
+struct scrub_recov {
+	uint64_t	start; /* First sector of the region */
+	unsigned int	errors; /* Recovered errors since the last rescrub */
+	unsigned int	rescrubs; /* Rescrubs queued so far */
+	unsigned long	due; /* Earliest next rescrub (seconds) */
+	unsigned long	stamp; /* Last recovered error (seconds) */
+};
+
+/* Sense data of a failed verification */
+struct scrub_sense {
+	uint64_t	info; /* LBA reported with a medium error */
+	unsigned char	key;
+	unsigned char	asc;
+	unsigned char	ascq;
+};
+
+/* Bitmap of 1MB chunks of a disk, see block/scrub_map.c */
+#define SCRUB_MAP_ALLOCATED	0 /* Chunks holding allocated blocks */
+#define SCRUB_MAP_METADATA	1 /* Chunks holding filesystem/RAID metadata */
+
+struct scrub_map {
+	unsigned long	*bits;
+	uint64_t	nbits; /* Number of chunks */
+	uint64_t	sectors; /* Sectors in marked chunks */
+};
+
+/* Time-of-day window where scrubbing is allowed (seconds since midnight) */
+struct scrub_window {
+	unsigned int	start;
+	unsigned int	end;
+};
+
+/* Scrub policy of a partition, see block/scrub_part.c */
+struct scrub_policy {
+	struct kobject	kobj;
+	struct list_head list;
+	struct disk_scrubber *ds;
+	int		partno;
+	int		own; /* Scrubbed in rounds of its own, not the disk's */
+	int		strategy; /* 1 + index in the strategy names (0: disk's) */
+	int		priority; /* 1 + index in the priority names (0: disk's) */
+	uint64_t	delayms; /* Delay between commands */
+	uint64_t	period_s; /* Seconds between rounds (0: never) */
+	unsigned long	next_start; /* When the next round is due (seconds) */
+	unsigned int	rounds; /* Rounds started so far */
+};
+
+struct scrub_job;
+typedef void (scrub_end_io_t)(struct scrub_job *job);
+
+#define SCRUB_JOB_RESCAN	(1 << 0) /* Rescan around a medium error */
+#define SCRUB_JOB_WRITTEN	(1 << 1) /* Verification of written chunks */
+
+/* A range queued for scrubbing, outside of (or ahead of) the round */
+struct scrub_job {
+	struct list_head list;
+	uint64_t	start; /* First sector of the range */
+	uint64_t	len; /* Number of sectors in the range */
+	uint64_t	pos; /* Next sector to be scrubbed */
+	int		prio; /* BLK_SCRUB_PRIO_* */
+	unsigned int	flags; /* SCRUB_JOB_* */
+	uint64_t	chunk; /* Sectors per verification (0: segsize) */
+	int		errors; /* Number of failed verifications */
+	uint64_t	bad_sector; /* First sector that failed verification */
+	uint64_t	bad_sectors; /* Number of sectors found bad */
+	scrub_end_io_t	*end_io; /* Called from the scrubber thread */
+	void		*private;
+};
+
+/* Events passed to scrub notifiers */
+#define SCRUB_EVENT_BAD_SECTOR	1 /* A bad sector was pinpointed */
+#define SCRUB_EVENT_METADATA	2 /* Report metadata areas through report */
+
+struct scrub_event {
+	struct gendisk	*disk;
+	uint64_t	sector; /* First bad sector, relative to the disk */
+	uint64_t	len; /* Number of bad sectors */
+	scrub_extent_fn	*report; /* Takes extents relative to the disk */
+	void		*data; /* Passed to report */
+};
 
 struct disk_scrubber {
 	/* Pointer to the name of the gendisk we're scrubbing 
@@ -47,11 +268,31 @@ struct disk_scrubber {
 	char		*priority;
 	uint64_t	segsize; /* Segment size of scrubber */
 	uint64_t	regsize; /* Region size of scrubber */
+	int		stag_order; /* SCRUB_STAG_* */
+	uint64_t	stag_burst; /* Segments per region visit */
+	unsigned int	hybrid_idle_ms; /* Idle time that calls for sequential runs */
+	unsigned int	parts; /* Sub-ranges scrubbed in parallel (0: detect) */
+	uint64_t	stripe_kb; /* Stripe unit (0: detect) */
+
+	/* Flash profile */
+	int		flash; /* SCRUB_FLASH_* */
+	unsigned int	flash_depth; /* Commands in flight */
+	unsigned int	flash_rate_mbs; /* Rate cap in MB/s (0: none) */
+	uint32_t	*wtime; /* Last write time per chunk (seconds, 0: unknown) */
+	atomic64_t	fg_last; /* End of the last foreground request */
+	unsigned int	fg_local; /* Share of local foreground requests (of 1024) */
 
 	int		state; /* State of scrubber: {on, off} */
 	int		threads; /* Number of threads used by scrubber */
 	int		dpo; /* Disable page out */
 	int		vrprotect; /* VRP value */
+	int		vcmd; /* SCRUB_VCMD_* */
+	int		ata_pt; /* Probed ATA pass-through support (-1: unknown) */
+	int		engine; /* SCRUB_ENGINE_* */
+	int		use_read; /* Whether segments are read (-1: unknown) */
+	struct page	*rpages[SCRUB_READ_PAGES]; /* Read engine buffer */
+	struct block_device *rbdev; /* Read through, until the scrubber idles */
+	struct mutex	rbdev_lock;
 	int		verbose; /* Verbosity of scrubber */
 
 	int		timed; /* Whether we should keep scrubbing stats */
@@ -66,6 +307,103 @@ struct disk_scrubber {
 	struct timespec	idle;
 	uint64_t	delayms;
 
+	/* Deadline-driven pacing */
+	uint64_t	deadline_s; /* Pass deadline (0: use period_s) */
+	int64_t		remaining_s; /* Projected time until the pass completes */
+	unsigned long	completion_s; /* Projected completion (seconds) */
+	int64_t		slack_s; /* Time left before the deadline when done */
+
+	/* Periodic scrubbing */
+	uint64_t	period_s; /* Seconds between automatic rounds (0: off) */
+	int		stagger; /* Whether to stagger the first round */
+	unsigned int	slot; /* Stagger slot of the disk */
+	unsigned long	next_start; /* When the next round is due (seconds) */
+	int		nwindows; /* Number of time-of-day windows (0: any) */
+	struct scrub_window windows[SCRUB_WINDOWS_MAX];
+
+	/* Partition policies */
+	struct list_head policies;
+	int		part_round; /* Partition of the current round (0: disk) */
+
+	atomic_t	bad_sectors; /* Bad sectors pinpointed so far */
+
+	/* Rescans around medium errors */
+	uint64_t	rescan_radius; /* Sectors rescanned on either side */
+	uint64_t	rescan_chunk; /* Sectors per rescan verification */
+	spinlock_t	bad_lock;
+	struct scrub_bad bad_recent[SCRUB_BAD_RECENT]; /* Reported lately */
+
+	/* Filesystem-aware scrubbing */
+	int		fsaware; /* Whether only allocated blocks are scrubbed */
+	unsigned int	free_interval; /* Rounds between scrubs of free space */
+	unsigned int	rounds; /* Rounds started so far */
+	struct scrub_map amap; /* Allocation map */
+
+	/* Metadata tier */
+	uint64_t	meta_period_s; /* Seconds between extra metadata passes (0: none) */
+	unsigned long	meta_next; /* When the next metadata pass is due */
+	struct scrub_map meta; /* Metadata map */
+
+	/* Provisioning cache of thinly provisioned LUNs */
+	int		thin; /* SCRUB_THIN_* */
+	int		lbp; /* GET LBA STATUS support (-1: unknown) */
+	spinlock_t	lbas_lock;
+	struct scrub_lbas_lookup lbas_lookups[SCRUB_LBAS_QUERIES];
+	struct scrub_map lbas_known; /* Chunks with a cached status */
+	struct scrub_map lbas_mapped; /* Chunks holding mapped LBAs */
+
+	/* Verification of written data */
+	uint64_t	wverify_delay_s; /* Age of the batches (0: off) */
+	spinlock_t	wdirty_lock;
+	struct scrub_map wdirty; /* Chunks written since the last batch */
+	struct scrub_map wflush; /* Chunks of the batch being queued */
+	unsigned long	wdirty_since; /* First write of the batch (seconds) */
+	uint64_t	wverified; /* Sectors queued for verification so far */
+
+	/* Zone bandwidth profile, over SCRUB_ZONES equal LBA ranges */
+	int		zoned; /* Whether command sizes follow the profile */
+	int		zone_learn; /* Whether the profile is learned (not given) */
+	uint32_t	zone_kbs[SCRUB_ZONES]; /* KB/s per zone (0: unknown) */
+	unsigned int	zone_idle_ms; /* Idle time that calls for slow zones (0: off) */
+	unsigned long	idle_ios; /* Foreground requests seen so far */
+	unsigned long	idle_since; /* Last foreground activity (jiffies) */
+	atomic_long_t	rios; /* Read engine bios completed so far */
+	unsigned long	idle_rios; /* rios when idle_ios was sampled */
+
+	/* Cost model, from the last characterization (or restored) */
+	uint32_t	cost_cmd_us; /* Per-command overhead (0: unknown) */
+	uint32_t	cost_seek_us[SCRUB_SEEK_POINTS]; /* Seek time over
+						   * capacity >> 2k sectors */
+	int		trackalign; /* Whether segments span whole tracks */
+	uint64_t	track_start[SCRUB_ZONES]; /* A track boundary per zone */
+	uint32_t	track_len[SCRUB_ZONES]; /* Sectors per track (0: unknown) */
+
+	/* Weak sectors, found from response time outliers */
+	unsigned int	weak_factor; /* Allowed extra overheads per command (0: off) */
+	int		weak_action; /* SCRUB_WEAK_* */
+	unsigned int	nweak;
+	struct scrub_weak weak[SCRUB_WEAK_MAX];
+
+	/* Regions with recovered errors, rescrubbed more often */
+	atomic_t	recovered; /* Recovered errors seen so far */
+	uint64_t	recov_region; /* Sectors per region (0: off) */
+	unsigned int	recov_threshold; /* Errors per interval that call for a rescrub */
+	unsigned int	recov_interval_s; /* Minimum time between rescrubs */
+	spinlock_t	recov_lock;
+	struct scrub_recov recov[SCRUB_RECOV_MAX];
+
+	/* Ring buffer of the last errors seen on the disk */
+	struct blk_scrub_error *errlog;
+	uint64_t	errlog_seq; /* Sequence number of the next record */
+	uint64_t	errlog_sent; /* Next record to send a uevent for */
+	spinlock_t	errlog_lock;
+	struct work_struct errlog_work;
+
+	/* Queue of pending scrub jobs, sorted by priority */
+	struct list_head jobs;
+	spinlock_t	joblock;
+	unsigned int	njobs;
+
 	/* Embedded kobject for the scrubber */
 	struct kobject	kobj;
 	struct mutex	sysfs_lock;
@@ -74,9 +412,84 @@ struct disk_scrubber {
 int kscrubd_init(void *data);
 int blk_register_scrub(struct gendisk *disk);
 void blk_unregister_scrub(struct gendisk *disk);
-int scsi_verify(struct gendisk *disk, uint64_t lba, unsigned int count);
+unsigned int scrub_block_sectors(struct gendisk *disk);
+int scsi_verify(struct gendisk *disk, uint64_t sector, unsigned int count,
+	struct scrub_sense *sense);
 int scrubber(struct gendisk *disk);
+int scrub_read_init(struct disk_scrubber *s);
+void scrub_read_exit(struct disk_scrubber *s);
+
+int blk_scrub_range(struct gendisk *disk, uint64_t start, uint64_t len,
+	int prio, scrub_end_io_t *end_io, void *private, gfp_t gfp_mask);
+int blk_scrub_rescan(struct gendisk *disk, uint64_t sector, uint64_t len,
+	gfp_t gfp_mask);
+int scrub_bad_reported(struct disk_scrubber *s, uint64_t sector,
+	uint64_t len);
+int scrub_queue_written(struct disk_scrubber *s, uint64_t start,
+	uint64_t len);
+struct scrub_job *scrub_dequeue_job(struct disk_scrubber *s, int maxprio);
+void scrub_requeue_job(struct disk_scrubber *s, struct scrub_job *job);
+void scrub_end_job(struct scrub_job *job);
+void scrub_flush_jobs(struct disk_scrubber *s);
+int blk_scrub_ioctl(struct block_device *bdev,
+	struct blk_scrub_batch __user *arg);
+int register_scrub_notifier(struct notifier_block *nb);
+int unregister_scrub_notifier(struct notifier_block *nb);
+void scrub_notify_bad_sector(struct gendisk *disk, uint64_t sector,
+	uint64_t len);
+void scrub_notify_metadata(struct gendisk *disk, scrub_extent_fn *report,
+	void *data);
+
+int scrub_errlog_init(struct disk_scrubber *s);
+void scrub_errlog_exit(struct disk_scrubber *s);
+void blk_scrub_log_error(struct gendisk *disk, uint64_t sector,
+	unsigned char key, unsigned char asc, unsigned char ascq, int source);
+void blk_scrub_recovered(struct gendisk *disk, uint64_t sector,
+	unsigned char asc, unsigned char ascq, int source);
+extern struct bin_attribute scrub_errlog_attr;
+
+int scrub_map_build(struct disk_scrubber *s, struct scrub_map *map,
+	int type);
+void scrub_map_free(struct scrub_map *map);
+int scrub_map_marked(struct scrub_map *map, uint64_t pos, uint64_t count);
+int scrub_map_next(struct scrub_map *map, uint64_t pos, uint64_t *start,
+	uint64_t *len);
+int scrub_lbas_mapped(struct disk_scrubber *s, uint64_t pos, uint64_t count);
+void scrub_lbas_free(struct disk_scrubber *s);
+void blk_scrub_written(struct gendisk *disk, uint64_t sector, uint64_t len,
+	int discard);
+int scrub_wdirty_init(struct disk_scrubber *s);
+void scrub_wdirty_free(struct disk_scrubber *s);
+int scrub_wdirty_due(struct disk_scrubber *s);
+long scrub_wdirty_timeout(struct disk_scrubber *s);
+void scrub_wdirty_flush(struct disk_scrubber *s);
+uint64_t scrub_wdirty_pending(struct disk_scrubber *s);
+void blk_scrub_seen(struct gendisk *disk, uint64_t sector, uint64_t len);
+void scrub_read_end_io(struct bio *bio, int error);
+int scrub_wtime_init(struct disk_scrubber *s);
+void scrub_wtime_free(struct disk_scrubber *s);
+unsigned int scrub_wtime_chunk(struct gendisk *disk, uint64_t pos);
+uint64_t scrub_wtime_start(struct gendisk *disk, unsigned int chunk);
+int scsi_get_lba_status(struct gendisk *disk, uint64_t sector, void *resp,
+	int alloc_len);
+int scsi_reassign_blocks(struct gendisk *disk, uint64_t sector,
+	unsigned int count);
+
+int blk_register_scrub_part(struct gendisk *disk, struct hd_struct *part);
+void blk_unregister_scrub_part(struct gendisk *disk, int partno);
+struct scrub_policy *scrub_policy_find(struct disk_scrubber *s, int partno);
+int scrub_policy_due(struct disk_scrubber *s);
+long scrub_policy_timeout(struct disk_scrubber *s);
+void scrub_policy_advance(struct disk_scrubber *s, unsigned long started);
+
+unsigned int scrub_sched_slot(void);
+void scrub_sched_reset(struct disk_scrubber *s);
+void scrub_sched_advance(struct disk_scrubber *s, unsigned long started);
+unsigned long scrub_window_wait(struct disk_scrubber *s, unsigned long now);
+int scrub_parse_windows(const char *p, struct scrub_window *w);
+int scrub_print_windows(struct disk_scrubber *s, char *page);
 
 #endif /* CONFIG_BLK_DEV_SCRUB */
+#endif /* __KERNEL__ */
 
 #endif